@@ -130,4 +130,24 @@ namespace msctl { namespace agent {
         pp_.stop_all( );
     }
 
+    std::string application::get_key( const std::string &id ) const
+    {
+        std::string any;
+
+        auto f = cmd_options_.find( "key" );
+        if( f == cmd_options_.end( ) ) {
+            return any;
+        }
+
+        for( auto &k: f->second.as<std::vector<std::string> >( ) ) {
+            auto pos = k.find( ':' );
+            if( pos == std::string::npos ) {
+                any = k;
+            } else if( k.compare( 0, pos, id ) == 0 ) {
+                return k.substr( pos + 1 );
+            }
+        }
+        return any;
+    }
+
 }}
@@ -172,6 +172,10 @@ namespace msctl { namespace agent {
 
         void quit( );
 
+        /// the key of the --key options for the id; a key without id
+        /// is for any id; "" if there is nothing
+        std::string get_key( const std::string &id ) const;
+
     };
 
 }}
@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "common/cmd-iface.h"
+#include "boost/program_options.hpp"
+#include "boost/asio/io_service.hpp"
+#include "common/integrity.h"
+#include "common/compress.h"
+#include "common/fec.h"
+#include "common/udp-batch.h"
+
+namespace msctl { namespace agent { namespace cmd {
+
+    namespace {
+
+        namespace po = boost::program_options;
+
+        using clock_type = std::chrono::steady_clock;
+        using check_call = std::function<void (const char *, size_t,
+                                               std::uint8_t *)>;
+
+        struct impl: public common::cmd_iface {
+
+            std::uint32_t size_  = 1400;
+            std::uint32_t count_ = 1000000;
+            std::uint32_t batch_ = 32;
+            bool          udp_   = false;
+
+            /// the results go here; the loop can't be thrown away
+            volatile std::uint8_t sink_ = 0;
+
+            /// nanoseconds per frame
+            double measure( const check_call &call,
+                            const std::vector<char> &frame )
+            {
+                std::uint8_t result[64] = { 0 };
+
+                auto begin = clock_type::now( );
+                for( std::uint32_t i = 0; i < count_; ++i ) {
+                    call( &frame[0], frame.size( ), result );
+                    sink_ = sink_ ^ result[0];
+                }
+                auto time = clock_type::now( ) - begin;
+
+                using ns = std::chrono::nanoseconds;
+                return double(std::chrono::duration_cast<ns>( time ).count( ))
+                     / double(count_);
+            }
+
+            void show( const std::string &name, double ns )
+            {
+                /// bytes per nanosecond is GB per second
+                const double gbs = ns > 0 ? double(size_) / ns : 0.0;
+                std::cout << std::setw( 12 ) << std::left  << name
+                          << std::setw( 12 ) << std::right << std::fixed
+                          << std::setprecision( 1 ) << ns << " ns/frame"
+                          << std::setw( 10 ) << std::setprecision( 2 )
+                          << gbs << " GB/s\n";
+            }
+
+            /// datagrams over loopback: batch by batch, sent and then
+            /// received; nanoseconds per datagram
+            double measure_udp( size_t batch, bool native )
+            {
+                namespace ba = boost::asio;
+                using udp    = ba::ip::udp;
+
+                ba::io_service ios;
+                const udp::endpoint local( ba::ip::address_v4::loopback( ),
+                                           0 );
+                udp::socket rcv( ios, local );
+                udp::socket snd( ios, local );
+                rcv.non_blocking( true );
+                snd.non_blocking( true );
+
+                std::vector<char> out( size_ );
+                std::vector<char> in( batch * size_ );
+                std::vector<common::udp_datagram> dgs( batch );
+
+                std::uint64_t lost = 0;
+                auto begin = clock_type::now( );
+
+                for( std::uint32_t done = 0; done < count_; ) {
+
+                    const size_t n = std::min<size_t>( batch,
+                                                       count_ - done );
+                    for( size_t i = 0; i < n; ++i ) {
+                        dgs[i].data = &out[0];
+                        dgs[i].len  = out.size( );
+                        dgs[i].peer = rcv.local_endpoint( );
+                    }
+                    size_t sent = 0;
+                    while( sent < n ) {
+                        const int res = native
+                            ? common::udp_send_batch( snd.native_handle( ),
+                                                      &dgs[sent], n - sent )
+                            : common::udp_send_batch( snd.native_handle( ),
+                                                      &dgs[sent], 1 );
+                        if( res < 0 ) {
+                            return 0.0;
+                        }
+                        sent += static_cast<size_t>(res);
+                    }
+
+                    size_t got = 0;
+                    size_t idle = 0;
+                    while( got < n && idle < 1000 ) {
+                        for( size_t i = 0; i < n - got; ++i ) {
+                            dgs[i].data = &in[i * size_];
+                            dgs[i].len  = size_;
+                        }
+                        const int res = native
+                            ? common::udp_recv_batch( rcv.native_handle( ),
+                                                      &dgs[0], n - got )
+                            : common::udp_recv_batch( rcv.native_handle( ),
+                                                      &dgs[0], 1 );
+                        if( res < 0 ) {
+                            return 0.0;
+                        }
+                        idle = res ? 0 : idle + 1;
+                        got += static_cast<size_t>(res);
+                    }
+                    lost += n - got;
+                    done += static_cast<std::uint32_t>(n);
+                    sink_ = sink_ ^ static_cast<std::uint8_t>(in[0]);
+                }
+                auto time = clock_type::now( ) - begin;
+
+                if( lost ) {
+                    std::cout << "lost " << lost << " datagrams\n";
+                }
+
+                using ns = std::chrono::nanoseconds;
+                return double(std::chrono::duration_cast<ns>( time ).count( ))
+                     / double(count_);
+            }
+
+            /// trains of datagrams: an entry of the batch with a segment is
+            /// sent with UDP_SEGMENT, the receiver reads trains of UDP_GRO
+            double measure_train( size_t batch )
+            {
+                namespace ba = boost::asio;
+                using udp    = ba::ip::udp;
+
+                ba::io_service ios;
+                const udp::endpoint local( ba::ip::address_v4::loopback( ),
+                                           0 );
+                udp::socket rcv( ios, local );
+                udp::socket snd( ios, local );
+                rcv.non_blocking( true );
+                snd.non_blocking( true );
+                common::udp_set_gro( rcv.native_handle( ), true );
+
+                /// the train fits a datagram of the biggest size
+                batch = std::min<size_t>( batch, 65000 / size_ );
+                batch = std::max<size_t>( batch, 1 );
+
+                std::vector<char> out( batch * size_ );
+                std::vector<char> in( 64 * 1024 );
+                const auto peer = rcv.local_endpoint( );
+
+                std::uint64_t lost = 0;
+                auto begin = clock_type::now( );
+
+                for( std::uint32_t done = 0; done < count_; ) {
+
+                    const size_t n = std::min<size_t>( batch,
+                                                       count_ - done );
+                    common::udp_datagram train;
+                    train.peer    = peer;
+                    train.data    = &out[0];
+                    train.len     = n * size_;
+                    train.segment = n > 1 ? size_ : 0;
+                    if( common::udp_send_batch( snd.native_handle( ),
+                                                &train, 1 ) < 0 )
+                    {
+                        return 0.0;
+                    }
+
+                    size_t got  = 0;
+                    size_t idle = 0;
+                    while( got < n && idle < 1000 ) {
+                        common::udp_datagram dg;
+                        dg.data = &in[0];
+                        dg.len  = in.size( );
+                        const int res = common::udp_recv_batch(
+                                            rcv.native_handle( ), &dg, 1 );
+                        if( res < 0 ) {
+                            return 0.0;
+                        }
+                        if( res == 0 ) {
+                            ++idle;
+                            continue;
+                        }
+                        idle = 0;
+                        got += dg.segment
+                             ? ( dg.len + dg.segment - 1 ) / dg.segment
+                             : 1;
+                    }
+                    lost += n > got ? n - got : 0;
+                    done += static_cast<std::uint32_t>(n);
+                    sink_ = sink_ ^ static_cast<std::uint8_t>(in[0]);
+                }
+                auto time = clock_type::now( ) - begin;
+
+                if( lost ) {
+                    std::cout << "lost " << lost << " datagrams\n";
+                }
+
+                using ns = std::chrono::nanoseconds;
+                return double(std::chrono::duration_cast<ns>( time ).count( ))
+                     / double(count_);
+            }
+
+            int run_udp( )
+            {
+                const size_t batch = std::max<size_t>( 1,
+                                std::min<size_t>( batch_,
+                                                  common::udp_batch_max ) );
+
+                std::cout << "UDP loopback; " << size_ << " bytes, "
+                          << count_ << " datagrams, batch " << batch
+                          << ( common::udp_batch_native( )
+                               ? "" : " (no mmsg calls)" ) << "\n";
+
+                show( "one-by-one", measure_udp( batch, false ) );
+                show( "batched",    measure_udp( batch, true ) );
+
+                if( common::udp_offload_native( ) ) {
+                    show( "gso/gro", measure_train( batch ) );
+                } else {
+                    std::cout << "gso/gro: no system support\n";
+                }
+                return 0;
+            }
+
+            int run( const boost::program_options::variables_map & ) override
+            {
+                if( size_ == 0 || count_ == 0 ) {
+                    std::cerr << "size and count have to be positive\n";
+                    return 1;
+                }
+
+                if( udp_ ) {
+                    return run_udp( );
+                }
+
+                std::vector<char> frame( size_ );
+                for( size_t i = 0; i < frame.size( ); ++i ) {
+                    frame[i] = static_cast<char>(i * 131 + 7);
+                }
+
+                std::cout << "Frame integrity, compression and fec; "
+                          << size_ << " bytes, " << count_ << " frames\n";
+
+                auto none = common::create_integrity( "none" );
+                show( "none", measure(
+                    [&none]( const char *d, size_t l, std::uint8_t *r )
+                    {
+                        none->get( d, l, r );
+                    }, frame ) );
+
+                show( "crc32c-sw", measure(
+                    [ ]( const char *d, size_t l, std::uint8_t *r )
+                    {
+                        r[0] = static_cast<std::uint8_t>(
+                                    common::crc32c_soft( d, l ) );
+                    }, frame ) );
+
+                if( common::crc32c_hardware( ) ) {
+                    auto crc = common::create_integrity( "crc32c" );
+                    show( "crc32c", measure(
+                        [&crc]( const char *d, size_t l, std::uint8_t *r )
+                        {
+                            crc->get( d, l, r );
+                        }, frame ) );
+                } else {
+                    std::cout << "crc32c: no cpu support; the same as "
+                                 "crc32c-sw\n";
+                }
+
+                /// the frame compresses well; the random one doesn't and
+                /// shows the cost of the match finder skipping it
+                auto lz4 = common::create_compressor( "lz4" );
+                std::vector<char> packed( lz4->max_compressed( size_ ) );
+                auto *ppos = &packed[0];
+                const size_t plen = lz4->compress( &frame[0], frame.size( ),
+                                                   ppos, packed.size( ) );
+
+                show( "lz4", measure(
+                    [&lz4, ppos, &packed]( const char *d, size_t l,
+                                           std::uint8_t *r )
+                    {
+                        r[0] = static_cast<std::uint8_t>(
+                                    lz4->compress( d, l, ppos,
+                                                   packed.size( ) ) );
+                    }, frame ) );
+
+                std::vector<char> unpacked( size_ );
+                auto *upos = &unpacked[0];
+                show( "lz4-dec", measure(
+                    [&lz4, ppos, plen, upos]( const char *, size_t l,
+                                              std::uint8_t *r )
+                    {
+                        r[0] = lz4->decompress( ppos, plen, upos, l );
+                    }, frame ) );
+
+                std::vector<char> noise( size_ );
+                std::uint32_t state = 2463534242U;
+                for( auto &n: noise ) {
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    n = static_cast<char>(state);
+                }
+                show( "lz4-rand", measure(
+                    [&lz4, ppos, &packed]( const char *d, size_t l,
+                                           std::uint8_t *r )
+                    {
+                        r[0] = static_cast<std::uint8_t>(
+                                    lz4->compress( d, l, ppos,
+                                                   packed.size( ) ) );
+                    }, noise ) );
+
+                /// one repair frame of a fec group: the frame multiplied
+                /// by a coefficient and added to the repair
+                std::vector<std::uint8_t> repair( size_ );
+                auto *rpos = &repair[0];
+
+                show( "gf256-sw", measure(
+                    [rpos]( const char *d, size_t l, std::uint8_t *r )
+                    {
+                        common::gf256_mul_add_soft( rpos,
+                                reinterpret_cast<const std::uint8_t *>(d),
+                                0x8E, l );
+                        r[0] = rpos[0];
+                    }, frame ) );
+
+                if( common::gf256_simd( ) ) {
+                    show( "gf256", measure(
+                        [rpos]( const char *d, size_t l, std::uint8_t *r )
+                        {
+                            common::gf256_mul_add( rpos,
+                                reinterpret_cast<const std::uint8_t *>(d),
+                                0x8E, l );
+                            r[0] = rpos[0];
+                        }, frame ) );
+                } else {
+                    std::cout << "gf256: no cpu support; the same as "
+                                 "gf256-sw\n";
+                }
+
+                return 0;
+            }
+
+            void opts( options_description &desc ) override
+            {
+                desc.add_options( )
+                ("size,s", po::value<std::uint32_t>( &size_ ),
+                        "frame size in bytes; default = 1400")
+                ("count", po::value<std::uint32_t>( &count_ ),
+                        "frames for every algorithm; default = 1000000")
+                ("udp", po::bool_switch( &udp_ ),
+                        "datagram system calls instead: one by one, "
+                        "recvmmsg/sendmmsg and UDP GSO/GRO over loopback")
+                ("batch", po::value<std::uint32_t>( &batch_ ),
+                        "datagrams of one batched call; default = 32")
+                ;
+            }
+
+            std::string desc(  ) const
+            {
+                return "Per-frame cost of the integrity, compression and fec "
+                       "algorithms or of the datagram system calls.";
+            }
+
+        };
+    }
+
+    namespace bench {
+        void create( common::cmd_map &all_map )
+        {
+            common::cmd_ptr ptr( new impl );
+            all_map.emplace( std::make_pair( "bench", std::move(ptr) ) );
+        }
+    }
+
+}}}
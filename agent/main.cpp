@@ -24,6 +24,7 @@ using namespace msctl;
 namespace msctl { namespace agent { namespace cmd {
 
     namespace tuntap { void create( common::cmd_map &all ); }
+    namespace bench  { void create( common::cmd_map &all ); }
 
 }}}
 
@@ -68,6 +69,7 @@ namespace {
     {
         common::cmd_map res;
         agent::cmd::tuntap::create( res );
+        agent::cmd::bench::create( res );
         return res;
     }
 
@@ -1,10 +1,20 @@
 #ifndef MSCTL_NONAME_COMMON_H
 #define MSCTL_NONAME_COMMON_H
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 #include "protocol/tuntap.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
 #include "srpc/common/protocol/binary.h"
+#include "srpc/common/hash/interface.h"
 
 #include "srpc/client/connector/async/tcp.h"
 #include "srpc/client/connector/async/udp.h"
@@ -16,6 +26,18 @@
 
 #include "application.h"
 
+#include "common/tuntap.h"
+#include "common/compress.h"
+#include "common/header-compress.h"
+#include "common/integrity.h"
+#include "common/aead.h"
+#include "common/write-stat.h"
+#include "common/fragment.h"
+#include "common/replay-window.h"
+#include "common/reorder-buffer.h"
+#include "common/fec.h"
+#include "common/udp-port.h"
+
 namespace msctl { namespace agent { namespace noname {
 
     using error_code       = srpc::common::transport::error_code;
@@ -29,19 +51,122 @@ namespace msctl { namespace agent { namespace noname {
     using tcp_connector    = srpc::client::connector::async::tcp;
     using udp_connector    = srpc::client::connector::async::udp;
 
+    /// read block of a stream transport; the same for both sides
+    static const size_t tcp_read_block   = 16 * 1024;
+
+    /// buffer of a datagram transport; fits any UDP datagram
+    static const size_t udp_datagram_max = 64 * 1024;
+
+    /// space for the tag, message fields, hash and size prefix
+    static const size_t frame_overhead   = 1024;
+
+    /// frame limit for packets of the block size
+    inline size_t frame_maxlen( size_t block )
+    {
+        return block + frame_overhead;
+    }
+
+    /// calls; the same numbers are used in fast frames
+    enum opcode {
+        OP_NONE    = 0,     /// empty call; always succeeds
+        OP_INIT    = 1,
+        OP_REG     = 2,
+        OP_REGOK   = 3,
+        OP_PUSH    = 4,
+        OP_BATCH   = 5,     /// fast frames only; several packets
+        OP_HCRESET = 6,     /// fast frames only; a header context is lost
+        OP_FEC     = 7,     /// fast frames only; a frame of a fec group
+        OP_UNKNOWN = 8,
+        OP_COUNT   = 9,
+    };
+
+    inline opcode opcode_by_name( const std::string &name )
+    {
+        static const char *names[OP_UNKNOWN] = {
+            "", "init", "reg", "regok", "push", "batch", "hcreset", "fec"
+        };
+        for( int i = OP_NONE; i < OP_UNKNOWN; ++i ) {
+            if( name == names[i] ) {
+                return static_cast<opcode>(i);
+            }
+        }
+        return OP_UNKNOWN;
+    }
+
+    /// features negotiated by "init"
+    enum frame_features {
+        FEATURE_FAST_FRAMES  = 0x01,
+        FEATURE_BATCH_FRAMES = 0x02,
+        FEATURE_HEADER_COMP  = 0x04,    /// needs fast frames
+        FEATURE_FRAGMENTS    = 0x08,    /// datagram transports only
+        FEATURE_SEQUENCE     = 0x10,    /// datagram transports only
+        FEATURE_FEC          = 0x20,    /// the same; needs fast frames
+    };
+
+    static const std::uint32_t supported_features = FEATURE_FAST_FRAMES
+                                                  | FEATURE_BATCH_FRAMES
+                                                  | FEATURE_HEADER_COMP
+                                                  | FEATURE_FRAGMENTS
+                                                  | FEATURE_SEQUENCE
+                                                  | FEATURE_FEC;
+
+    /// header compression is asked for by the options only
+    static const std::uint32_t default_features = FEATURE_FAST_FRAMES
+                                                | FEATURE_BATCH_FRAMES;
+
+    /// fast frame: mark, opcode, 4 bytes of big endian length, data.
+    /// A protobuf message can't start with 0; the tag 0 is not valid
+    static const std::uint8_t fast_frame_mark   = 0x00;
+    static const size_t       fast_header_size  = 6;
+
+    /// compressed frames start with the mode byte
+    enum pack_mode {
+        PACK_RAW = 0,
+        PACK_LZ  = 1,   /// 4 bytes of big endian length, compressed data
+    };
+
+    static const size_t pack_mode_size   = 1;
+    static const size_t pack_header_size = 5;
+
+    /// encrypted frames: 8 bytes of big endian counter, data, the tag
+    static const size_t seal_head_size   = 8;
+    static const size_t seal_salt_size   = 16;
+
+    /// sequenced frames: 4 bytes of big endian number, data
+    static const size_t seq_head_size    = 4;
+
+    /// before the frame data
+    static const size_t pack_headroom    = pack_mode_size + seal_head_size
+                                         + common::frag_whole_head
+                                         + seq_head_size;
+
+    /// a protected packet frame: the fast header of OP_FEC, the fec
+    /// header and the packet frame; with sequence numbers the number of
+    /// the frame goes before the packet frame and is protected with it
+    static const size_t fec_frame_head   = fast_header_size
+                                         + common::fec_head_size;
+
+    /// frames in one corked write if the options say nothing
+    static const size_t       cork_frames_default = 64;
+
+    /// batch frame data: 2 bytes of big endian length and a packet,
+    /// one by one
+    static const size_t       batch_entry_header = 2;
+    static const size_t       batch_entry_max    = 0xFFFF;
+
     template <typename T>
     struct connector_to_size_policy;
 
     template <>
     struct connector_to_size_policy<tcp_connector> {
         using policy = tcp_size_policy;
-        static const size_t maxlen = 8096;
+        static const size_t maxlen = tcp_read_block;
     };
 
     template <>
     struct connector_to_size_policy<udp_connector> {
         using policy = udp_size_policy;
-        static const size_t maxlen = 45 * 1024;
+        static const size_t maxlen = udp_datagram_max;
     };
 
 
@@ -54,19 +179,58 @@ namespace msctl { namespace agent { namespace noname {
     template <>
     struct acceptor_to_size_policy<tcp_acceptor> {
         using policy = tcp_size_policy;
-        static const size_t maxlen = 4 * 1024;
+        static const size_t maxlen = tcp_read_block;
     };
 
     template <>
     struct acceptor_to_size_policy<udp_acceptor> {
         using policy = udp_size_policy;
-        static const size_t maxlen = 45 * 1024;
+        static const size_t maxlen = udp_datagram_max;
     };
 
+
     template <typename SizePack>
     using protocol_type = srpc::common
                               ::protocol::binary<SizePack, tcp_size_policy>;
 
+    /// a frame integrity algorithm as the hash of the protocol
+    class integrity_hash: public srpc::common::hash::interface {
+
+        common::integrity_sptr impl_;
+
+    public:
+
+        explicit integrity_hash( common::integrity_sptr impl )
+            :impl_(std::move(impl))
+        { }
+
+        size_t length( ) const override
+        {
+            return impl_->length( );
+        }
+
+        void get( void const *data, size_t len,
+                  void *result ) const override
+        {
+            impl_->get( data, len, result );
+        }
+
+        std::string get( void const *data, size_t len ) const override
+        {
+            std::string res( impl_->length( ), '\0' );
+            if( !res.empty( ) ) {
+                impl_->get( data, len, &res[0] );
+            }
+            return res;
+        }
+
+        bool check( void const *data, size_t len,
+                    void const *value ) const override
+        {
+            return impl_->check( data, len, value );
+        }
+    };
+
     template <typename T>
     std::uintptr_t uint_cast( const T *val )
     {
@@ -87,13 +251,50 @@ namespace msctl { namespace agent { namespace noname {
         using message_sptr       = noname::message_sptr;
 
         using stub_type          = std::function<bool (message_sptr &)>;
-        using call_map           = std::map<std::string, stub_type>;
+        using call_map           = std::array<stub_type, OP_COUNT>;
         using void_call          = std::function<void ( )>;
 
         using bufer_cache        = srpc::common::cache::simple<std::string>;
         using message_cache      = srpc::common::cache::simple<message_type>;
 
         using callbacks          = transport_type::write_callbacks;
+        using write_done         = std::function<void (const error_code &)>;
+
+        /// a frame waiting for the write in flight
+        struct cork_entry {
+            const char *data;
+            size_t      len;
+            write_done  done;
+        };
+
+        /// packets collected while frames are being written
+        struct batch_frame {
+            buffer_type buf;
+            size_t      start = 0;  /// the frame
+            size_t      inner = 0;  /// the protected frame; 0 - none
+            size_t      head  = 0;  /// the fast header
+            size_t      size  = 0;  /// packets with their lengths
+        };
+
+        /// a frame made once and written to many peers as is;
+        /// nobody changes it after it is made
+        struct shared_frame {
+            std::shared_ptr<const std::string> buf;
+            const_buffer_slice                 slice;
+        };
+
+        /// a packet to send: the compressed header and the rest of it
+        struct packet_parts {
+            const char *head     = nullptr;
+            size_t      head_len = 0;
+            const char *data     = nullptr;
+            size_t      len      = 0;
+
+            size_t size( ) const
+            {
+                return head_len + len;
+            }
+        };
 
         transport_delegate( SRPC_ASIO::io_service &ios, size_t mexlen )
             :parent_type( mexlen )
@@ -101,10 +302,26 @@ namespace msctl { namespace agent { namespace noname {
             ,mcache_(10)
             ,next_tag_(0)
             ,next_id_(100)
+            ,features_(0)
+            ,local_features_(default_features)
+            ,seal_on_(false)
+            ,compress_on_(false)
+            ,compress_skip_(0)
+            ,unpack_max_(mexlen)
+            ,frag_on_(false)
+            ,frag_next_id_(0)
+            ,frag_in_(mexlen + frame_overhead)
+            ,seq_on_(false)
+            ,seq_next_(0)
+            ,reorder_on_(false)
+            ,reorder_timer_(ios)
+            ,fec_on_(false)
+            ,fec_timer_(ios)
+            ,port_closed_(false)
             ,keepout_(ios)
         {
             last_tick_ = application::tick_count( );
-            calls_[""] = [ ]( ... ){ return true; };
+            calls_[OP_NONE] = [ ]( ... ){ return true; };
 
             keepout_.call(
                 [this]( const error_code &e )
@@ -124,12 +341,302 @@ namespace msctl { namespace agent { namespace noname {
         virtual void on_timeout( )
         { }
 
+        /// the body of a "push" frame; the data points into the frame.
+        /// Returns false if the frame is not ready yet for packets
+        virtual bool on_packet( const char * /*data*/, size_t /*len*/ )
+        {
+            return false;
+        }
+
+        /// finds call and body of a message without parsing it;
+        /// returns false if the message is not a "push" with a body
+        static bool find_push_body( const char *frame, size_t frame_len,
+                                    const char *&data, size_t &len )
+        {
+            using wire   = google::protobuf::internal::WireFormatLite;
+            using stream = google::protobuf::io::CodedInputStream;
+
+            static const char   call_name[] = "push";
+            static const size_t call_len    = sizeof(call_name) - 1;
+
+            const auto *begin = reinterpret_cast<const std::uint8_t *>(frame);
+            stream input( begin, static_cast<int>(frame_len) );
+
+            bool is_push  = false;
+            bool has_body = false;
+
+            while( std::uint32_t tag = input.ReadTag( ) ) {
+
+                const int field = wire::GetTagFieldNumber( tag );
+                const bool delimited = wire::GetTagWireType( tag )
+                                    == wire::WIRETYPE_LENGTH_DELIMITED;
+
+                if( delimited && ( field == message_type::kCallFieldNumber
+                                || field == message_type::kBodyFieldNumber ) )
+                {
+                    std::uint32_t size = 0;
+                    const void   *ptr  = nullptr;
+                    int           left = 0;
+
+                    if( !input.ReadVarint32( &size )
+                     || !input.GetDirectBufferPointer( &ptr, &left )
+                     || static_cast<std::uint32_t>(left) < size )
+                    {
+                        return false;
+                    }
+
+                    /// the last field wins like in ParseFromArray
+                    if( field == message_type::kCallFieldNumber ) {
+                        is_push = ( size == call_len )
+                               && ( memcmp( ptr, call_name, size ) == 0 );
+                    } else {
+                        data     = static_cast<const char *>(ptr);
+                        len      = size;
+                        has_body = true;
+                    }
+                    input.Skip( static_cast<int>(size) );
+
+                } else if( !wire::SkipField( &input, tag ) ) {
+                    return false;
+                }
+            }
+
+            return is_push && has_body && input.ConsumedEntireMessage( );
+        }
+
+        /// fast frames are accepted always; the peer sends them
+        /// only if the feature has been negotiated
+        static bool find_fast_body( const char *frame, size_t frame_len,
+                                    opcode &op,
+                                    const char *&data, size_t &len )
+        {
+            const auto *head = reinterpret_cast<const std::uint8_t *>(frame);
+
+            if( frame_len < fast_header_size
+             || head[0] != fast_frame_mark )
+            {
+                return false;
+            }
+
+            const std::uint32_t size = ( std::uint32_t(head[2]) << 24 )
+                                     | ( std::uint32_t(head[3]) << 16 )
+                                     | ( std::uint32_t(head[4]) <<  8 )
+                                     |   std::uint32_t(head[5]);
+
+            op   = head[1] < OP_UNKNOWN ? static_cast<opcode>(head[1])
+                                        : OP_UNKNOWN;
+            data = frame + fast_header_size;
+            len  = size;
+
+            return size <= frame_len - fast_header_size;
+        }
+
+        /// packets of a batch go to on_packet one by one;
+        /// a broken tail is dropped
+        void dispatch_batch( const char *data, size_t len )
+        {
+            const auto *pos = reinterpret_cast<const std::uint8_t *>(data);
+            const auto *end = pos + len;
+
+            while( end - pos >= static_cast<std::ptrdiff_t>(
+                                                batch_entry_header ) )
+            {
+                const size_t size = ( size_t(pos[0]) << 8 ) | pos[1];
+                pos += batch_entry_header;
+
+                if( size > size_t( end - pos )
+                 || !deliver_packet( reinterpret_cast<const char *>(pos),
+                                     size ) )
+                {
+                    return;
+                }
+                pos += size;
+            }
+            last_tick_ = application::tick_count( );
+        }
+
+        /// a "push" goes to on_packet without a message object.
+        /// Returns false if the frame has to be parsed as a message.
+        /// The frame has passed the integrity check or the cipher, its
+        /// number can move the window now; a duplicate or a frame that
+        /// is too late is dropped. Held packets that can go now follow
+        /// the frame
+        bool dispatch_packet( const const_buffer_slice &slice )
+        {
+            if( rx_numbered_ ) {
+                rx_numbered_ = false;
+                if( !accept_sequence( rx_seq_ ) ) {
+                    return true;
+                }
+            }
+
+            const bool res = dispatch_frame( slice );
+            if( reorder_on_ ) {
+                rx_hold_ = false;
+                release_held( );
+            }
+            return res;
+        }
+
+        /// false - the frame has to be dropped;
+        /// the packets of a frame after a gap are held
+        bool accept_sequence( std::uint32_t seq )
+        {
+            using reorder = common::reorder_buffer;
+
+            std::lock_guard<std::mutex> lck(rx_lock_);
+            const reorder::verdict verdict = rx_.accept( seq,
+                [this]( const char *data, size_t len )
+                {
+                    on_packet( data, len );
+                } );
+            rx_hold_ = ( verdict == reorder::SEQ_HOLD );
+            return verdict != reorder::SEQ_DROP;
+        }
+
+        bool dispatch_frame( const const_buffer_slice &slice )
+        {
+            const char *frame = reinterpret_cast<const char *>(slice.data( ));
+            const char *data  = nullptr;
+            size_t      len   = 0;
+            opcode      op    = OP_UNKNOWN;
+
+            if( slice.size( ) && std::uint8_t(frame[0]) == fast_frame_mark ) {
+                /// not a message; a bad or unknown frame is dropped
+                if( !find_fast_body( frame, slice.size( ), op, data, len ) ) {
+                    return true;
+                }
+                if( op == OP_PUSH ) {
+                    if( deliver_packet( data, len ) ) {
+                        last_tick_ = application::tick_count( );
+                    }
+                } else if( op == OP_BATCH ) {
+                    dispatch_batch( data, len );
+                } else if( op == OP_FEC ) {
+                    dispatch_fec( data, len );
+                } else if( op == OP_HCRESET && len >= 2 ) {
+                    std::lock_guard<std::mutex> lck(hc_lock_);
+                    hc_out_.reset( std::uint8_t(data[0]),
+                                   std::uint8_t(data[1]) );
+                }
+                return true;
+            }
+
+            if( !find_push_body( frame, slice.size( ), data, len ) ) {
+                return false;
+            }
+
+            if( deliver_packet( data, len ) ) {
+                last_tick_ = application::tick_count( );
+                return true;
+            }
+            return false;
+        }
+
+        /// a data frame of a group goes as is, the frames it or a repair
+        /// frame restores go after it. The number of a data frame is the
+        /// number of the frame that has brought it and has been accepted
+        /// already; a restored frame has its number checked like a frame
+        /// of its own
+        void dispatch_fec( const char *data, size_t len )
+        {
+            using decoder = common::fec_decoder;
+
+            decoder::result res = decoder::FEC_DROP;
+            {
+                std::lock_guard<std::mutex> lck(fec_in_lock_);
+                res = fec_in_.add( data, len, fec_rec_ );
+            }
+
+            if( res == decoder::FEC_DATA ) {
+                dispatch_protected( data, len, false );
+            }
+
+            for( auto &f: fec_rec_ ) {
+                dispatch_protected( f.data( ), f.size( ), true );
+            }
+            fec_rec_.clear( );
+        }
+
+        /// only packet frames are protected
+        void dispatch_protected( const char *data, size_t len,
+                                 bool restored )
+        {
+            if( seq_on_ ) {
+                if( len < seq_head_size ) {
+                    return;
+                }
+                if( restored && !accept_sequence( read_number( data ) ) ) {
+                    return;
+                }
+                data += seq_head_size;
+                len  -= seq_head_size;
+            }
+
+            if( len >= fast_header_size
+             && std::uint8_t(data[0]) == fast_frame_mark
+             && std::uint8_t(data[1]) != OP_FEC )
+            {
+                dispatch_frame( const_buffer_slice( data, len ) );
+            }
+        }
+
+        /// a packet with a compressed header is restored first; a packet
+        /// of a lost context is dropped and the peer is asked to send the
+        /// header again. Compressed packets are accepted always
+        bool deliver_packet( const char *data, size_t len )
+        {
+            using decomp = common::header_decompressor;
+
+            if( !common::is_header_compressed( data, len ) ) {
+                return pass_packet( data, len );
+            }
+
+            std::uint8_t id  = 0;
+            std::uint8_t gen = 0;
+            switch( hc_in_.decompress( data, len, id, gen ) ) {
+            case decomp::HC_DONE:
+                return pass_packet( data, len );
+            case decomp::HC_RESET:
+                send_hc_reset( id, gen );
+                break;
+            case decomp::HC_DROP:
+                break;
+            }
+            return true;
+        }
+
+        /// a packet of a frame after a gap waits for the gap
+        bool pass_packet( const char *data, size_t len )
+        {
+            if( !reorder_on_ ) {
+                return on_packet( data, len );
+            }
+
+            std::lock_guard<std::mutex> lck(rx_lock_);
+            if( rx_hold_ ) {
+                rx_.hold( data, len );
+                return true;
+            }
+            return on_packet( data, len );
+        }
+
+        /// by the read path after a frame and by the timer
+        void release_held( )
+        {
+            std::lock_guard<std::mutex> lck(rx_lock_);
+            rx_.release( [this]( const char *data, size_t len )
+                         {
+                             on_packet( data, len );
+                         } );
+        }
+
         bool call( message_sptr &mess )
         {
             last_tick_ = application::tick_count( );
-            auto f = calls_.find( mess->call( ) );
-            if( f != calls_.end( ) ) {
-                return f->second( mess );
+            auto &f( calls_[opcode_by_name( mess->call( ) )] );
+            if( f ) {
+                return f( mess );
             }
             return false;
         }
@@ -150,7 +657,7 @@ namespace msctl { namespace agent { namespace noname {
 
             auto tag = next_tag( );
 
-            buf->resize( size_policy::max_length );
+            buf->resize( size_policy::max_length + pack_headroom );
 
             const size_t old_len   = buf->size( );
             const size_t hash_size = hash( )->length( );
@@ -168,43 +675,1370 @@ namespace msctl { namespace agent { namespace noname {
 
             buffer_slice packed = pack_message( buf, res );
 
-            return insert_size_prefix( buf, packed );
+            return frame_out( buf, packed );
+        }
+
+        /// features of both sides
+        void set_features( std::uint32_t value )
+        {
+            value &= local_features_;
+            if( !( value & FEATURE_FAST_FRAMES ) ) {
+                value &= ~std::uint32_t(FEATURE_HEADER_COMP | FEATURE_FEC);
+            }
+            features_ = value;
+        }
+
+        std::uint32_t features( ) const
+        {
+            return features_;
+        }
+
+        /// features this side asks for or agrees to
+        std::uint32_t local_features( ) const
+        {
+            return local_features_;
+        }
+
+        /// has to be called before "init"
+        void set_header_compress( bool value )
+        {
+            if( value ) {
+                local_features_ |= FEATURE_HEADER_COMP;
+            } else {
+                local_features_ &= ~std::uint32_t(FEATURE_HEADER_COMP);
+            }
+        }
+
+        /// the header of a packet frame; a fast header if the peer knows
+        /// it, otherwise call "push" and the body field header of the same
+        /// message prepare_message makes
+        size_t push_header( std::uint8_t *head, size_t len ) const
+        {
+            if( features_ & FEATURE_FAST_FRAMES ) {
+                head[0] = fast_frame_mark;
+                head[1] = OP_PUSH;
+                head[2] = static_cast<std::uint8_t>(len >> 24);
+                head[3] = static_cast<std::uint8_t>(len >> 16);
+                head[4] = static_cast<std::uint8_t>(len >>  8);
+                head[5] = static_cast<std::uint8_t>(len);
+                return fast_header_size;
+            }
+
+            using wire   = google::protobuf::internal::WireFormatLite;
+            using stream = google::protobuf::io::CodedOutputStream;
+
+            static const char   call_name[] = "push";
+            static const size_t call_len    = sizeof(call_name) - 1;
+
+            /// fields go in the order of their numbers like protobuf does
+            std::uint8_t *pos = head;
+            pos = stream::WriteTagToArray(
+                        wire::MakeTag( message_type::kCallFieldNumber,
+                                       wire::WIRETYPE_LENGTH_DELIMITED ),
+                        pos );
+            pos = stream::WriteVarint32ToArray( call_len, pos );
+            pos = stream::WriteRawToArray( call_name, call_len, pos );
+            pos = stream::WriteTagToArray(
+                        wire::MakeTag( message_type::kBodyFieldNumber,
+                                       wire::WIRETYPE_LENGTH_DELIMITED ),
+                        pos );
+            pos = stream::WriteVarint32ToArray(
+                        static_cast<std::uint32_t>(len), pos );
+            return pos - head;
+        }
+
+        /// the size prefix; a frame that fits one datagram gets the
+        /// header of a whole frame in the headroom before it now, while
+        /// the buffer belongs to this peer only
+        buffer_slice frame_out( buffer_type &buf, buffer_slice packed )
+        {
+            buffer_slice res = insert_size_prefix( buf, packed );
+            if( frag_on_
+             && res.size( ) + common::frag_whole_head <= frag_size_ )
+            {
+                char *head = res.data( ) - common::frag_whole_head;
+                head[0] = static_cast<char>(common::frag_whole);
+            }
+            return res;
+        }
+
+        /// room for the size prefix and the tag; returns the frame start
+        size_t frame_begin( buffer_type &buf )
+        {
+            typedef typename parent_type::size_policy size_policy;
+
+            buf->resize( size_policy::max_length + pack_headroom );
+            const size_t old_len = buf->size( );
+            tag_policy::append( next_tag( ), *buf );
+            return old_len;
+        }
+
+        /// room for the headers of a protected frame before a packet
+        /// frame; 0 - packet frames are not protected
+        size_t protect_room( ) const
+        {
+            if( !fec_on_ ) {
+                return 0;
+            }
+            return fec_frame_head + ( seq_on_ ? seq_head_size : 0 );
+        }
+
+        /// hash, pack and the size prefix of the frame data; a packet
+        /// frame with protect_room( ) bytes at inner before it goes to
+        /// the fec group with its number
+        buffer_slice frame_end( buffer_type &buf, size_t old_len,
+                                size_t inner = 0 )
+        {
+            std::uint32_t number = 0;
+            if( inner ) {
+                number = protect_frame( buf, inner );
+            }
+
+            const size_t hash_size = hash( )->length( );
+
+            buf->resize( buf->size( ) + hash_size );
+
+            hash( )->get( buf->c_str( ) + old_len,
+                          buf->size( ) - old_len - hash_size,
+                       &(*buf)[buf->size( ) - hash_size]);
+
+            buffer_slice res( &(*buf)[old_len], buf->size( ) - old_len );
+
+            buffer_slice packed = pack_frame( buf, res, number );
+
+            return frame_out( buf, packed );
+        }
+
+        /// a packet frame; the header is made by hand around the packet,
+        /// so the packet is copied only once
+        buffer_slice prepare_push( buffer_type buf, const packet_parts &pkt )
+        {
+            const size_t old_len = frame_begin( buf );
+            const size_t inner   = buf->size( );
+            const size_t room    = protect_room( );
+
+            std::uint8_t head[32];
+            const size_t head_len = push_header( head, pkt.size( ) );
+
+            buf->reserve( buf->size( ) + room + head_len + pkt.size( )
+                        + hash( )->length( ) );
+            buf->append( room, '\0' );
+            buf->append( reinterpret_cast<const char *>(head), head_len );
+            if( pkt.head_len ) {
+                buf->append( pkt.head, pkt.head_len );
+            }
+            buf->append( pkt.data, pkt.len );
+
+            return frame_end( buf, old_len, room ? inner : 0 );
         }
 
+        /// the buffer goes back to the cache when the write is done
         template <typename Cb>
-        void send_message( message_sptr &mess, Cb cb )
+        void send_buffer( buffer_type buf, buffer_slice slice, Cb cb )
         {
-            auto buf = bcache_.get( );
-            auto slice = prepare_message( buf, *mess );
+            write_frame( slice.data( ), slice.size( ),
+                         [this, buf, cb]( const error_code &e )
+                         {
+                             if( !e ) {
+                                 bcache_.push( buf );
+                             }
+                             cb( e );
+                         } );
+            if( fec_on_ ) {
+                send_repairs( );
+            }
+        }
 
-            auto rcb =  [this, buf, cb]( const error_code &e, size_t )
-                        {
-                            if( !e ) {
-                                bcache_.push( buf );
-                            }
-                            cb( e );
-                        };
+        /// without corking every frame is a write of its own.
+        /// With it, a frame goes at once if nothing is being written;
+        /// otherwise it waits and all the waiting frames go in one write
+        /// when the write in flight is done
+        void write_frame( const char *data, size_t len, write_done done )
+        {
+            if( frag_on_ ) {
+                write_datagrams( data, len, std::move( done ) );
+                return;
+            }
 
-            get_transport( )->write( slice.data( ), slice.size( ) ,
-                                     callbacks::post( rcb ) );
+            if( cork_bytes_ == 0 ) {
+                write_stat_.add_write( 1, len );
+                write_raw( data, len, std::move( done ) );
+                return;
+            }
 
-            mcache_.push( mess );
+            {
+                std::lock_guard<std::mutex> lck(cork_lock_);
+                cork_queue_.push_back( cork_entry{ data, len,
+                                                   std::move(done) } );
+                if( cork_busy_ ) {
+                    return;
+                }
+                cork_busy_ = true;
+            }
+            flush_cork( );
         }
 
-        void send_message( message_sptr &mess )
+        /// bytes and frames of one corked write; 0 bytes - no corking.
+        /// Has to be called before the first frame; for streams only,
+        /// a datagram has to keep one frame
+        void set_cork( size_t bytes, size_t frames )
         {
-            static const auto ccb = [ ](...){ };
-            send_message( mess, ccb );
+            cork_bytes_  = bytes;
+            cork_frames_ = frames ? frames : cork_frames_default;
         }
 
-        call_map        calls_;
-        void_call       on_close_;
+        common::write_stat write_stat( ) const
+        {
+            return write_stat_.stat( );
+        }
 
-        bufer_cache     bcache_;
-        message_cache   mcache_;
+        /// the frames go through a UDP port of the agent, not through
+        /// a transport of srpc; the port gives the datagrams of the peer
+        /// to on_data( ) like a transport of srpc does. detach is called
+        /// once by close_transport( ). Has to be called before "init"
+        void assign_port( common::udp_port_sptr port,
+                          const common::udp_endpoint &peer,
+                          void_call detach )
+        {
+            port_   = std::move( port );
+            peer_   = peer;
+            detach_ = std::move( detach );
+        }
 
-        std::atomic<std::uint64_t> next_tag_;
-        std::atomic<std::uint64_t> next_id_;
+        bool has_port( ) const
+        {
+            return static_cast<bool>(port_);
+        }
+
+        /// a port reads all the time
+        void read_transport( )
+        {
+            if( !port_ ) {
+                get_transport( )->read( );
+            }
+        }
+
+        /// the port stays with the other peers; this one is closed
+        void close_transport( )
+        {
+            if( !port_ ) {
+                get_transport( )->close( );
+                return;
+            }
+
+            if( port_closed_.exchange( true ) ) {
+                return;
+            }
+            if( detach_ ) {
+                detach_( );
+            }
+            on_close( );
+        }
+
+        /// a frame that fits the datagram size has the header in the
+        /// headroom before it, frame_out( ) has put it there; a bigger one
+        /// is cut into pieces that are copied to buffers of the cache.
+        /// The frame is done when all its datagrams are written
+        void write_datagrams( const char *data, size_t len, write_done done )
+        {
+            using common::frag_whole_head;
+            using common::frag_piece_head;
+
+            if( len + frag_whole_head <= frag_size_ ) {
+                const char *head = data - frag_whole_head;
+                write_stat_.add_write( 1, len + frag_whole_head );
+                write_raw( head, len + frag_whole_head, std::move( done ) );
+                return;
+            }
+
+            const size_t body  = frag_size_ - frag_piece_head;
+            const size_t count = ( len + body - 1 ) / body;
+
+            /// a frame bigger than the pieces can carry is not written
+            if( count > common::frag_max_pieces ) {
+                write_stat_.add_drop( );
+                done( SRPC_ASIO::error::message_size );
+                return;
+            }
+
+            const std::uint32_t id = frag_next_id_++;
+            auto left = std::make_shared<std::atomic<size_t> >( count );
+
+            for( size_t i = 0; i < count; ++i ) {
+                const size_t pos  = i * body;
+                const size_t part = std::min( body, len - pos );
+
+                auto buf = bcache_.get( );
+                buf->resize( frag_piece_head );
+                common::write_frag_head( &(*buf)[0], id,
+                                         static_cast<std::uint8_t>(i),
+                                         static_cast<std::uint8_t>(count) );
+                buf->append( data + pos, part );
+
+                write_stat_.add_write( 1, buf->size( ) );
+                write_raw( buf->c_str( ), buf->size( ),
+                    [this, buf, left, done]( const error_code &e )
+                    {
+                        if( !e ) {
+                            bcache_.push( buf );
+                        }
+                        if( --(*left) == 0 ) {
+                            done( e );
+                        }
+                    } );
+            }
+        }
+
+        /// the datagram size of a datagram transport; 0 - frames go as
+        /// datagrams of their own size. Has to be called before "init"
+        void set_fragment_size( size_t value )
+        {
+            frag_size_ = value;
+            if( value ) {
+                local_features_ |= FEATURE_FRAGMENTS;
+            } else {
+                local_features_ &= ~std::uint32_t(FEATURE_FRAGMENTS);
+            }
+        }
+
+        size_t fragment_size( ) const
+        {
+            return frag_size_;
+        }
+
+        /// both sides have agreed; the next datagrams have the header
+        void start_fragments( )
+        {
+            if( features_ & FEATURE_FRAGMENTS ) {
+                frag_on_ = true;
+            }
+        }
+
+        /// frames the peer has not completed
+        std::uint64_t fragment_drops( ) const
+        {
+            return frag_in_.dropped( );
+        }
+
+        /// frames of a datagram transport get sequence numbers; the peer
+        /// drops duplicates and holds up to depth frames after a gap for
+        /// max_wait_ms at most. Has to be called before "init"
+        void set_sequence( bool value, size_t depth,
+                           std::uint32_t max_wait_ms )
+        {
+            if( value ) {
+                local_features_ |= FEATURE_SEQUENCE;
+            } else {
+                local_features_ &= ~std::uint32_t(FEATURE_SEQUENCE);
+            }
+            rx_       = common::reorder_buffer( depth, max_wait_ms );
+            rx_wait_  = max_wait_ms;
+        }
+
+        /// both sides have agreed; the next frames have the number
+        void start_sequence( )
+        {
+            if( !( features_ & FEATURE_SEQUENCE ) ) {
+                return;
+            }
+
+            seq_on_ = true;
+            if( rx_.depth( ) == 0 ) {
+                return;
+            }
+
+            reorder_on_ = true;
+
+            /// a held frame waits for max_wait and half of it at most
+            const std::uint32_t tick = rx_wait_ > 1 ? rx_wait_ / 2 : 1;
+            reorder_timer_.call(
+                [this]( const error_code &e )
+                {
+                    if( !e ) {
+                        release_held( );
+                    }
+                }, std::chrono::milliseconds( tick ) );
+        }
+
+        common::reorder_stat reorder_stat( )
+        {
+            std::lock_guard<std::mutex> lck(rx_lock_);
+            return rx_.stat( );
+        }
+
+        /// packet frames of a datagram transport go in groups of k with
+        /// m repair frames; a group that has not got frames for max_wait
+        /// is finished as it is. Any peer that knows FEATURE_FEC restores
+        /// the frames of a group. Has to be called before "init"
+        void set_fec( common::fec_scheme scheme, size_t k, size_t m,
+                      std::uint32_t max_wait_ms )
+        {
+            local_features_ |= FEATURE_FEC;
+            fec_scheme_ = scheme;
+            fec_out_    = common::fec_encoder( scheme, k, m );
+            fec_wait_   = max_wait_ms ? max_wait_ms : 1;
+        }
+
+        /// both sides have agreed; the next packet frames are protected
+        void start_fec( )
+        {
+            if( !( features_ & FEATURE_FEC )
+             || fec_scheme_ == common::FEC_NONE )
+            {
+                return;
+            }
+
+            fec_on_ = true;
+            fec_timer_.call(
+                [this]( const error_code &e )
+                {
+                    if( e ) {
+                        return;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lck(fec_lock_);
+                        if( fec_out_.idle( ) ) {
+                            fec_out_.finish( fec_ready_ );
+                        }
+                    }
+                    send_repairs( );
+                }, std::chrono::milliseconds( fec_wait_ ) );
+        }
+
+        common::fec_stat fec_stat( )
+        {
+            common::fec_stat res;
+            {
+                std::lock_guard<std::mutex> lck(fec_in_lock_);
+                res = fec_in_.stat( );
+            }
+            std::lock_guard<std::mutex> lck(fec_lock_);
+            res.groups  = fec_out_.stat( ).groups;
+            res.repairs = fec_out_.stat( ).repairs;
+            return res;
+        }
+
+        template <typename Cb>
+        void send_message( message_sptr &mess, Cb cb )
+        {
+            auto buf = bcache_.get( );
+            auto slice = prepare_message( buf, *mess );
+
+            send_buffer( buf, slice, cb );
+
+            mcache_.push( mess );
+        }
+
+        /// one packet as a "push" message; no message object is involved.
+        /// With batching, packets that come while a frame is being written
+        /// are collected into one batch frame; it goes out when the write
+        /// is done or when it is full. An idle peer gets packets at once
+        void send_packet( const char *data, size_t len )
+        {
+            static const auto ccb = [ ](...){ };
+
+            packet_parts pkt;
+            pkt.data = data;
+            pkt.len  = len;
+
+            /// a compressed header refers to the packets before it; the
+            /// packet is queued before the next one is compressed
+            std::unique_lock<std::mutex> hc_lck(hc_lock_, std::defer_lock);
+
+            std::uint8_t hc_head[common::hc_max_head];
+            if( features_ & FEATURE_HEADER_COMP ) {
+                size_t skip = 0;
+                hc_lck.lock( );
+                pkt.head_len = hc_out_.compress( data, len, hc_head, skip );
+                pkt.head  = reinterpret_cast<const char *>(hc_head);
+                pkt.data += skip;
+                pkt.len  -= skip;
+            }
+
+            if( batch_bytes_ == 0
+             || !( features_ & FEATURE_BATCH_FRAMES )
+             || !( features_ & FEATURE_FAST_FRAMES ) )
+            {
+                auto buf = bcache_.get( );
+                send_buffer( buf, prepare_push( buf, pkt ), ccb );
+                return;
+            }
+
+            len = pkt.size( );
+            const size_t entry = batch_entry_header + len;
+
+            batch_frame full;
+            bool        single = false;
+            {
+                std::lock_guard<std::mutex> lck(batch_lock_);
+
+                const bool fits = ( len <= batch_entry_max )
+                               && ( entry <= batch_bytes_ );
+
+                if( batch_.buf
+                 && ( !fits || batch_.size + entry > batch_bytes_ ) )
+                {
+                    full = std::move( batch_ );
+                    batch_.buf.reset( );
+                    ++in_flight_;
+                }
+
+                if( !fits || ( in_flight_ == 0 && !batch_.buf ) ) {
+                    single = true;
+                    ++in_flight_;
+                } else {
+                    batch_add( pkt );
+                }
+            }
+
+            /// the order is kept: the batch is older than the packet
+            if( full.buf ) {
+                send_batch( full );
+            }
+
+            if( single ) {
+                auto buf = bcache_.get( );
+                send_buffer( buf, prepare_push( buf, pkt ),
+                             [this]( const error_code & ) { on_sent( ); } );
+            }
+        }
+
+        /// the frames of this peer carry no state of the connection:
+        /// no counters of a cipher, of the sequence or of a fec group, no
+        /// codec with its own statistics, no datagram header
+        bool frame_shareable( ) const
+        {
+            return !seal_on_ && !compress_on_ && !seq_on_ && !fec_on_
+                && !frag_on_;
+        }
+
+        /// a frame one of them makes is valid for the other
+        bool same_frames( const transport_delegate &other ) const
+        {
+            const std::uint32_t fast = FEATURE_FAST_FRAMES;
+            return frame_shareable( ) && other.frame_shareable( )
+                && ( ( features_ & fast ) == ( other.features_ & fast ) )
+                && ( hash_name_ == other.hash_name_ );
+        }
+
+        /// a packet frame for all the peers with the same frames; the
+        /// header is not compressed, the peer takes such packets as is
+        shared_frame prepare_shared_push( const char *data, size_t len )
+        {
+            packet_parts pkt;
+            pkt.data = data;
+            pkt.len  = len;
+
+            /// not from the cache; it goes to the writers of many peers
+            auto buf   = std::make_shared<std::string>( );
+            auto slice = prepare_push( buf, pkt );
+
+            const_buffer_slice frame( slice.data( ), slice.size( ) );
+            return shared_frame{ buf, frame };
+        }
+
+        /// the frame goes after the packets collected before it;
+        /// the writer keeps a reference to the frame until it is written
+        void send_shared( const shared_frame &frame )
+        {
+            batch_frame full;
+            {
+                std::lock_guard<std::mutex> lck(batch_lock_);
+                if( batch_.buf ) {
+                    full = std::move( batch_ );
+                    batch_.buf.reset( );
+                    ++in_flight_;
+                }
+                ++in_flight_;
+            }
+
+            if( full.buf ) {
+                send_batch( full );
+            }
+
+            auto keeper = frame.buf;
+            write_frame( frame.slice.data( ), frame.slice.size( ),
+                         [this, keeper]( const error_code & )
+                         {
+                             on_sent( );
+                         } );
+        }
+
+        /// 0 turns batching off; has to be called before the first packet
+        void set_batch_bytes( size_t value )
+        {
+            batch_bytes_ = value;
+        }
+
+        /// the codec asked for by "init"; "" - no compression
+        void set_compress( const std::string &name )
+        {
+            compress_name_ = name;
+        }
+
+        const std::string &compress_name( ) const
+        {
+            return compress_name_;
+        }
+
+        /// both sides have agreed; the next frames have the mode byte
+        void start_compress( const std::string &name )
+        {
+            codec_ = common::create_compressor( name );
+            if( codec_ ) {
+                compress_on_ = true;
+            }
+        }
+
+        /// the integrity asked for by "init"; "" - the default hash
+        void set_integrity( const std::string &name )
+        {
+            integrity_name_ = name;
+        }
+
+        const std::string &integrity_name( ) const
+        {
+            return integrity_name_;
+        }
+
+        /// both sides have agreed; the next frames are checked with it.
+        /// Has to be called before packets go
+        void start_integrity( const std::string &name )
+        {
+            auto impl = common::create_integrity( name );
+            if( impl ) {
+                set_hash( srpc::common::hash::interface_uptr(
+                              new integrity_hash( impl ) ) );
+                hash_name_ = name;
+            }
+        }
+
+        /// the cipher of the options; "" - no encryption
+        void set_cipher( const std::string &name )
+        {
+            cipher_name_ = name;
+            if( !name.empty( ) && cipher_salt_.empty( ) ) {
+                cipher_salt_ = common::random_bytes( seal_salt_size );
+            }
+        }
+
+        const std::string &cipher_name( ) const
+        {
+            return cipher_name_;
+        }
+
+        /// the random part of the keys from this side
+        const std::string &cipher_salt( ) const
+        {
+            return cipher_salt_;
+        }
+
+        void set_cipher_key( const std::string &id, const std::string &key )
+        {
+            cipher_key_id_ = id;
+            cipher_key_    = key;
+        }
+
+        const std::string &cipher_key_id( ) const
+        {
+            return cipher_key_id_;
+        }
+
+        bool cipher_on( ) const
+        {
+            return seal_on_;
+        }
+
+        /// both sides have agreed; every direction has its own key made
+        /// of the shared key and the salts of both sides.
+        /// Has to be called before packets go
+        void start_cipher( const std::string &client_salt,
+                           const std::string &server_salt, bool server )
+        {
+            const std::string salt = client_salt + server_salt;
+
+            auto c2s = common::derive_key( cipher_key_, "msctl c2s", salt );
+            auto s2c = common::derive_key( cipher_key_, "msctl s2c", salt );
+
+            sealer_  = common::create_aead( cipher_name_, server ? s2c : c2s );
+            opener_  = common::create_aead( cipher_name_, server ? c2s : s2c );
+            seal_on_ = true;
+        }
+
+        common::compress_stat compress_stat( ) const
+        {
+            return compress_stat_.stat( );
+        }
+
+        buffer_slice pack_message( buffer_type buf,
+                                   buffer_slice slice ) override
+        {
+            return pack_frame( buf, slice, 0 );
+        }
+
+        /// the number, compression and then encryption; number 0 - the
+        /// next one, a protected frame has got its number already
+        buffer_slice pack_frame( buffer_type &buf, buffer_slice slice,
+                                 std::uint32_t number )
+        {
+            if( seq_on_ ) {
+                slice = number_frame( buf, slice, number );
+            }
+            if( compress_on_ ) {
+                slice = compress_frame( buf, slice );
+            }
+            if( seal_on_ ) {
+                slice = seal_frame( buf, slice );
+            }
+            return slice;
+        }
+
+        /// a datagram of a fragmenting transport loses its header before
+        /// srpc takes the size prefix; a piece goes nowhere until its
+        /// frame is complete
+        void on_data( const char *data, size_t len ) override
+        {
+            if( !frag_on_ ) {
+                parent_type::on_data( data, len );
+                return;
+            }
+
+            const_buffer_slice frame( data, len );
+            if( join_frame( frame ) ) {
+                parent_type::on_data( frame.data( ), frame.size( ) );
+            }
+        }
+
+        /// a broken frame becomes empty and fails the hash check
+        buffer_type unpack_message( const_buffer_slice &slice ) override
+        {
+            buffer_type res;
+            rx_numbered_ = false;
+            if( seal_on_ ) {
+                res = open_frame( slice );
+            }
+            if( compress_on_ ) {
+                auto plain = decompress_frame( slice );
+                if( plain ) {
+                    res = plain;
+                }
+            }
+            if( seq_on_ ) {
+                res = check_sequence( slice, res );
+            }
+            return res;
+        }
+
+        /// the number goes before the data
+        buffer_slice number_frame( buffer_type &buf, buffer_slice slice,
+                                   std::uint32_t number )
+        {
+            const size_t start = slice.data( ) - &(*buf)[0] - seq_head_size;
+
+            char *head = &(*buf)[start];
+            write_number( head, number ? number : ++seq_next_ );
+
+            return buffer_slice( head, slice.size( ) + seq_head_size );
+        }
+
+        static void write_number( char *head, std::uint32_t seq )
+        {
+            head[0] = static_cast<char>(seq >> 24);
+            head[1] = static_cast<char>(seq >> 16);
+            head[2] = static_cast<char>(seq >>  8);
+            head[3] = static_cast<char>(seq);
+        }
+
+        static std::uint32_t read_number( const char *data )
+        {
+            const auto *head = reinterpret_cast<const std::uint8_t *>(data);
+            return ( std::uint32_t(head[0]) << 24 )
+                 | ( std::uint32_t(head[1]) << 16 )
+                 | ( std::uint32_t(head[2]) <<  8 )
+                 |   std::uint32_t(head[3]);
+        }
+
+        /// the number goes away and waits for dispatch_packet( ); the
+        /// frame has not passed the integrity check yet and can't touch
+        /// the window. A frame without the number becomes empty
+        buffer_type check_sequence( const_buffer_slice &slice,
+                                    buffer_type res )
+        {
+            const char  *data = slice.data( );
+            const size_t len  = slice.size( );
+
+            rx_numbered_ = false;
+            if( len < seq_head_size ) {
+                slice = const_buffer_slice( data, 0 );
+                return res;
+            }
+
+            slice = const_buffer_slice( data + seq_head_size,
+                                        len  - seq_head_size );
+
+            rx_seq_      = read_number( data );
+            rx_numbered_ = true;
+            return res;
+        }
+
+        /// the frame gets the mode byte; it is compressed if it looks
+        /// compressible and becomes smaller.
+        /// A frame that has not become smaller turns compression off
+        /// for the next frames for a while
+        buffer_slice compress_frame( buffer_type &buf, buffer_slice slice )
+        {
+            using clock = std::chrono::steady_clock;
+
+            /// frames after a failure that are not tried
+            static const std::uint32_t skip_after_fail = 16;
+
+            const auto   begin = clock::now( );
+            const size_t start = slice.data( ) - &(*buf)[0] - pack_mode_size;
+            const size_t len   = slice.size( );
+
+            bool try_it = true;
+            if( compress_skip_.load( std::memory_order_relaxed ) ) {
+                compress_skip_.fetch_sub( 1, std::memory_order_relaxed );
+                try_it = false;
+            }
+
+            if( try_it && common::looks_compressible( slice.data( ), len ) ) {
+
+                /// compressed data goes after the frame and then moves
+                /// to the frame place
+                const size_t out_pos = start + pack_mode_size + len;
+                const size_t cap     = std::min( codec_->max_compressed( len ),
+                                                 len - pack_header_size );
+                buf->resize( out_pos + cap );
+
+                const size_t res = codec_->compress(
+                                        &(*buf)[start + pack_mode_size], len,
+                                        &(*buf)[out_pos], cap );
+
+                if( res && res + pack_header_size < len + pack_mode_size ) {
+                    char *head = &(*buf)[start];
+                    head[0] = static_cast<char>(PACK_LZ);
+                    head[1] = static_cast<char>(len >> 24);
+                    head[2] = static_cast<char>(len >> 16);
+                    head[3] = static_cast<char>(len >>  8);
+                    head[4] = static_cast<char>(len);
+                    memmove( head + pack_header_size, &(*buf)[out_pos], res );
+                    buf->resize( start + pack_header_size + res );
+
+                    compress_stat_.add_frame( len, res + pack_header_size,
+                                              nanosec_from( begin ) );
+                    return buffer_slice( &(*buf)[start],
+                                         res + pack_header_size );
+                }
+
+                buf->resize( start + pack_mode_size + len );
+                compress_skip_ = skip_after_fail;
+            }
+
+            (*buf)[start] = static_cast<char>(PACK_RAW);
+            compress_stat_.add_skipped( len + pack_mode_size,
+                                        nanosec_from( begin ) );
+            return buffer_slice( &(*buf)[start], len + pack_mode_size );
+        }
+
+        /// a new buffer for a compressed frame
+        buffer_type decompress_frame( const_buffer_slice &slice )
+        {
+            const char *data = slice.data( );
+            const size_t len = slice.size( );
+
+            if( len >= pack_mode_size && data[0] == char(PACK_RAW) ) {
+                slice = const_buffer_slice( data + pack_mode_size,
+                                            len - pack_mode_size );
+                return buffer_type( );
+            }
+
+            if( len < pack_header_size || data[0] != char(PACK_LZ) ) {
+                slice = const_buffer_slice( data, 0 );
+                return buffer_type( );
+            }
+
+            const auto begin = std::chrono::steady_clock::now( );
+            const auto *head = reinterpret_cast<const std::uint8_t *>(data);
+            const size_t orig = ( size_t(head[1]) << 24 )
+                              | ( size_t(head[2]) << 16 )
+                              | ( size_t(head[3]) <<  8 )
+                              |   size_t(head[4]);
+
+            if( orig > unpack_max_ ) {
+                slice = const_buffer_slice( data, 0 );
+                return buffer_type( );
+            }
+
+            auto res = std::make_shared<std::string>( orig, '\0' );
+            if( !codec_->decompress( data + pack_header_size,
+                                     len - pack_header_size,
+                                     &(*res)[0], orig ) )
+            {
+                slice = const_buffer_slice( data, 0 );
+                return buffer_type( );
+            }
+
+            compress_stat_.add_decompress( nanosec_from( begin ) );
+            slice = const_buffer_slice( res->data( ), res->size( ) );
+            return res;
+        }
+
+        /// the header of the datagram goes away; a piece goes to the table.
+        /// Returns false while the frame is not complete; the slice is the
+        /// frame with its size prefix otherwise
+        bool join_frame( const_buffer_slice &slice )
+        {
+            using reassembly = common::frag_reassembly;
+
+            const char  *data = slice.data( );
+            const size_t len  = slice.size( );
+
+            if( len >= common::frag_whole_head
+             && std::uint8_t(data[0]) == common::frag_whole )
+            {
+                slice = const_buffer_slice( data + common::frag_whole_head,
+                                            len  - common::frag_whole_head );
+                return true;
+            }
+
+            const auto joined = frag_in_.add( data, len, frag_out_ );
+            if( joined != reassembly::FRAG_DONE ) {
+                return false;
+            }
+            slice = const_buffer_slice( frag_out_.data( ),
+                                        frag_out_.size( ) );
+            return true;
+        }
+
+        /// the counter goes before the data, the tag after it.
+        /// Frames of all the writers are encrypted one by one
+        buffer_slice seal_frame( buffer_type &buf, buffer_slice slice )
+        {
+            std::lock_guard<std::mutex> lck(seal_lock_);
+
+            const size_t tag   = common::aead::tag_size;
+            const size_t start = slice.data( ) - &(*buf)[0] - seal_head_size;
+            const size_t len   = slice.size( );
+            const std::uint64_t counter = ++seal_counter_;
+
+            buf->resize( start + seal_head_size + len + tag );
+
+            char *head = &(*buf)[start];
+            for( size_t i = 0; i < seal_head_size; ++i ) {
+                head[i] = static_cast<char>(
+                            counter >> ( ( seal_head_size - 1 - i ) * 8 ) );
+            }
+
+            /// a failure leaves a frame the peer can't open
+            sealer_->seal( counter, head + seal_head_size, len,
+                           head + seal_head_size + len );
+
+            return buffer_slice( head, buf->size( ) - start );
+        }
+
+        /// a frame that can't be opened or is a replay becomes empty
+        buffer_type open_frame( const_buffer_slice &slice )
+        {
+            const char  *data = slice.data( );
+            const size_t len  = slice.size( );
+
+            slice = const_buffer_slice( data, 0 );
+
+            if( len < seal_head_size + common::aead::tag_size ) {
+                return buffer_type( );
+            }
+
+            const auto *head = reinterpret_cast<const std::uint8_t *>(data);
+            std::uint64_t counter = 0;
+            for( size_t i = 0; i < seal_head_size; ++i ) {
+                counter = ( counter << 8 ) | head[i];
+            }
+
+            if( !open_window_.fresh( counter ) ) {
+                return buffer_type( );
+            }
+
+            const size_t body = len - seal_head_size - common::aead::tag_size;
+            auto res = std::make_shared<std::string>( body, '\0' );
+
+            if( !opener_->open( counter, data + seal_head_size, body,
+                                data + seal_head_size + body, &(*res)[0] ) )
+            {
+                return buffer_type( );
+            }
+
+            open_window_.mark( counter );
+            slice = const_buffer_slice( res->data( ), res->size( ) );
+            return res;
+        }
+
+        static std::uint64_t nanosec_from(
+                                std::chrono::steady_clock::time_point t )
+        {
+            using namespace std::chrono;
+            return duration_cast<nanoseconds>( steady_clock::now( ) - t )
+                   .count( );
+        }
+
+        void send_message( message_sptr &mess )
+        {
+            static const auto ccb = [ ](...){ };
+            send_message( mess, ccb );
+        }
+
+    private:
+
+        /// a frame goes to the port or to the transport of srpc
+        void write_raw( const char *data, size_t len, write_done done )
+        {
+            if( port_ ) {
+                port_->write( peer_, data, len, std::move( done ) );
+                return;
+            }
+
+            get_transport( )->write( data, len,
+                callbacks::post(
+                    [done]( const error_code &e, size_t )
+                    {
+                        done( e );
+                    } ) );
+        }
+
+        /// has to be called under batch_lock_
+        void batch_add( const packet_parts &pkt )
+        {
+            if( !batch_.buf ) {
+                batch_.buf   = bcache_.get( );
+                batch_.start = frame_begin( batch_.buf );
+
+                const size_t room = protect_room( );
+                batch_.inner = room ? batch_.buf->size( ) : 0;
+                batch_.buf->append( room, '\0' );
+
+                batch_.head  = batch_.buf->size( );
+                batch_.size  = 0;
+                batch_.buf->append( fast_header_size, '\0' );
+            }
+
+            const size_t len = pkt.size( );
+            const char head[batch_entry_header] = {
+                static_cast<char>(len >> 8),
+                static_cast<char>(len)
+            };
+            batch_.buf->append( head, batch_entry_header );
+            if( pkt.head_len ) {
+                batch_.buf->append( pkt.head, pkt.head_len );
+            }
+            batch_.buf->append( pkt.data, pkt.len );
+            batch_.size += batch_entry_header + len;
+        }
+
+        /// the peer sent a packet of a context this side doesn't know
+        void send_hc_reset( std::uint8_t id, std::uint8_t gen )
+        {
+            static const auto ccb = [ ](...){ };
+            static const size_t body = 2;
+
+            auto buf = bcache_.get( );
+            const size_t old_len = frame_begin( buf );
+
+            const char head[fast_header_size + body] = {
+                static_cast<char>(fast_frame_mark),
+                static_cast<char>(OP_HCRESET),
+                0, 0, 0, static_cast<char>(body),
+                static_cast<char>(id),
+                static_cast<char>(gen)
+            };
+            buf->append( head, sizeof(head) );
+
+            send_buffer( buf, frame_end( buf, old_len ), ccb );
+        }
+
+        /// the room before the packet frame gets the fast header of
+        /// OP_FEC, the fec header and the number of the frame; the number
+        /// is returned, 0 - no numbers. A full group leaves its repair
+        /// frames for send_repairs( ). A frame too big for a group goes
+        /// without the room
+        std::uint32_t protect_frame( buffer_type &buf, size_t inner )
+        {
+            const bool   numbered = seq_on_;
+            const size_t data_pos = inner + fec_frame_head;
+            const size_t len      = buf->size( ) - data_pos;
+
+            if( len > 0xFFFF ) {
+                buf->erase( inner, protect_room( ) );
+                return 0;
+            }
+
+            std::uint32_t number = 0;
+            if( numbered ) {
+                number = ++seq_next_;
+                write_number( &(*buf)[data_pos], number );
+            }
+
+            const size_t body = common::fec_head_size + len;
+            char *head = &(*buf)[inner];
+            head[0] = static_cast<char>(fast_frame_mark);
+            head[1] = static_cast<char>(OP_FEC);
+            head[2] = static_cast<char>(body >> 24);
+            head[3] = static_cast<char>(body >> 16);
+            head[4] = static_cast<char>(body >>  8);
+            head[5] = static_cast<char>(body);
+
+            std::lock_guard<std::mutex> lck(fec_lock_);
+            if( fec_out_.add( head + fast_header_size,
+                              head + fec_frame_head, len ) )
+            {
+                fec_out_.finish( fec_ready_ );
+            }
+            return number;
+        }
+
+        void send_repairs( )
+        {
+            static const auto ccb = [ ](...){ };
+
+            std::vector<std::string> list;
+            {
+                std::lock_guard<std::mutex> lck(fec_lock_);
+                if( fec_ready_.empty( ) ) {
+                    return;
+                }
+                list.swap( fec_ready_ );
+            }
+
+            for( auto &r: list ) {
+                auto buf = bcache_.get( );
+                const size_t old_len = frame_begin( buf );
+
+                const size_t size = r.size( );
+                const char head[fast_header_size] = {
+                    static_cast<char>(fast_frame_mark),
+                    static_cast<char>(OP_FEC),
+                    static_cast<char>(size >> 24),
+                    static_cast<char>(size >> 16),
+                    static_cast<char>(size >>  8),
+                    static_cast<char>(size)
+                };
+                buf->append( head, fast_header_size );
+                buf->append( r );
+
+                send_buffer( buf, frame_end( buf, old_len ), ccb );
+            }
+        }
+
+        void send_batch( batch_frame &frame )
+        {
+            char *head = &(*frame.buf)[frame.head];
+            head[0] = static_cast<char>(fast_frame_mark);
+            head[1] = static_cast<char>(OP_BATCH);
+            head[2] = static_cast<char>(frame.size >> 24);
+            head[3] = static_cast<char>(frame.size >> 16);
+            head[4] = static_cast<char>(frame.size >>  8);
+            head[5] = static_cast<char>(frame.size);
+
+            send_buffer( frame.buf,
+                         frame_end( frame.buf, frame.start, frame.inner ),
+                         [this]( const error_code & ) { on_sent( ); } );
+        }
+
+        /// the waiting frames that fit the limits go out; the first one
+        /// always does. One frame is written from its own buffer, more
+        /// are copied to a buffer of the cache one after another
+        void flush_cork( )
+        {
+            std::vector<cork_entry> list;
+            size_t total = 0;
+            {
+                std::lock_guard<std::mutex> lck(cork_lock_);
+                while( !cork_queue_.empty( ) && list.size( ) < cork_frames_ ) {
+                    auto &next( cork_queue_.front( ) );
+                    if( !list.empty( ) && total + next.len > cork_bytes_ ) {
+                        break;
+                    }
+                    total += next.len;
+                    list.emplace_back( std::move( next ) );
+                    cork_queue_.pop_front( );
+                }
+                if( list.empty( ) ) {
+                    cork_busy_ = false;
+                    return;
+                }
+            }
+
+            write_stat_.add_write( list.size( ), total );
+
+            if( list.size( ) == 1 ) {
+                auto done = std::move( list[0].done );
+                write_raw( list[0].data, list[0].len,
+                    [this, done]( const error_code &e )
+                    {
+                        done( e );
+                        on_cork_written( e );
+                    } );
+                return;
+            }
+
+            auto buf = bcache_.get( );
+            buf->clear( );
+            buf->reserve( total );
+            for( auto &f: list ) {
+                buf->append( f.data, f.len );
+            }
+
+            auto frames = std::make_shared<std::vector<cork_entry> >(
+                                                        std::move( list ) );
+            write_raw( buf->c_str( ), buf->size( ),
+                [this, buf, frames]( const error_code &e )
+                {
+                    if( !e ) {
+                        bcache_.push( buf );
+                    }
+                    for( auto &f: *frames ) {
+                        f.done( e );
+                    }
+                    on_cork_written( e );
+                } );
+        }
+
+        /// after an error the waiting frames get it too
+        void on_cork_written( const error_code &e )
+        {
+            if( !e ) {
+                flush_cork( );
+                return;
+            }
+
+            std::deque<cork_entry> failed;
+            {
+                std::lock_guard<std::mutex> lck(cork_lock_);
+                failed.swap( cork_queue_ );
+                cork_busy_ = false;
+            }
+            for( auto &f: failed ) {
+                f.done( e );
+            }
+        }
+
+        /// a write is done; the collected batch goes out if nothing else
+        /// is being written
+        void on_sent( )
+        {
+            batch_frame full;
+            {
+                std::lock_guard<std::mutex> lck(batch_lock_);
+                if( in_flight_ ) {
+                    --in_flight_;
+                }
+                if( in_flight_ == 0 && batch_.buf ) {
+                    full = std::move( batch_ );
+                    batch_.buf.reset( );
+                    ++in_flight_;
+                }
+            }
+
+            if( full.buf ) {
+                send_batch( full );
+            }
+        }
+
+    public:
+
+        call_map        calls_;
+        void_call       on_close_;
+
+        bufer_cache     bcache_;
+        message_cache   mcache_;
+
+        std::atomic<std::uint64_t> next_tag_;
+        std::atomic<std::uint64_t> next_id_;
+        std::atomic<std::uint32_t> features_;
+        std::uint32_t              local_features_;
+
+        std::string                 integrity_name_;
+        std::string                 hash_name_;     /// "" - the default
+
+        /// encryption; the read path opens, any writer seals
+        std::string                 cipher_name_;
+        std::string                 cipher_salt_;
+        std::string                 cipher_key_id_;
+        std::string                 cipher_key_;
+        common::aead_uptr           sealer_;
+        common::aead_uptr           opener_;
+        std::mutex                  seal_lock_;
+        std::uint64_t               seal_counter_ = 0;
+        common::replay_window       open_window_;
+        std::atomic<bool>           seal_on_;
+
+        /// compression; the codec is set before compress_on_
+        std::string                 compress_name_;
+        common::compressor_sptr     codec_;
+        std::atomic<bool>           compress_on_;
+        std::atomic<std::uint32_t>  compress_skip_;
+        common::compress_counters   compress_stat_;
+        size_t                      unpack_max_;
+
+        /// header compression; the compressor is shared by the writers
+        /// and a packet is queued under the lock it was compressed with,
+        /// the decompressor belongs to the read path
+        std::mutex                  hc_lock_;
+        common::header_compressor   hc_out_;
+        common::header_decompressor hc_in_;
+
+        /// fragments; the read path joins, any writer cuts
+        size_t                      frag_size_ = 0;
+        std::atomic<bool>           frag_on_;
+        std::atomic<std::uint32_t>  frag_next_id_;
+        common::frag_reassembly     frag_in_;
+        std::string                 frag_out_;  /// the joined frame
+
+        /// sequence numbers; the read path checks them, the timer and
+        /// the read path release held packets under rx_lock_.
+        /// rx_seq_ is the number of the frame being read
+        std::atomic<bool>           seq_on_;
+        std::atomic<std::uint32_t>  seq_next_;
+        std::atomic<bool>           reorder_on_;
+        bool                        rx_hold_     = false;
+        bool                        rx_numbered_ = false;
+        std::uint32_t               rx_seq_      = 0;
+        std::uint32_t               rx_wait_ = 0;
+        std::mutex                  rx_lock_;
+        common::reorder_buffer      rx_;
+        srpc::common::timers::periodical reorder_timer_;
+
+        /// forward error correction; any writer adds frames to the group,
+        /// the read path restores lost frames
+        std::atomic<bool>           fec_on_;
+        common::fec_scheme          fec_scheme_ = common::FEC_NONE;
+        std::uint32_t               fec_wait_   = 1;
+        std::mutex                  fec_lock_;
+        common::fec_encoder         fec_out_;
+        std::vector<std::string>    fec_ready_;
+        std::mutex                  fec_in_lock_;
+        common::fec_decoder         fec_in_;
+        std::vector<std::string>    fec_rec_;
+        srpc::common::timers::periodical fec_timer_;
+
+        /// frames in flight are counted for batching only
+        std::mutex      batch_lock_;
+        size_t          batch_bytes_ = 0;
+        batch_frame     batch_;
+        size_t          in_flight_   = 0;
+
+        /// corking; frames that wait for the write in flight
+        std::mutex                  cork_lock_;
+        std::deque<cork_entry>      cork_queue_;
+        bool                        cork_busy_   = false;
+        size_t                      cork_bytes_  = 0;
+        size_t                      cork_frames_ = cork_frames_default;
+        common::write_counters      write_stat_;
+
+        /// the UDP port of the agent; the frames of this peer only
+        common::udp_port_sptr       port_;
+        common::udp_endpoint        peer_;
+        void_call                   detach_;
+        std::atomic<bool>           port_closed_;
 
         srpc::common::timers::periodical keepout_;
         std::uint64_t                    last_tick_;
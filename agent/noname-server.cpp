@@ -1,6 +1,8 @@
 
 #include <memory>
 #include <functional>
+#include <map>
+#include <mutex>
 
 #include "noname-server.h"
 
@@ -223,7 +225,9 @@ namespace {
 
         void init( )
         {
-            acceptor_ = acceptor_type::create( ios_, 4096, ep_ );
+            using convertor_type = acceptor_to_size_policy<acceptor_type>;
+            acceptor_ = acceptor_type::create( ios_, convertor_type::maxlen,
+                                               ep_ );
             acceptor_->set_delegate( &delegate_ );
         }
 
@@ -251,6 +255,128 @@ namespace {
         accept_delegate         delegate_;
     };
 
+    /// peers are told by their addresses; a peer without a delegate
+    /// gets one from peer_call_ with its first datagram
+    struct port_impl: public server::interface,
+                      public std::enable_shared_from_this<port_impl> {
+
+        using this_type   = port_impl;
+        using peer_map    = std::map<common::udp_endpoint,
+                                     std::weak_ptr<transport_delegate> >;
+
+        port_impl( SRPC_ASIO::io_service &ios,
+                   const std::string &addr, srpc::uint16_t port,
+                   const common::udp_port_params &params )
+            :ios_(ios)
+            ,ep_(SRPC_ASIO::ip::address::from_string(addr), port)
+            ,params_(params)
+        { }
+
+        static
+        std::shared_ptr<this_type> create( application *app,
+                                           const std::string &svc,
+                                           std::uint16_t port,
+                                           const common::udp_port_params &p )
+        {
+            return std::make_shared<this_type>( app->get_io_service( ),
+                                                svc, port, p );
+        }
+
+        void start( )
+        {
+            if( port_ ) {
+                return;
+            }
+
+            auto inst = common::udp_port::create( ios_, params_ );
+            inst->open( ep_ );
+
+            std::weak_ptr<this_type> wself(shared_from_this( ));
+            inst->assign_read_call(
+                [wself]( const common::udp_datagram *dgs, size_t count )
+                {
+                    auto self = wself.lock( );
+                    if( self ) {
+                        self->on_read( dgs, count );
+                    }
+                } );
+
+            port_ = inst;
+            port_->start_read( );
+        }
+
+        void stop( )
+        {
+            if( port_ ) {
+                port_->close( );
+            }
+        }
+
+        server::acceptor_type *acceptor( )
+        {
+            return nullptr;
+        }
+
+        void on_read( const common::udp_datagram *dgs, size_t count )
+        {
+            for( size_t i = 0; i < count; ++i ) {
+                auto deleg = find_peer( dgs[i].peer );
+                if( deleg ) {
+                    deleg->on_data( dgs[i].data, dgs[i].len );
+                }
+            }
+        }
+
+        server::delegate_sptr find_peer( const common::udp_endpoint &peer )
+        {
+            {
+                std::lock_guard<std::mutex> lck(peers_lock_);
+                auto f = peers_.find( peer );
+                if( f != peers_.end( ) ) {
+                    auto deleg = f->second.lock( );
+                    if( deleg ) {
+                        return deleg;
+                    }
+                    peers_.erase( f );
+                }
+            }
+
+            if( !peer_call_ ) {
+                return server::delegate_sptr( );
+            }
+
+            std::weak_ptr<this_type> wself(shared_from_this( ));
+            auto deleg = peer_call_( port_, peer,
+                [wself, peer]( )
+                {
+                    auto self = wself.lock( );
+                    if( self ) {
+                        self->forget( peer );
+                    }
+                } );
+
+            if( deleg ) {
+                std::lock_guard<std::mutex> lck(peers_lock_);
+                peers_[peer] = deleg;
+            }
+            return deleg;
+        }
+
+        /// the next datagram of the peer makes a new delegate
+        void forget( const common::udp_endpoint &peer )
+        {
+            std::lock_guard<std::mutex> lck(peers_lock_);
+            peers_.erase( peer );
+        }
+
+        SRPC_ASIO::io_service  &ios_;
+        common::udp_endpoint    ep_;
+        common::udp_port_params params_;
+        common::udp_port_sptr   port_;
+        std::mutex              peers_lock_;
+        peer_map                peers_;
+    };
+
 }
 
 namespace server {
@@ -272,6 +398,15 @@ namespace server {
         }
     }
 
+    namespace port {
+        server_sptr create( application *app,
+                            std::string addr, std::uint16_t port,
+                            const common::udp_port_params &params )
+        {
+            return port_impl::create( app, addr, port, params );
+        }
+    }
+
 }
 
 
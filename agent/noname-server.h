@@ -23,6 +23,7 @@ namespace server {
     using transport_type    = srpc::common::transport::interface;
     using error_code        = srpc::common::transport::error_code;
     using acceptor_type     = srpc::server::acceptor::interface;
+    using delegate_sptr     = std::shared_ptr<transport_delegate>;
 
     class interface {
 
@@ -34,6 +35,14 @@ namespace server {
         using accept_error      = std::function<void ( const error_code &) >;
         using close_call        = std::function<void ( ) >;
 
+        /// a new peer of a server on the agent's own UDP port; returns
+        /// the delegate of the peer with the port assigned, or nullptr.
+        /// The last argument is the detach call of assign_port( )
+        using peer_call         = std::function<delegate_sptr (
+                                        const common::udp_port_sptr &,
+                                        const common::udp_endpoint &,
+                                        std::function<void ( )> ) >;
+
         virtual ~interface( ) { }
         virtual acceptor_type *acceptor(  ) = 0;
         virtual void start(  ) = 0;
@@ -54,11 +63,17 @@ namespace server {
             close_call_ = std::move(call);
         }
 
+        void assignt_peer_call( peer_call call )
+        {
+            peer_call_ = std::move(call);
+        }
+
     protected:
 
         accept_call  accept_call_;
         accept_error error_call_;
         close_call   close_call_;
+        peer_call    peer_call_;
     };
 
     using server_sptr = std::shared_ptr<interface>;
@@ -74,6 +89,14 @@ namespace server {
                             std::string addr, std::uint16_t port );
     }
 
+    /// UDP on the agent's own port; datagrams go in batches, the peers
+    /// come to peer_call, acceptor( ) is nullptr
+    namespace port {
+        server_sptr create( application *app,
+                            std::string addr, std::uint16_t port,
+                            const common::udp_port_params &params );
+    }
+
 }
 
 }}}
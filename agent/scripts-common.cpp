@@ -5,6 +5,7 @@
 #include "scripts-common.h"
 
 #include "common/utilities.h"
+#include "common/udp-batch.h"
 
 #define LOG(lev) log_(lev, "script")
 #define LOGINF   LOG(logger_impl::level::info)
@@ -159,9 +160,62 @@ namespace msctl { namespace agent { namespace scripts {
         out.tcp_nowait = obj["tcp_nowait"].as_bool( false );
         out.max_queue  = obj["max_queue"].as_uint32( 10 );
 
+        out.read_batch = obj["read_batch"].as_uint32( 1 );
+        out.backend    = obj["backend"].as_string( );
+
+        out.queue_packets  = obj["queue_packets"].as_uint32( 1024 );
+        out.queue_bytes    = obj["queue_bytes"].as_uint32( 4 * 1024 * 1024 );
+        out.aqm            = obj["aqm"].as_string( );
+        out.codel_target   = obj["codel_target"].as_uint32( 5 );
+        out.codel_interval = obj["codel_interval"].as_uint32( 100 );
+
+        out.cpu       = static_cast<std::int32_t>(
+                                obj["cpu"].as_uint32( std::uint32_t(-1) ) );
+        out.busy_poll = obj["busy_poll"].as_uint32( 0 );
+
+        out.batch_bytes = obj["batch_bytes"].as_uint32( 0 );
+        out.cork_bytes  = obj["cork_bytes"].as_uint32( 0 );
+        out.cork_frames = obj["cork_frames"].as_uint32( 64 );
+        out.fragment_size   = obj["fragment_size"].as_uint32( 0 );
+        out.sequence        = obj["sequence"].as_bool( false );
+        out.reorder_depth   = obj["reorder_depth"].as_uint32( 0 );
+        out.reorder_ms      = obj["reorder_ms"].as_uint32( 20 );
+        out.fec             = obj["fec"].as_string( );
+        out.fec_data        = obj["fec_data"].as_uint32( 8 );
+        out.fec_repair      = obj["fec_repair"].as_uint32( 2 );
+        out.fec_ms          = obj["fec_ms"].as_uint32( 20 );
+        out.udp_batch       = obj["udp_batch"].as_uint32( 0 );
+        out.udp_offload     = obj["udp_offload"].as_bool( false );
+        out.compress    = obj["compress"].as_string( );
+        out.header_compress = obj["header_compress"].as_bool( false );
+        out.integrity       = obj["integrity"].as_string( );
+        out.cipher          = obj["cipher"].as_string( );
+
         if( out.max_queue < 5 ) {
             out.max_queue = 5;
         }
+
+        if( out.read_batch < 1 ) {
+            out.read_batch = 1;
+        } else if( out.read_batch > 256 ) {
+            out.read_batch = 256;
+        }
+
+        if( out.udp_batch > common::udp_batch_max ) {
+            out.udp_batch = common::udp_batch_max;
+        }
+
+        if( out.codel_target < 1 ) {
+            out.codel_target = 1;
+        }
+
+        if( out.codel_interval < out.codel_target ) {
+            out.codel_interval = out.codel_target;
+        }
+
+        if( out.busy_poll > 1000000 ) {
+            out.busy_poll = 1000000;
+        }
     }
 
     void add_function(const lua::object_wrapper &obj,
@@ -154,7 +154,8 @@ namespace {
         static const auto default_opt = parent_type::OPT_DISPATCH_READ;
 
         client_transport( vclnt::base *c )
-            :parent_type(c->get_io_service( ), 2048, default_opt )
+            :parent_type(c->get_io_service( ), common::TUN_DEFAULT_BLOCK,
+                         default_opt )
             ,client_(c->create_channel( ), true)
         {
             client_.channel( )->set_flag( vcomm::rpc_channel::DISABLE_WAIT);
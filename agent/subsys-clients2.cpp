@@ -5,6 +5,7 @@
 #include "noname-client.h"
 
 #include "common/tuntap.h"
+#include "common/tuntap-queue.h"
 #include "common/utilities.h"
 #include "common/net-ifaces.h"
 
@@ -44,18 +45,59 @@ namespace {
             ,app_(app)
         {
             push_ = [this]( ... ){ };
-            calls_["init"] = [this]( message_sptr &mess )
-                             { return on_ready( mess ); };
+            calls_[noname::OP_INIT] = [this]( message_sptr &mess )
+                                      { return on_ready( mess ); };
         }
 
         bool on_ready( message_sptr &mess )
         {
+            static auto &log_(app_->log( ));
 
-            calls_["push"] = [this]( message_sptr &mess )
-                             { return on_push( mess ); };
+            if( mess->has_err( ) ) {
+                LOGERR << "Init failed: " << mess->err( ).mess( );
+                close_transport( );
+                return false;
+            }
+
+            rpc::tuntap::init_res res;
+            res.ParseFromString( mess->body( ) );
+
+            /// the client with a cipher doesn't talk without it too
+            if( !cipher_name( ).empty( ) ) {
+                if( res.cipher( ) != cipher_name( )
+                 || res.salt( ).size( ) != noname::seal_salt_size )
+                {
+                    LOGERR << "Init failed: the server doesn't support "
+                           << quote(cipher_name( ));
+                    close_transport( );
+                    return false;
+                }
+                start_cipher( cipher_salt( ), res.salt( ), false );
+            }
+
+            set_features( res.features( ) );
+            start_fragments( );
+            start_sequence( );
+            start_fec( );
+
+            if( !compress_name( ).empty( )
+             && res.compress( ) == compress_name( ) )
+            {
+                start_compress( compress_name( ) );
+            }
 
-            calls_["regok"] = [this]( message_sptr &mess )
-                              { return on_register_ok( mess ); };
+            if( !integrity_name( ).empty( )
+             && res.integrity( ) == integrity_name( ) )
+            {
+                start_integrity( integrity_name( ) );
+            }
+
+            calls_[noname::OP_PUSH] = [this]( message_sptr &mess )
+                                      { return on_push( mess ); };
+            push_ready_ = true;
+
+            calls_[noname::OP_REGOK] = [this]( message_sptr &mess )
+                                       { return on_register_ok( mess ); };
 
             push_ = [this]( const char * d, size_t l)
                     { send_impl( d, l ); };
@@ -69,6 +111,7 @@ namespace {
 
         bool on_push( message_sptr &mess );
         bool on_register_ok( message_sptr &mess );
+        bool on_packet( const char *data, size_t len ) override;
 
         void send( const char *data, size_t len )
         {
@@ -77,26 +120,16 @@ namespace {
 
         void send_impl( const char *data, size_t len )
         {
-            auto mess = mcache_.get( );
-            mess->clear_err( );
-            mess->set_call( "push" );
-            mess->set_body( data, len );
-            send_message( mess );
-        }
-
-        buffer_type unpack_message( const_buffer_slice & ) override
-        {
-            return buffer_type( );
-        }
-
-        buffer_slice pack_message( buffer_type, buffer_slice slice ) override
-        {
-            return slice;
+            send_packet( data, len );
         }
 
         void on_message_ready( tag_type /*t*/, buffer_type /*b*/,
                                const_buffer_slice sl )
         {
+            if( dispatch_packet( sl ) ) {
+                return;
+            }
+
             auto mess = mcache_.get( );
             mess->ParseFromArray( sl.data( ), sl.size( ) );
             call( mess );
@@ -104,10 +137,21 @@ namespace {
 
         void init( )
         {
+            rpc::tuntap::init_req req;
+            req.set_features( local_features( ) );
+            req.set_compress( compress_name( ) );
+            req.set_integrity( integrity_name( ) );
+            if( !cipher_name( ).empty( ) ) {
+                req.set_cipher( cipher_name( ) );
+                req.set_key_id( cipher_key_id( ) );
+                req.set_salt( cipher_salt( ) );
+            }
+
             message_sptr mess = mcache_.get( );
             mess->set_call( "init" );
+            mess->set_body( req.SerializeAsString( ) );
             send_message( mess );
-            get_transport( )->read( );
+            read_transport( );
         }
 
         bool ready( ) const
@@ -121,9 +165,10 @@ namespace {
         }
 
         application *app_;
-        device      *my_device_ = nullptr;
+        device      *my_device_  = nullptr;
         push_call    push_;
-        bool         ready_     = false;
+        bool         ready_      = false;
+        bool         push_ready_ = false;
         std::string  name_;
 //        std::condition_variable ready_var_;
 //        std::mutex              ready_lock_;
@@ -131,45 +176,161 @@ namespace {
 
     using proto_sptr = std::shared_ptr<client_delegate>;
 
-    struct device: public common::tuntap_transport {
-
-        using parent_type = common::tuntap_transport;
+    struct device {
 
         device( application *app )
-            :common::tuntap_transport( app->get_io_service( ), 2048,
-                                       parent_type::OPT_DISPATCH_READ )
-            ,app_(app)
+            :app_(app)
             ,log_(app->log( ))
         { }
 
-        void on_read( char *data, size_t length )
+        void on_read_batch( common::packet_slice *packets, size_t count )
         {
-            proto_->send( data, length );
+            auto &proto(*proto_);
+            for( size_t i = 0; i < count; ++i ) {
+                proto.send( packets[i].data, packets[i].length );
+            }
         }
 
         static
         std::shared_ptr<device> create( application *app,
                                         const client_create_info &inf )
         {
+            common::open_params params;
+            params.vnet_hdr = inf.vnet_hdr;
+            params.mtu      = inf.mtu;
+
+            const size_t block = common::tun_block_size( params );
+
+            if( inf.udp && noname::frame_maxlen( block )
+                         > noname::udp_datagram_max )
+            {
+                throw std::runtime_error( "MTU is too big for udp." );
+            }
+
+            common::queue_params qparams;
+            common::fill_queue_params( inf.common, qparams );
+
+            /// throws for an unknown codec, integrity or cipher
+            common::create_compressor( inf.common.compress );
+            common::create_integrity( inf.common.integrity );
+            if( inf.udp && inf.common.integrity == "none" ) {
+                throw std::runtime_error( "Integrity none is for tcp only." );
+            }
+            common::check_aead_name( inf.common.cipher );
+
+            const size_t frag = inf.udp ? inf.common.fragment_size : 0;
+            if( frag && ( frag < common::frag_min_size
+                       || frag > noname::udp_datagram_max ) )
+            {
+                throw std::runtime_error( "Invalid fragment size." );
+            }
+
+            const size_t depth = inf.udp ? inf.common.reorder_depth : 0;
+            if( depth && ( !inf.common.sequence
+                        || depth > common::replay_window::size ) )
+            {
+                throw std::runtime_error( "Invalid reorder depth." );
+            }
+
+            /// throws for an unknown scheme or bad group sizes
+            const auto fec = inf.udp
+                           ? common::fec_scheme_by_name( inf.common.fec )
+                           : common::FEC_NONE;
+            common::check_fec_params( fec, inf.common.fec_data,
+                                      inf.common.fec_repair );
+
+            auto key = app->get_key( inf.id );
+            if( !inf.common.cipher.empty( ) && key.empty( ) ) {
+                throw std::runtime_error( "No key for the client "
+                                        + inf.id + "." );
+            }
+            qparams.block_size  = block;
+
+            if( qparams.backend == common::queue_params::BACKEND_PACKET ) {
+                throw std::runtime_error( "The packet backend "
+                                          "is for servers only." );
+            }
+
             auto inst = std::make_shared<device>( app );
-            auto d = common::open_tun( inf.device );
+
+            auto hdls = common::open_tun( inf.device, params );
+            auto &d   = hdls[0];
 
             inst->cln_name_ = inf.id;
             inst->dev_name_ = d.name( );
-
-            inst->get_stream( ).assign( d.release( ) );
+            inst->vnet_hdr_ = inf.vnet_hdr;
+            inst->block_    = block;
+            inst->handle_   = d.get( );
+
+            /// a batch frame can't be bigger than a frame of one packet
+            inst->batch_bytes_ = std::min<size_t>( inf.common.batch_bytes,
+                                                   block );
+
+            /// a datagram keeps one frame
+            inst->cork_bytes_  = inf.udp ? 0 : inf.common.cork_bytes;
+            inst->cork_frames_ = inf.common.cork_frames;
+            inst->frag_size_   = frag;
+            inst->sequence_    = inf.udp && inf.common.sequence;
+            inst->reorder_depth_ = depth;
+            inst->reorder_ms_    = inf.common.reorder_ms;
+            inst->udp_           = inf.udp;
+            inst->fec_           = fec;
+            inst->fec_data_      = inf.common.fec_data;
+            inst->fec_repair_    = inf.common.fec_repair;
+            inst->fec_ms_        = inf.common.fec_ms;
+            inst->compress_    = inf.common.compress;
+            inst->integrity_   = inf.common.integrity;
+            inst->cipher_      = inf.common.cipher;
+            inst->key_         = key;
+
+            /// super-packets of vnet mode are not touched
+            inst->header_compress_ = inf.common.header_compress
+                                  && !inf.vnet_hdr;
+
+            inst->queue_ = common::create_queue( app->get_io_service( ),
+                                                 d, qparams );
+
+            std::weak_ptr<device> wdev(inst);
+            inst->queue_->assign_read_call(
+                [wdev]( common::packet_slice *packets, size_t count )
+                {
+                    auto dev = wdev.lock( );
+                    if( dev ) {
+                        dev->on_read_batch( packets, count );
+                    }
+                } );
 
             return inst;
         }
 
+        /// the protocol without its transport
+        proto_sptr create_proto( )
+        {
+            auto mexlen = noname::frame_maxlen( block_ );
+            auto proto = std::make_shared<client_delegate>( app_, mexlen );
+            proto->my_device_ = this;
+            proto->set_batch_bytes( batch_bytes_ );
+            proto->set_cork( cork_bytes_, cork_frames_ );
+            proto->set_fragment_size( frag_size_ );
+            proto->set_sequence( sequence_, reorder_depth_, reorder_ms_ );
+            if( udp_ ) {
+                proto->set_fec( fec_, fec_data_, fec_repair_, fec_ms_ );
+            }
+            proto->set_compress( compress_ );
+            proto->set_header_compress( header_compress_ );
+            proto->set_integrity( integrity_ );
+            proto->set_cipher( cipher_ );
+            proto->set_cipher_key( cln_name_, key_ );
+            return proto;
+        }
+
         void init( noname::client::client_sptr c )
         {
 
             c->assign_on_connect(
                 [this]( transport_type *t )
                 {
-                    proto_ = std::make_shared<client_delegate>( app_, 4096 );
-                    proto_->my_device_ = this;
+                    proto_ = create_proto( );
                     proto_->assign_transport( t );
                     t->set_delegate( proto_.get( ) );
                     proto_->assign_transport( t );
@@ -193,28 +354,75 @@ namespace {
 
         }
 
-        void start( )
+        /// the agent's own port instead of a connector of srpc; the port
+        /// takes the datagrams of the server only
+        void init_port( const common::udp_endpoint &server,
+                        const common::udp_port_params &params )
         {
-            client_->start( );
+            auto port = common::udp_port::create( app_->get_io_service( ),
+                                                  params );
+            port->open( common::udp_endpoint( server.protocol( ), 0 ) );
+            port->assign_read_call(
+                [this]( const common::udp_datagram *dgs, size_t count )
+                {
+                    for( size_t i = 0; i < count; ++i ) {
+                        if( dgs[i].peer == peer_ ) {
+                            proto_->on_data( dgs[i].data, dgs[i].len );
+                        }
+                    }
+                } );
+
+            port_ = port;
+            peer_ = server;
         }
 
-        void on_read_error( const error_code &/*code*/ )
-        { }
+        void start( )
+        {
+            if( !port_ ) {
+                client_->start( );
+                return;
+            }
 
-        void on_write_error( const error_code &/*code*/ )
-        { }
+            if( proto_ ) {
+                return;
+            }
 
-        void on_write_exception(  )
-        {
-            throw;
+            auto port = port_;
+            proto_ = create_proto( );
+            proto_->assign_port( port, peer_, [port]( ) { port->close( ); } );
+            port_->start_read( );
+            proto_->init( );
         }
 
         application                    *app_;
         logger_impl                    &log_;
+        common::tuntap_queue_sptr       queue_;
+        common::native_handle           handle_;
         proto_sptr                      proto_;
         noname::client::client_sptr     client_;
+        common::udp_port_sptr           port_;
+        common::udp_endpoint            peer_;
         std::string                     dev_name_;
         std::string                     cln_name_;
+        bool                            vnet_hdr_ = false;
+        size_t                          block_    = common::TUN_DEFAULT_BLOCK;
+        size_t                          batch_bytes_ = 0;
+        size_t                          cork_bytes_  = 0;
+        size_t                          cork_frames_ = 0;
+        size_t                          frag_size_   = 0;
+        bool                            sequence_    = false;
+        size_t                          reorder_depth_ = 0;
+        std::uint32_t                   reorder_ms_    = 0;
+        bool                            udp_           = false;
+        common::fec_scheme              fec_           = common::FEC_NONE;
+        size_t                          fec_data_      = 0;
+        size_t                          fec_repair_    = 0;
+        std::uint32_t                   fec_ms_        = 0;
+        std::string                     compress_;
+        std::string                     integrity_;
+        std::string                     cipher_;
+        std::string                     key_;
+        bool                            header_compress_ = false;
 
     };
 
@@ -225,17 +433,28 @@ namespace {
 
     bool client_delegate::on_push(message_sptr &mess )
     {
-        my_device_->write( mess->body( ).c_str( ),
-                           mess->body( ).size( ) );
+        my_device_->queue_->write( mess->body( ).c_str( ),
+                                   mess->body( ).size( ) );
         mcache_.push( mess );
         return true;
     }
 
+    /// the packet is written from the frame buffer if the device is idle
+    bool client_delegate::on_packet( const char *data, size_t len )
+    {
+        if( !push_ready_ ) {
+            return false;
+        }
+        my_device_->queue_->write_through( data, len );
+        return true;
+    }
+
     void client_delegate::send_register_me( message_sptr &mess )
     {
         mess->set_call( "reg" );
         rpc::tuntap::register_req req;
         req.set_name( my_device_->cln_name_ );
+        req.set_vnet_hdr( my_device_->vnet_hdr_ );
         mess->set_body( req.SerializeAsString( ) );
 
         send_message( mess );
@@ -245,6 +464,12 @@ namespace {
     {
         static auto &log_(app_->log( ));
 
+        if( mess->has_err( ) ) {
+            LOGERR << "Registration failed: " << mess->err( ).mess( );
+            close_transport( );
+            return false;
+        }
+
         try {
 
             rpc::tuntap::register_res res;
@@ -266,7 +491,7 @@ namespace {
                    << " and mask: " << quote(mask.to_string( ))
                       ;
 
-            auto hdl = my_device_->get_stream( ).native_handle( );
+            auto hdl = my_device_->handle_;
 
             clients2::register_info reginfo;
 
@@ -283,7 +508,7 @@ namespace {
     //                                    *devhint_, reginfo );
 
             ready_ = true;
-            my_device_->start_read( );
+            my_device_->queue_->start_read( );
 
             LOGINF << "Device " << quote(my_device_->dev_name_)
                    << " setup success.";
@@ -291,7 +516,7 @@ namespace {
             mcache_.push( mess );
         } catch( const std::exception &ex ) {
             LOGERR << "Device setup failed: " << ex.what( ) << "\n";
-            get_transport( )->close( );
+            close_transport( );
         }
 
         return true;
@@ -322,6 +547,59 @@ namespace {
             }
         }
 
+        void get_device_stats( clients2::device_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto &dev(d.second);
+                out[dev->dev_name_] = dev->queue_->write_queue_stat( );
+            }
+        }
+
+        void get_compress_stats( clients2::compress_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto proto = d.second->proto_;
+                if( proto ) {
+                    out[d.second->dev_name_] = proto->compress_stat( );
+                }
+            }
+        }
+
+        void get_write_stats( clients2::write_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto proto = d.second->proto_;
+                if( proto ) {
+                    out[d.second->dev_name_] = proto->write_stat( );
+                }
+            }
+        }
+
+        void get_reorder_stats( clients2::reorder_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto proto = d.second->proto_;
+                if( proto ) {
+                    out[d.second->dev_name_] = proto->reorder_stat( );
+                }
+            }
+        }
+
+        void get_fec_stats( clients2::fec_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto proto = d.second->proto_;
+                if( proto ) {
+                    out[d.second->dev_name_] = proto->fec_stat( );
+                }
+            }
+        }
+
         bool add_client( const client_create_info &inf, bool start )
         {
             try {
@@ -332,12 +610,27 @@ namespace {
                 auto e = utilities::get_endpoint_info( inf.point );
                 if( e.is_ip( ) ) {
 
-                    auto cln = inf.udp
+                    auto dev = device::create( app_, inf );
+
+                    if( inf.udp && inf.common.udp_batch ) {
+                        using SRPC_ASIO::ip::address;
+                        common::udp_port_params pparams;
+                        pparams.batch   = inf.common.udp_batch;
+                        pparams.buffer  = noname::frame_maxlen( dev->block_ );
+                        pparams.offload = inf.common.udp_offload;
+                        dev->init_port( common::udp_endpoint(
+                                address::from_string( e.addpess ),
+                                e.service ), pparams );
+                    } else {
+                        auto cln = inf.udp
                              ? nudp::create( app_, e.addpess, e.service )
                              : ntcp::create( app_, e.addpess, e.service );
+                        dev->init( cln );
+                    }
 
-                    auto dev = device::create( app_, inf );
-                    dev->init( cln );
+                    LOGINF << "Device " << quote(dev->dev_name_)
+                           << " backend: " << dev->queue_->backend_name( )
+                           << " block: " << dev->block_;
 
                     {
                         std::lock_guard<std::mutex> lck(devs_lock_);
@@ -379,6 +672,31 @@ namespace {
         return impl_->add_client( inf, start );
     }
 
+    void clients2::get_device_stats( device_stat_map &out ) const
+    {
+        impl_->get_device_stats( out );
+    }
+
+    void clients2::get_compress_stats( compress_stat_map &out ) const
+    {
+        impl_->get_compress_stats( out );
+    }
+
+    void clients2::get_write_stats( write_stat_map &out ) const
+    {
+        impl_->get_write_stats( out );
+    }
+
+    void clients2::get_reorder_stats( reorder_stat_map &out ) const
+    {
+        impl_->get_reorder_stats( out );
+    }
+
+    void clients2::get_fec_stats( fec_stat_map &out ) const
+    {
+        impl_->get_fec_stats( out );
+    }
+
     void clients2::init( )
     { }
 
@@ -4,6 +4,11 @@
 
 #include "application.h"
 #include "common/create-params.h"
+#include "common/aqm-queue.h"
+#include "common/compress.h"
+#include "common/write-stat.h"
+#include "common/reorder-buffer.h"
+#include "common/fec.h"
 
 namespace msctl { namespace agent {
 
@@ -21,7 +26,9 @@ namespace msctl { namespace agent {
             std::string               device;
             std::string               id;
             common::create_parameters common;
-            bool                      udp = true;
+            bool                      udp      = true;
+            bool                      vnet_hdr = false;
+            std::uint32_t             mtu      = 0;
         };
 
         struct register_info {
@@ -30,6 +37,14 @@ namespace msctl { namespace agent {
             std::string server_ip;
         };
 
+        using device_stat_map   = std::map<std::string, common::queue_stat>;
+        using compress_stat_map = std::map<std::string,
+                                           common::compress_stat>;
+        using write_stat_map    = std::map<std::string, common::write_stat>;
+        using reorder_stat_map  = std::map<std::string,
+                                           common::reorder_stat>;
+        using fec_stat_map      = std::map<std::string, common::fec_stat>;
+
         clients2( application *app );
         static std::shared_ptr<clients2> create( application *app );
         static const char *name( ) 
@@ -39,6 +54,21 @@ namespace msctl { namespace agent {
 
         bool add_client( const client_create_info &inf, bool start );
 
+        /// write queues of the devices
+        void get_device_stats( device_stat_map &out ) const;
+
+        /// compression of the connected devices by the device name
+        void get_compress_stats( compress_stat_map &out ) const;
+
+        /// socket writes of the connected devices by the device name
+        void get_write_stats( write_stat_map &out ) const;
+
+        /// sequence numbers of the connected UDP devices by the name
+        void get_reorder_stats( reorder_stat_map &out ) const;
+
+        /// error correction of the connected UDP devices by the name
+        void get_fec_stats( fec_stat_map &out ) const;
+
     private:
 
         void init( )  override;
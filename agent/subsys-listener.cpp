@@ -121,7 +121,8 @@ namespace {
 
         server_transport( ba::io_service &ios,
                           std::shared_ptr<listener::server_create_info> inf )
-            :parent_type(ios, 2048, parent_type::OPT_DISPATCH_READ)
+            :parent_type(ios, common::TUN_DEFAULT_BLOCK,
+                         parent_type::OPT_DISPATCH_READ)
             ,poll_(inf->addr_poll)
             ,create_inf_(inf)
         { }
@@ -4,6 +4,7 @@
 #include "noname-server.h"
 
 #include "common/tuntap.h"
+#include "common/tuntap-queue.h"
 #include "common/utilities.h"
 #include "common/net-ifaces.h"
 
@@ -41,42 +42,102 @@ namespace  {
             :parent_type(app->get_rpc_service( ), mexlen )
             ,app_(app)
         {
-            calls_["init"] = [this]( message_sptr &mess )
-                             { return on_init( mess ); };
-            calls_["reg"] = [this]( message_sptr &mess )
-                            { return on_register_me( mess ); };
+            calls_[noname::OP_INIT] = [this]( message_sptr &mess )
+                                      { return on_init( mess ); };
+            calls_[noname::OP_REG] = [this]( message_sptr &mess )
+                                     { return on_register_me( mess ); };
         }
 
         void send_on_register( std::uint32_t addr, std::uint32_t mask,
                                const std::string &name );
 
+        /// the features known by both sides go back to the client
         bool on_init( message_sptr &mess )
         {
+            /// a second init would reset the keys, the sequence and timers
+            if( init_done_ ) {
+                mess->clear_body( );
+                mess->mutable_err( )->set_mess( "Already initialized." );
+                send_message( mess );
+                return false;
+            }
+
+            rpc::tuntap::init_req req;
+            req.ParseFromString( mess->body( ) );
+
+            /// the server with a cipher doesn't talk without it
+            const bool cipher = !cipher_name( ).empty( );
+            if( cipher ) {
+                auto key = app_->get_key( req.key_id( ) );
+                if( req.cipher( ) != cipher_name( ) || key.empty( )
+                 || req.salt( ).size( ) != noname::seal_salt_size )
+                {
+                    mess->clear_body( );
+                    mess->mutable_err( )->set_mess( "Encryption is required." );
+                    send_message( mess );
+                    return false;
+                }
+                set_cipher_key( req.key_id( ), key );
+            }
+
+            set_features( req.features( ) );
+
+            rpc::tuntap::init_res res;
+            res.set_features( features( ) );
+
+            /// both sides have to ask for the same codec
+            const bool compress = !compress_name( ).empty( )
+                               && ( req.compress( ) == compress_name( ) );
+            if( compress ) {
+                res.set_compress( compress_name( ) );
+            }
+
+            const bool integrity = !integrity_name( ).empty( )
+                                && ( req.integrity( ) == integrity_name( ) );
+            if( integrity ) {
+                res.set_integrity( integrity_name( ) );
+            }
+
+            if( cipher ) {
+                res.set_cipher( cipher_name( ) );
+                res.set_salt( cipher_salt( ) );
+            }
+            mess->set_body( res.SerializeAsString( ) );
+
+            init_done_ = true;
             send_message( mess );
+
+            /// the answer goes as is; the client starts after it
+            if( compress ) {
+                start_compress( compress_name( ) );
+            }
+            if( integrity ) {
+                start_integrity( integrity_name( ) );
+            }
+            if( cipher ) {
+                start_cipher( req.salt( ), cipher_salt( ), true );
+            }
+            start_fragments( );
+            start_sequence( );
+            start_fec( );
             mcache_.push( mess );
             return true;
         }
 
         bool on_register_me( message_sptr &mess );
         bool on_push( message_sptr &mess );
+        bool on_packet( const char *data, size_t len ) override;
 
         void on_message_ready( tag_type, buffer_type,
                                const_buffer_slice ) override;
 
         void on_close( ) override;
 
-        buffer_type unpack_message( const_buffer_slice & ) override
-        {
-            return buffer_type( );
-        }
-
-        buffer_slice pack_message( buffer_type, buffer_slice slice ) override
-        {
-            return slice;
-        }
-
-        application             *app_;
-        std::shared_ptr<device>  my_device_;
+        application                   *app_;
+        std::shared_ptr<device>        my_device_;
+        common::tuntap_queue_sptr      my_queue_;
+        bool                           init_done_  = false;
+        bool                           registered_ = false;
 
         std::uint32_t   my_ip_   = 0;
         std::uint16_t   my_mask_ = 0;
@@ -87,19 +148,39 @@ namespace  {
     using delegate_sptr = std::shared_ptr<client_delegate>;
     using delegate_wptr = std::weak_ptr<client_delegate>;
 
+    using queue_sptr = common::tuntap_queue_sptr;
+    using queue_list = common::tuntap_queue_list;
+
     ///////////// DEVICE
-    struct device: public common::tuntap_transport {
+    struct device: public std::enable_shared_from_this<device> {
 
         using this_type   = device;
         using routev4_map = std::map<std::uint32_t, delegate_sptr>;
         using client_set  = std::map<std::uintptr_t, delegate_sptr>;
         using ipcache_map = std::map<std::string, std::uint32_t>;
-        using parent_type = common::tuntap_transport;
+
+        /// clients with the same frames and the frame made by the first
+        using frame_group = std::pair<client_delegate *,
+                                      client_delegate::shared_frame>;
+
+        /// a packet of a read batch and the client it goes to;
+        /// no client - it goes to everybody
+        struct routed_packet {
+            const char    *data   = nullptr;
+            size_t         length = 0;
+            delegate_sptr  client;
+        };
+
+        /// the clients of a batch; the routing table is not locked while
+        /// the packets are framed and sent
+        struct batch_routes {
+            std::vector<routed_packet> packets;
+            std::vector<delegate_sptr> everybody;
+            bool                       have_everybody = false;
+        };
 
         device( application *app, utilities::address_v4_poll poll )
-            :common::tuntap_transport( app->get_io_service( ), 2048,
-                                       parent_type::OPT_DISPATCH_READ )
-            ,app_(app)
+            :app_(app)
             ,log_(app->log( ))
             ,poll_(poll)
         { }
@@ -118,7 +199,38 @@ namespace  {
         {
             auto &log_(app->log( ));
             auto inst = std::make_shared<device>( app, inf.addr_poll );
-            auto hdl  = common::open_tun( inf.device );
+
+            common::open_params params;
+            params.queues   = inf.queues;
+            params.vnet_hdr = inf.vnet_hdr;
+            params.mtu      = inf.mtu;
+
+            common::queue_params qparams;
+            common::fill_queue_params( inf.common, qparams );
+
+            /// throws for an unknown codec
+            common::create_compressor( inf.common.compress );
+
+            /// the packet backend attaches to an existing interface
+            const bool packet = ( qparams.backend
+                               == common::queue_params::BACKEND_PACKET );
+
+            common::device_info_list hdls;
+
+            if( packet ) {
+                if( inf.vnet_hdr ) {
+                    throw std::runtime_error( "Vnet header is not supported "
+                                              "by the packet backend." );
+                }
+                if( inf.mtu && common::set_mtu( inf.device, inf.mtu ) < 0 ) {
+                    throw std::runtime_error( "Failed to set mtu for "
+                                              + inf.device );
+                }
+                inst->device_name_ = inf.device;
+            } else {
+                hdls = common::open_tun( inf.device, params );
+                inst->device_name_ = hdls[0].name( );
+            }
 
             auto addr_mask = common::iface_v4_addr( inf.device );
 
@@ -130,116 +242,314 @@ namespace  {
                    << " mask " << quote( inst->mask_.to_string( ) )
                       ;
 
-            inst->device_name_ = hdl.name( );
-            inst->get_stream( ).assign( hdl.release( ) );
+            inst->vnet_hdr_    = inf.vnet_hdr;
+            inst->mcast_       = inf.mcast;
+            inst->bcast_       = inf.bcast;
+            inst->hdr_len_     = inf.vnet_hdr ? common::TUN_VNET_HDR_SIZE : 0;
+
+            inst->block_       = common::tun_block_size( params );
+            qparams.block_size = inst->block_;
+
+            /// a batch frame can't be bigger than a frame of one packet
+            inst->batch_bytes_ = std::min<size_t>( inf.common.batch_bytes,
+                                                   inst->block_ );
+            inst->compress_    = inf.common.compress;
+
+            /// super-packets of vnet mode are not touched
+            inst->header_compress_ = inf.common.header_compress
+                                  && !inf.vnet_hdr;
+
+            auto &ios(app->get_io_service( ));
+
+            if( packet ) {
+                inst->queues_ = common::create_packet_queues( ios,
+                                                              inf.device,
+                                                              inf.queues,
+                                                              qparams );
+            } else {
+                for( auto &h: hdls ) {
+                    inst->queues_.emplace_back(
+                                common::create_queue( ios, h, qparams ) );
+                }
+            }
+
+            std::weak_ptr<device> wdev(inst);
+
+            for( auto &q: inst->queues_ ) {
+                q->assign_read_call(
+                    [wdev]( common::packet_slice *packets, size_t count )
+                    {
+                        auto dev = wdev.lock( );
+                        if( dev ) {
+                            dev->on_read_batch( packets, count );
+                        }
+                    } );
+            }
 
             LOGINF << "Create new device " << quote(inf.device)
                    << " address: " << inst->addr_.to_string( )
                    << " mask: " << inst->mask_.to_string( )
+                   << " queues: " << inst->queues_.size( )
+                   << " block: " << inst->block_
+                   << " backend: " << inst->queues_[0]->backend_name( )
+                   << ( inst->vnet_hdr_ ? " vnet header" : "" )
                    ;
             return inst;
         }
 
+        void start_read( )
+        {
+            for( auto &q: queues_ ) {
+                q->start_read( );
+            }
+        }
+
+        common::queue_stat write_queue_stat( ) const
+        {
+            common::queue_stat res;
+            for( auto &q: queues_ ) {
+                res += q->write_queue_stat( );
+            }
+            return res;
+        }
+
+        /// registered clients by "device/ip"
+        void get_compress_stats( listener2::compress_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(routes_lock_);
+            for( auto &r: routes_ ) {
+                auto ip = address( r.second->my_ip_ ).to_string( );
+                out[device_name_ + "/" + ip] = r.second->compress_stat( );
+            }
+        }
+
+        void get_write_stats( listener2::write_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(routes_lock_);
+            for( auto &r: routes_ ) {
+                auto ip = address( r.second->my_ip_ ).to_string( );
+                out[device_name_ + "/" + ip] = r.second->write_stat( );
+            }
+        }
+
+        void get_reorder_stats( listener2::reorder_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(routes_lock_);
+            for( auto &r: routes_ ) {
+                auto ip = address( r.second->my_ip_ ).to_string( );
+                out[device_name_ + "/" + ip] = r.second->reorder_stat( );
+            }
+        }
+
+        void get_fec_stats( listener2::fec_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(routes_lock_);
+            for( auto &r: routes_ ) {
+                auto ip = address( r.second->my_ip_ ).to_string( );
+                out[device_name_ + "/" + ip] = r.second->fec_stat( );
+            }
+        }
+
+        /// every client writes to its own queue;
+        /// so the packets of one client are never reordered
+        queue_sptr next_queue( )
+        {
+            auto id = next_queue_++;
+            return queues_[id % queues_.size( )];
+        }
+
         void add_tmp_client( delegate_sptr deleg )
         {
-            weak_type wptr( shared_from_this( ) );
-            dispatch(
-                [this, wptr, deleg]( )
-                {
-                    auto lck(wptr.lock( ));
-                    if( lck ) {
-                        auto id = uint_cast(deleg.get( ));
-                        deleg->get_transport( )->read( );
-                        tmp_clients_.insert( std::make_pair(id, deleg) );
-                    }
-                } );
+            auto id = uint_cast(deleg.get( ));
+            {
+                std::lock_guard<std::mutex> lck(routes_lock_);
+                tmp_clients_.insert( std::make_pair(id, deleg) );
+            }
+            deleg->read_transport( );
         }
 
         void del_client( client_delegate *deleg )
         {
-            weak_type wptr( shared_from_this( ) );
-            auto addr = deleg->my_ip_;
-            dispatch(
-                [this, wptr, deleg, addr]( )
-                {
-                    auto lck(wptr.lock( ));
-                    if( lck ) {
-                        routes_.erase( addr );
-                        tmp_clients_.erase( uint_cast( deleg ) );
-                    }
-                } );
+            delegate_sptr keeper;
+            auto addr = htonl( deleg->my_ip_ );
+
+            {
+                std::lock_guard<std::mutex> lck(routes_lock_);
+
+                auto f = routes_.find( addr );
+                if( f != routes_.end( ) && f->second.get( ) == deleg ) {
+                    keeper = f->second;
+                    routes_.erase( f );
+                }
+
+                auto t = tmp_clients_.find( uint_cast( deleg ) );
+                if( t != tmp_clients_.end( ) ) {
+                    keeper = t->second;
+                    tmp_clients_.erase( t );
+                }
+            }
+
+            /// the client is closing now; destroy it later
+            if( keeper ) {
+                app_->get_io_service( ).post( [keeper]( ) { } );
+            }
         }
 
         void register_client( client_delegate *deleg )
         {
-            weak_type wptr( shared_from_this( ) );
+            std::lock_guard<std::mutex> lck(routes_lock_);
 
-            dispatch(
-                [this, wptr, deleg]( )
-                {
-                    auto lck(wptr.lock( ));
-                    if( lck ) {
-                        auto id = uint_cast( deleg );
-                        auto f = tmp_clients_.find( id );
-                        if( f != tmp_clients_.end( ) ) {
+            auto id = uint_cast( deleg );
+            auto f = tmp_clients_.find( id );
+            if( f != tmp_clients_.end( ) ) {
 
-                            auto inst = f->second;
-                            tmp_clients_.erase( f );
+                auto inst = f->second;
+                tmp_clients_.erase( f );
 
-                            auto addr = htonl( inst->my_ip_ );
-                            routes_.insert( std::make_pair( addr, inst ) );
-                        }
-                    }
-                } );
+                auto addr = htonl( inst->my_ip_ );
+                routes_.insert( std::make_pair( addr, inst ) );
+            }
         }
 
-        void on_read( char *data, size_t length ) override
+        /// routes_lock_ has to be locked; only the clients are found here
+        void route_packet( const char *data, size_t length,
+                           batch_routes &out )
         {
-            auto mess = std::make_shared<noname::message_type>( );
-            mess->set_call( "push" );
-            mess->set_body( data, length );
-            auto srcdst = common::extract_ip_v4( data, length );
+            if( length <= hdr_len_ ) {
+                return;
+            }
 
-            if( srcdst.second ) {
+            /// in vnet mode the virtio header goes with the packet
+            auto srcdst = common::extract_ip_v4( data   + hdr_len_,
+                                                 length - hdr_len_ );
 
-                //std::cerr << std::hex << (srcdst.second & 0xFF000000) << "\n";
+            if( srcdst.second ) {
 
-                if( uipv4::is_multicast( ntohl( srcdst.second ) ) ) {
+                routed_packet pkt;
+                pkt.data   = data;
+                pkt.length = length;
 
-                    for( auto &r: routes_ ) {
-                        r.second->send_message( mess );
+                if( is_fanout( ntohl( srcdst.second ) ) ) {
+                    if( !out.have_everybody ) {
+                        out.everybody.reserve( routes_.size( ) );
+                        for( auto &r: routes_ ) {
+                            out.everybody.push_back( r.second );
+                        }
+                        out.have_everybody = true;
                     }
+                    out.packets.push_back( pkt );
                 } else {
                     auto f = routes_.find( srcdst.second );
                     if( f != routes_.end( ) ) {
-                        f->second->send_message( mess );
+                        pkt.client = f->second;
+                        out.packets.push_back( pkt );
                     }
                 }
             }
+        }
 
+        /// multicast and broadcast go to everybody if the server allows
+        bool is_fanout( std::uint32_t dst ) const
+        {
+            if( uipv4::is_multicast( dst ) ) {
+                return mcast_;
+            }
+            const auto bcast = static_cast<std::uint32_t>(
+                                    addr_.to_ulong( ) | ~mask_.to_ulong( ) );
+            return bcast_
+                && ( uipv4::is_broadcast( dst ) || ( dst == bcast ) );
         }
 
-        void on_read_error( const error_code & ) override
+        /// A packet for everybody is framed once for every kind of frames;
+        /// the clients get the same buffer. Clients with a cipher or a
+        /// codec make their own frames
+        static void fanout_packet( const std::vector<delegate_sptr> &clients,
+                                   const char *data, size_t length,
+                                   std::vector<frame_group> &groups )
         {
+            if( clients.size( ) == 1 ) {
+                push_packet( clients.front( ), data, length );
+                return;
+            }
+
+            groups.clear( );
+            for( auto &c: clients ) {
 
+                auto &cln(*c);
+                if( !cln.frame_shareable( ) ) {
+                    cln.send_packet( data, length );
+                    continue;
+                }
+
+                frame_group *grp = nullptr;
+                for( auto &g: groups ) {
+                    if( g.first->same_frames( cln ) ) {
+                        grp = &g;
+                        break;
+                    }
+                }
+
+                if( !grp ) {
+                    groups.emplace_back( &cln,
+                                cln.prepare_shared_push( data, length ) );
+                    grp = &groups.back( );
+                }
+                cln.send_shared( grp->second );
+            }
+            groups.clear( );
         }
 
-        void on_write_error( const error_code & ) override
+        /// the frame buffer comes from the client's own cache;
+        /// the packet is copied into it once
+        static void push_packet( const delegate_sptr &cln,
+                                 const char *data, size_t length )
         {
-
+            cln->send_packet( data, length );
         }
 
-        void on_write_exception(  ) override
+        /// the clients are found under the lock, the packets are framed
+        /// and sent without it; the queues of the device don't wait for
+        /// each other
+        void on_read_batch( const common::packet_slice *packets,
+                            size_t count )
         {
-            throw;
+            batch_routes routes;
+            routes.packets.reserve( count );
+            {
+                std::lock_guard<std::mutex> lck(routes_lock_);
+                for( size_t i = 0; i < count; ++i ) {
+                    route_packet( packets[i].data, packets[i].length,
+                                  routes );
+                }
+            }
+
+            std::vector<frame_group> groups;
+            for( auto &p: routes.packets ) {
+                if( p.client ) {
+                    push_packet( p.client, p.data, p.length );
+                } else {
+                    fanout_packet( routes.everybody, p.data, p.length,
+                                   groups );
+                }
+            }
         }
 
         application                  *app_ = nullptr;
         logger_impl                  &log_;
         utilities::address_v4_poll    poll_;
 
+        queue_list                    queues_;
+        std::atomic<std::size_t>      next_queue_{0};
+        bool                          vnet_hdr_ = false;
+        size_t                        hdr_len_  = 0;
+        size_t                        block_    = common::TUN_DEFAULT_BLOCK;
+        size_t                        batch_bytes_ = 0;
+        std::string                   compress_;
+        bool                          header_compress_ = false;
+
         routev4_map                   routes_;
         client_set                    tmp_clients_;
+        std::mutex                    routes_lock_;
 
         std::string                   device_name_;
 
@@ -247,6 +557,8 @@ namespace  {
 
         address                       addr_;
         address                       mask_;
+        bool                          mcast_ = true;
+        bool                          bcast_ = false;
     };
 
     using device_sptr = std::shared_ptr<device>;
@@ -260,6 +572,10 @@ namespace  {
     void client_delegate::on_message_ready( tag_type, buffer_type,
                                             const_buffer_slice slice )
     {
+        if( dispatch_packet( slice ) ) {
+            return;
+        }
+
         auto mess = mcache_.get( );
         mess->ParseFromArray( slice.data( ),
                               slice.size( ) );
@@ -270,12 +586,30 @@ namespace  {
 
     bool client_delegate::on_register_me( message_sptr &mess )
     {
+        rpc::tuntap::register_req req;
+        req.ParseFromString( mess->body( ) );
+
+        mess->set_call( "regok" );
+
+        if( !cipher_name( ).empty( ) && !cipher_on( ) ) {
+            mess->clear_body( );
+            mess->mutable_err( )->set_mess( "Encryption is required." );
+            send_message( mess );
+            return false;
+        }
+
+        /// super-packets can't be written to a device without vnet header
+        if( req.vnet_hdr( ) != my_device_->vnet_hdr_ ) {
+            mess->clear_body( );
+            mess->mutable_err( )->set_mess( "Vnet header mode mismatch." );
+            send_message( mess );
+            return false;
+        }
 
         my_ip_       = my_device_->poll_.next( );
         my_mask_     = htonl( my_device_->poll_.mask( ) );
         auto my_addr = htonl( my_device_->addr_.to_v4( ).to_ulong( ) );
 
-        mess->set_call( "regok" );
         if( my_ip_ == 0 ) {
             mess->clear_body( );
             mess->mutable_err( )->set_mess( "Server is full." );
@@ -283,9 +617,6 @@ namespace  {
             return false;
         };
 
-        rpc::tuntap::register_req req;
-        req.ParseFromString( mess->body( ) );
-
         name_ = req.name( );
 
         rpc::tuntap::register_res res;
@@ -300,18 +631,29 @@ namespace  {
 
         my_device_->register_client( this );
 
-        calls_["push"] = [this]( message_sptr &mess )
-                         { return on_push( mess ); };
+        calls_[noname::OP_PUSH] = [this]( message_sptr &mess )
+                                  { return on_push( mess ); };
+        registered_ = true;
         return true;
     }
 
     bool client_delegate::on_push( message_sptr &mess )
     {
-        my_device_->write( mess->body( ) );
+        my_queue_->write( mess->body( ) );
         mcache_.push( mess );
         return true;
     }
 
+    /// the packet is written from the frame buffer if the device is idle
+    bool client_delegate::on_packet( const char *data, size_t len )
+    {
+        if( !registered_ ) {
+            return false;
+        }
+        my_queue_->write_through( data, len );
+        return true;
+    }
+
     void client_delegate::on_close( )
     {
         //on_close_( );
@@ -329,14 +671,40 @@ namespace  {
             ,log_(app_->log( ))
         { }
 
+        /// the protocol of a client without its transport
+        delegate_sptr create_client( device_sptr dev, bool udp,
+                                     const common::create_parameters &opts )
+        {
+            auto mexlen = noname::frame_maxlen( dev->block_ );
+            auto prot = std::make_shared<client_delegate>( app_, mexlen );
+            prot->my_device_ = dev;
+            prot->my_queue_  = dev->next_queue( );
+            prot->set_batch_bytes( dev->batch_bytes_ );
+            if( !udp ) {
+                prot->set_cork( opts.cork_bytes, opts.cork_frames );
+            } else {
+                prot->set_fragment_size( opts.fragment_size );
+                prot->set_sequence( opts.sequence, opts.reorder_depth,
+                                    opts.reorder_ms );
+                prot->set_fec( common::fec_scheme_by_name( opts.fec ),
+                               opts.fec_data, opts.fec_repair,
+                               opts.fec_ms );
+            }
+            prot->set_compress( dev->compress_ );
+            prot->set_header_compress( dev->header_compress_ );
+            prot->set_integrity( opts.integrity );
+            prot->set_cipher( opts.cipher );
+            return prot;
+        }
+
         void on_new_client( device_sptr dev, transport_type *c,
-                            std::string addr, std::uint16_t svc, bool /*udp*/ )
+                            std::string addr, std::uint16_t svc, bool udp,
+                            const common::create_parameters &opts )
         {
             try {
 
-                auto prot = std::make_shared<client_delegate>( app_, 2048 );
+                auto prot = create_client( dev, udp, opts );
                 c->set_delegate( prot.get( ) );
-                prot->my_device_ = dev;
                 prot->assign_transport( c );
                 dev->add_tmp_client( prot );
 
@@ -346,6 +714,27 @@ namespace  {
             }
         }
 
+        /// a peer of the agent's own port; no transport of srpc
+        delegate_sptr on_new_peer( device_sptr dev,
+                                   const common::udp_port_sptr &port,
+                                   const common::udp_endpoint &peer,
+                                   std::function<void ( )> detach,
+                                   const common::create_parameters &opts )
+        {
+            try {
+
+                auto prot = create_client( dev, true, opts );
+                prot->assign_port( port, peer, std::move( detach ) );
+                dev->add_tmp_client( prot );
+                return prot;
+
+            } catch( const std::exception &ex ) {
+                LOGERR << "Failed to create protocol for client "
+                       << peer << "; " << ex.what( );
+            }
+            return delegate_sptr( );
+        }
+
         void on_error( device_sptr dev,
                        const noname::server::error_code &e,
                        const std::string &point_name )
@@ -386,6 +775,7 @@ namespace  {
         {
             namespace ntcp = noname::server::tcp;
             namespace nudp = noname::server::udp;
+            namespace nport = noname::server::port;
 
             auto e = utilities::get_endpoint_info( inf.point );
 
@@ -393,12 +783,67 @@ namespace  {
 
                 if( e.is_ip( ) ) {
 
-                    auto svc = inf.udp
-                            ? nudp::create( app_, e.addpess, e.service )
-                            : ntcp::create( app_, e.addpess, e.service );
-
                     auto dev = get_device( inf );
 
+                    /// a datagram bigger than a frame is broken anyway
+                    common::udp_port_params pparams;
+                    pparams.batch   = inf.common.udp_batch;
+                    pparams.buffer  = noname::frame_maxlen( dev->block_ );
+                    pparams.offload = inf.common.udp_offload;
+
+                    auto svc = !inf.udp
+                            ? ntcp::create( app_, e.addpess, e.service )
+                            : inf.common.udp_batch
+                            ? nport::create( app_, e.addpess, e.service,
+                                             pparams )
+                            : nudp::create( app_, e.addpess, e.service );
+
+                    if( inf.udp && noname::frame_maxlen( dev->block_ )
+                                 > noname::udp_datagram_max )
+                    {
+                        LOGERR << "MTU of " << quote(inf.device)
+                               << " is too big for udp server "
+                               << quote(inf.point);
+                        return false;
+                    }
+
+                    /// throws for an unknown name
+                    common::create_integrity( inf.common.integrity );
+                    if( inf.udp && inf.common.integrity == "none" ) {
+                        LOGERR << "Integrity none is for tcp only; server "
+                               << quote(inf.point);
+                        return false;
+                    }
+                    common::check_aead_name( inf.common.cipher );
+
+                    const size_t frag = inf.common.fragment_size;
+                    if( inf.udp && frag && ( frag < common::frag_min_size
+                                 || frag > noname::udp_datagram_max ) )
+                    {
+                        LOGERR << "Invalid fragment size " << frag
+                               << " for udp server " << quote(inf.point);
+                        return false;
+                    }
+
+                    const size_t depth = inf.common.reorder_depth;
+                    if( inf.udp && depth && ( !inf.common.sequence
+                                 || depth > common::replay_window::size ) )
+                    {
+                        LOGERR << "Invalid reorder depth " << depth
+                               << " for udp server " << quote(inf.point)
+                               << "; it needs sequence and "
+                               << common::replay_window::size
+                               << " frames at most";
+                        return false;
+                    }
+
+                    /// throws for an unknown scheme or bad group sizes
+                    if( inf.udp ) {
+                        common::check_fec_params(
+                                common::fec_scheme_by_name( inf.common.fec ),
+                                inf.common.fec_data, inf.common.fec_repair );
+                    }
+
                     {
                         std::lock_guard<std::mutex> lck(serv_lock_);
                         auto res = serv_.insert(
@@ -412,14 +857,26 @@ namespace  {
 
                     bool is_udp  = inf.udp;
                     std::string point_name = inf.point;
+                    common::create_parameters opts = inf.common;
 
                     svc->assignt_accept_call(
-                        [this, dev, is_udp]( transport_type *t,
-                                             const std::string &addr,
-                                             std::uint16_t port )
+                        [this, dev, is_udp, opts]( transport_type *t,
+                                                const std::string &addr,
+                                                std::uint16_t port )
                         {
                             this->on_new_client( dev, t, addr, port,
-                                                 is_udp );
+                                                 is_udp, opts );
+                        } );
+
+                    svc->assignt_peer_call(
+                        [this, dev, opts]( const common::udp_port_sptr &port,
+                                           const common::udp_endpoint &peer,
+                                           std::function<void ( )> detach )
+                        {
+                            return noname::server::delegate_sptr(
+                                    this->on_new_peer( dev, port, peer,
+                                                       std::move( detach ),
+                                                       opts ) );
                         } );
 
                     svc->assignt_error_call(
@@ -453,6 +910,61 @@ namespace  {
             return true;
         }
 
+        void get_device_stats( listener2::device_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto dev = d.second.lock( );
+                if( dev ) {
+                    out[dev->device_name_] = dev->write_queue_stat( );
+                }
+            }
+        }
+
+        void get_compress_stats( listener2::compress_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto dev = d.second.lock( );
+                if( dev ) {
+                    dev->get_compress_stats( out );
+                }
+            }
+        }
+
+        void get_write_stats( listener2::write_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto dev = d.second.lock( );
+                if( dev ) {
+                    dev->get_write_stats( out );
+                }
+            }
+        }
+
+        void get_reorder_stats( listener2::reorder_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto dev = d.second.lock( );
+                if( dev ) {
+                    dev->get_reorder_stats( out );
+                }
+            }
+        }
+
+        void get_fec_stats( listener2::fec_stat_map &out )
+        {
+            std::lock_guard<std::mutex> lck(devs_lock_);
+            for( auto &d: devs_ ) {
+                auto dev = d.second.lock( );
+                if( dev ) {
+                    dev->get_fec_stats( out );
+                }
+            }
+        }
+
         void start_all( )
         {
             for( auto &d: devs_ ) {
@@ -509,5 +1021,30 @@ namespace  {
         return impl_->add_server( inf, start );
     }
 
+    void listener2::get_device_stats( device_stat_map &out ) const
+    {
+        impl_->get_device_stats( out );
+    }
+
+    void listener2::get_compress_stats( compress_stat_map &out ) const
+    {
+        impl_->get_compress_stats( out );
+    }
+
+    void listener2::get_write_stats( write_stat_map &out ) const
+    {
+        impl_->get_write_stats( out );
+    }
+
+    void listener2::get_reorder_stats( reorder_stat_map &out ) const
+    {
+        impl_->get_reorder_stats( out );
+    }
+
+    void listener2::get_fec_stats( fec_stat_map &out ) const
+    {
+        impl_->get_fec_stats( out );
+    }
+
 }}
 
@@ -8,6 +8,11 @@
 #include "srpc/common/observers/define.h"
 
 #include "common/create-params.h"
+#include "common/aqm-queue.h"
+#include "common/compress.h"
+#include "common/write-stat.h"
+#include "common/reorder-buffer.h"
+#include "common/fec.h"
 
 namespace msctl { namespace agent {
 
@@ -26,9 +31,20 @@ namespace msctl { namespace agent {
             bool                            mcast       = true;
             bool                            bcast       = false;
             bool                            udp         = true;
+            std::uint32_t                   queues      = 1;
+            bool                            vnet_hdr    = false;
+            std::uint32_t                   mtu         = 0;
             common::create_parameters       common;
         };
 
+        using device_stat_map   = std::map<std::string, common::queue_stat>;
+        using compress_stat_map = std::map<std::string,
+                                           common::compress_stat>;
+        using write_stat_map    = std::map<std::string, common::write_stat>;
+        using reorder_stat_map  = std::map<std::string,
+                                           common::reorder_stat>;
+        using fec_stat_map      = std::map<std::string, common::fec_stat>;
+
         listener2( application *app );
 
         static std::shared_ptr<listener2> create( application *app );
@@ -39,6 +55,21 @@ namespace msctl { namespace agent {
 
         bool add_server( const server_create_info &inf, bool start );
 
+        /// write queues of the devices; queues of one device are summed
+        void get_device_stats( device_stat_map &out ) const;
+
+        /// compression of the registered clients by "device/ip"
+        void get_compress_stats( compress_stat_map &out ) const;
+
+        /// socket writes of the registered clients by "device/ip"
+        void get_write_stats( write_stat_map &out ) const;
+
+        /// sequence numbers of the registered UDP clients by "device/ip"
+        void get_reorder_stats( reorder_stat_map &out ) const;
+
+        /// error correction of the registered UDP clients by "device/ip"
+        void get_fec_stats( fec_stat_map &out ) const;
+
     private:
 
         void init( )  override;
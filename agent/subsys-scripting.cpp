@@ -13,6 +13,7 @@
 #include "common/tuntap.h"
 #include "common/net-ifaces.h"
 #include "common/create-params.h"
+#include "common/packet-pool.h"
 
 #include "boost/algorithm/string.hpp"
 
@@ -42,6 +43,7 @@ namespace msctl { namespace agent {
 
         using objects::new_string;
         using objects::new_integer;
+        using objects::new_number;
         using objects::new_table;
 
         using utilities::decorators::quote;
@@ -131,6 +133,13 @@ namespace msctl { namespace agent {
             return 1;
         }
 
+        /// 0 keeps the MTU of the device
+        bool valid_mtu( std::uint32_t mtu )
+        {
+            return ( mtu == 0 )
+                || ( mtu >= common::TUN_MTU_MIN && mtu <= common::TUN_MTU_MAX );
+        }
+
         int lcall_add_server( lua_State *L )
         {
             static auto &log_(gs_application->log( ));
@@ -165,6 +174,30 @@ namespace msctl { namespace agent {
 
                 scripts::get_common_opts( tw["options"], inf.common );
 
+                inf.queues = tw["queues"].as_uint32( 1 );
+                if( inf.queues < 1 ) {
+                    inf.queues = 1;
+                }
+
+                inf.mcast = tw["mcast"].as_bool( true );
+                inf.bcast = tw["bcast"].as_bool( false );
+
+                inf.vnet_hdr = tw["vnet_hdr"].as_bool( false );
+                if( inf.vnet_hdr && inf.udp ) {
+                    LOGERR << "vnet_hdr requires tcp for server";
+                    ls.push( );
+                    ls.push( "Bad protocol for vnet_hdr." );
+                    return 2;
+                }
+
+                inf.mtu = tw["mtu"].as_uint32( 0 );
+                if( !valid_mtu( inf.mtu ) ) {
+                    LOGERR << "Invalid mtu " << inf.mtu << " for server";
+                    ls.push( );
+                    ls.push( "Bad mtu value." );
+                    return 2;
+                }
+
                 auto addr_poll  = tw["addr_poll"].as_string( );
 
                 scripts::add_function( tw, "on_register",   inf.common );
@@ -326,6 +359,22 @@ namespace msctl { namespace agent {
                     }
                 }
 
+                inf.vnet_hdr = tw["vnet_hdr"].as_bool( false );
+                if( inf.vnet_hdr && inf.udp ) {
+                    LOGERR << "vnet_hdr requires tcp for client";
+                    ls.push( );
+                    ls.push( "Bad protocol for vnet_hdr." );
+                    return 2;
+                }
+
+                inf.mtu = tw["mtu"].as_uint32( 0 );
+                if( !valid_mtu( inf.mtu ) ) {
+                    LOGERR << "Invalid mtu " << inf.mtu << " for client";
+                    ls.push( );
+                    ls.push( "Bad mtu value." );
+                    return 2;
+                }
+
                 scripts::get_common_opts( tw["options"],    inf.common );
                 scripts::add_function( tw, "on_register",   inf.common );
                 scripts::add_function( tw, "on_disconnect", inf.common );
@@ -453,6 +502,188 @@ namespace msctl { namespace agent {
             return 1;
         }
 
+        int lcall_pool_stat( lua_State *L )
+        {
+            using objects::new_integer;
+            objects::table res;
+
+            auto stat = common::packet_pool::total_stat( );
+            res.add( "hits",     new_integer( stat.hits ) );
+            res.add( "misses",   new_integer( stat.misses ) );
+            res.add( "remote",   new_integer( stat.remote ) );
+            res.add( "oversize", new_integer( stat.oversize ) );
+
+            res.push( L );
+            return 1;
+        }
+
+        objects::table *new_queue_stat( const common::queue_stat &stat )
+        {
+            return new_table( )
+                 ->add( "depth",         new_integer( stat.depth ) )
+                 ->add( "bytes",         new_integer( stat.bytes ) )
+                 ->add( "max_depth",     new_integer( stat.max_depth ) )
+                 ->add( "tail_drops",    new_integer( stat.tail_drops ) )
+                 ->add( "head_drops",    new_integer( stat.head_drops ) )
+                 ->add( "codel_drops",   new_integer( stat.codel_drops ) )
+                 ->add( "dropped_bytes", new_integer( stat.dropped_bytes ) )
+                 ;
+        }
+
+        /// write queues of the tun devices by the device name
+        int lcall_device_stat( lua_State *L )
+        {
+            objects::table res;
+
+            listener2::device_stat_map servers;
+            gs_application->subsys<listener2>( ).get_device_stats( servers );
+            for( auto &s: servers ) {
+                res.add( s.first, new_queue_stat( s.second ) );
+            }
+
+            clients2::device_stat_map clients;
+            gs_application->subsys<clients2>( ).get_device_stats( clients );
+            for( auto &c: clients ) {
+                res.add( c.first, new_queue_stat( c.second ) );
+            }
+
+            res.push( L );
+            return 1;
+        }
+
+        objects::table *new_compress_stat( const common::compress_stat &stat )
+        {
+            return new_table( )
+                 ->add( "frames",        new_integer( stat.frames ) )
+                 ->add( "skipped",       new_integer( stat.skipped ) )
+                 ->add( "bytes_in",      new_integer( stat.bytes_in ) )
+                 ->add( "bytes_out",     new_integer( stat.bytes_out ) )
+                 ->add( "compress_ns",   new_integer( stat.compress_ns ) )
+                 ->add( "decompress_ns", new_integer( stat.decompress_ns ) )
+                 ->add( "ratio",         new_number( stat.ratio( ) ) )
+                 ;
+        }
+
+        objects::table *new_write_stat( const common::write_stat &stat )
+        {
+            return new_table( )
+                 ->add( "writes",    new_integer( stat.writes ) )
+                 ->add( "frames",    new_integer( stat.frames ) )
+                 ->add( "bytes",     new_integer( stat.bytes ) )
+                 ->add( "corked",    new_integer( stat.corked ) )
+                 ->add( "drops",     new_integer( stat.drops ) )
+                 ->add( "per_write", new_number( stat.frames_per_write( ) ) )
+                 ;
+        }
+
+        objects::table *new_reorder_stat( const common::reorder_stat &stat )
+        {
+            return new_table( )
+                 ->add( "frames",     new_integer( stat.frames ) )
+                 ->add( "reordered",  new_integer( stat.reordered ) )
+                 ->add( "duplicates", new_integer( stat.duplicates ) )
+                 ->add( "late_drops", new_integer( stat.late_drops ) )
+                 ->add( "held",       new_integer( stat.held ) )
+                 ->add( "gaps",       new_integer( stat.gaps ) )
+                 ->add( "max_depth",  new_integer( stat.max_depth ) )
+                 ;
+        }
+
+        /// sequence numbers of UDP connections; "device/ip" for servers
+        int lcall_reorder_stat( lua_State *L )
+        {
+            objects::table res;
+
+            listener2::reorder_stat_map servers;
+            gs_application->subsys<listener2>( ).get_reorder_stats( servers );
+            for( auto &s: servers ) {
+                res.add( s.first, new_reorder_stat( s.second ) );
+            }
+
+            clients2::reorder_stat_map clients;
+            gs_application->subsys<clients2>( ).get_reorder_stats( clients );
+            for( auto &c: clients ) {
+                res.add( c.first, new_reorder_stat( c.second ) );
+            }
+
+            res.push( L );
+            return 1;
+        }
+
+        objects::table *new_fec_stat( const common::fec_stat &stat )
+        {
+            return new_table( )
+                 ->add( "groups",     new_integer( stat.groups ) )
+                 ->add( "repairs",    new_integer( stat.repairs ) )
+                 ->add( "repairs_in", new_integer( stat.repairs_in ) )
+                 ->add( "recovered",  new_integer( stat.recovered ) )
+                 ->add( "lost",       new_integer( stat.lost ) )
+                 ;
+        }
+
+        /// error correction of UDP connections; "device/ip" for servers
+        int lcall_fec_stat( lua_State *L )
+        {
+            objects::table res;
+
+            listener2::fec_stat_map servers;
+            gs_application->subsys<listener2>( ).get_fec_stats( servers );
+            for( auto &s: servers ) {
+                res.add( s.first, new_fec_stat( s.second ) );
+            }
+
+            clients2::fec_stat_map clients;
+            gs_application->subsys<clients2>( ).get_fec_stats( clients );
+            for( auto &c: clients ) {
+                res.add( c.first, new_fec_stat( c.second ) );
+            }
+
+            res.push( L );
+            return 1;
+        }
+
+        /// socket writes of the connections; "device/ip" for servers
+        int lcall_write_stat( lua_State *L )
+        {
+            objects::table res;
+
+            listener2::write_stat_map servers;
+            gs_application->subsys<listener2>( ).get_write_stats( servers );
+            for( auto &s: servers ) {
+                res.add( s.first, new_write_stat( s.second ) );
+            }
+
+            clients2::write_stat_map clients;
+            gs_application->subsys<clients2>( ).get_write_stats( clients );
+            for( auto &c: clients ) {
+                res.add( c.first, new_write_stat( c.second ) );
+            }
+
+            res.push( L );
+            return 1;
+        }
+
+        /// compression of the connections; "device/ip" for servers
+        int lcall_compress_stat( lua_State *L )
+        {
+            objects::table res;
+
+            listener2::compress_stat_map servers;
+            gs_application->subsys<listener2>( ).get_compress_stats( servers );
+            for( auto &s: servers ) {
+                res.add( s.first, new_compress_stat( s.second ) );
+            }
+
+            clients2::compress_stat_map clients;
+            gs_application->subsys<clients2>( ).get_compress_stats( clients );
+            for( auto &c: clients ) {
+                res.add( c.first, new_compress_stat( c.second ) );
+            }
+
+            res.push( L );
+            return 1;
+        }
+
         void state_init( lua_State *L, application *app )
         {
             mlua::state ls(L);
@@ -478,6 +709,15 @@ namespace msctl { namespace agent {
                      ->add( "ifaces", new_function( &lcall_net_ifaces ) )
                      );
 
+            tab.add( "stat", new_table( )
+                     ->add( "pool", new_function( &lcall_pool_stat ) )
+                     ->add( "devices", new_function( &lcall_device_stat ) )
+                     ->add( "compress", new_function( &lcall_compress_stat ) )
+                     ->add( "writes", new_function( &lcall_write_stat ) )
+                     ->add( "reorder", new_function( &lcall_reorder_stat ) )
+                     ->add( "fec", new_function( &lcall_fec_stat ) )
+                     );
+
             ls.set_object( "msctl", &tab );
 
         }
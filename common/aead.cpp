@@ -0,0 +1,146 @@
+#include <climits>
+#include <stdexcept>
+
+#include "aead.h"
+
+#include "openssl/evp.h"
+#include "openssl/hmac.h"
+#include "openssl/rand.h"
+
+namespace msctl { namespace common {
+
+namespace {
+
+    const size_t nonce_size = 12;
+
+    const EVP_CIPHER *cipher_by_name( const std::string &name )
+    {
+        if( name == "aes-256-gcm" ) {
+            return EVP_aes_256_gcm( );
+        } else if( name == "chacha20-poly1305" ) {
+            return EVP_chacha20_poly1305( );
+        }
+        throw std::runtime_error( "Invalid cipher " + name );
+    }
+}
+
+    aead::aead( const std::string &name, const std::string &key )
+        :ctx_(nullptr)
+        ,cipher_(cipher_by_name( name ))
+        ,name_(name)
+    {
+        if( key.size( ) != key_size ) {
+            throw std::runtime_error( "Invalid key size for " + name );
+        }
+
+        ctx_ = EVP_CIPHER_CTX_new( );
+        const auto *k = reinterpret_cast<const unsigned char *>(key.data( ));
+
+        if( !ctx_
+         || !EVP_CipherInit_ex( ctx_, cipher_, nullptr, nullptr, nullptr, 1 )
+         || !EVP_CIPHER_CTX_ctrl( ctx_, EVP_CTRL_AEAD_SET_IVLEN,
+                                  static_cast<int>(nonce_size), nullptr )
+         || !EVP_CipherInit_ex( ctx_, nullptr, nullptr, k, nullptr, 1 ) )
+        {
+            EVP_CIPHER_CTX_free( ctx_ );
+            throw std::runtime_error( "Failed to init cipher " + name );
+        }
+    }
+
+    aead::~aead( )
+    {
+        EVP_CIPHER_CTX_free( ctx_ );
+    }
+
+    /// the key stays; only the nonce and the direction change
+    bool aead::init( std::uint64_t counter, int enc )
+    {
+        unsigned char nonce[nonce_size] = { 0 };
+        for( size_t i = 0; i < 8; ++i ) {
+            nonce[nonce_size - 1 - i] =
+                    static_cast<unsigned char>(counter >> ( i * 8 ));
+        }
+        return EVP_CipherInit_ex( ctx_, nullptr, nullptr,
+                                  nullptr, nonce, enc ) == 1;
+    }
+
+    bool aead::seal( std::uint64_t counter, char *data, size_t len,
+                     char *tag )
+    {
+        auto *p   = reinterpret_cast<unsigned char *>(data);
+        int   out = 0;
+
+        return ( len <= INT_MAX )
+            && init( counter, 1 )
+            && EVP_CipherUpdate( ctx_, p, &out, p, static_cast<int>(len) )
+            && EVP_CipherFinal_ex( ctx_, p + out, &out )
+            && EVP_CIPHER_CTX_ctrl( ctx_, EVP_CTRL_AEAD_GET_TAG,
+                                    static_cast<int>(tag_size), tag );
+    }
+
+    bool aead::open( std::uint64_t counter, const char *src, size_t len,
+                     const char *tag, char *dst )
+    {
+        const auto *in  = reinterpret_cast<const unsigned char *>(src);
+        auto       *res = reinterpret_cast<unsigned char *>(dst);
+        int         out = 0;
+
+        /// the tag is set before the final call checks it
+        return ( len <= INT_MAX )
+            && init( counter, 0 )
+            && EVP_CIPHER_CTX_ctrl( ctx_, EVP_CTRL_AEAD_SET_TAG,
+                                    static_cast<int>(tag_size),
+                                    const_cast<char *>(tag) )
+            && EVP_CipherUpdate( ctx_, res, &out, in, static_cast<int>(len) )
+            && EVP_CipherFinal_ex( ctx_, res + out, &out ) == 1;
+    }
+
+    aead_uptr create_aead( const std::string &name, const std::string &key )
+    {
+        if( name.empty( ) ) {
+            return aead_uptr( );
+        }
+        return aead_uptr( new aead( name, key ) );
+    }
+
+    void check_aead_name( const std::string &name )
+    {
+        if( !name.empty( ) ) {
+            cipher_by_name( name );
+        }
+    }
+
+    std::string derive_key( const std::string &secret,
+                            const std::string &label,
+                            const std::string &salt )
+    {
+        const std::string data = label + salt;
+
+        std::string  res( EVP_MAX_MD_SIZE, '\0' );
+        unsigned int len = 0;
+
+        auto *ok = HMAC( EVP_sha256( ),
+                   secret.data( ), static_cast<int>(secret.size( )),
+                   reinterpret_cast<const unsigned char *>(data.data( )),
+                   data.size( ),
+                   reinterpret_cast<unsigned char *>(&res[0]), &len );
+
+        if( !ok || len < aead::key_size ) {
+            throw std::runtime_error( "Failed to derive a key" );
+        }
+        res.resize( aead::key_size );
+        return res;
+    }
+
+    std::string random_bytes( size_t len )
+    {
+        std::string res( len, '\0' );
+        if( len && RAND_bytes( reinterpret_cast<unsigned char *>(&res[0]),
+                               static_cast<int>(len) ) != 1 )
+        {
+            throw std::runtime_error( "Failed to get random bytes" );
+        }
+        return res;
+    }
+
+}}
@@ -0,0 +1,73 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct evp_cipher_ctx_st;
+struct evp_cipher_st;
+
+namespace msctl { namespace common {
+
+    /// authenticated encryption of frames with OpenSSL EVP;
+    /// AES-GCM goes with AES-NI and PCLMUL, ChaCha20-Poly1305 with the
+    /// vector units if the cpu has them.
+    /// The nonce is 4 zero bytes and the 8 byte big endian counter.
+    /// Not thread safe; one object is for one direction of a connection
+    class aead {
+
+        evp_cipher_ctx_st   *ctx_;
+        const evp_cipher_st *cipher_;
+        std::string          name_;
+
+        bool init( std::uint64_t counter, int enc );
+
+    public:
+
+        static const size_t key_size = 32;
+        static const size_t tag_size = 16;
+
+        /// key has key_size bytes; throws std::runtime_error
+        aead( const std::string &name, const std::string &key );
+        ~aead( );
+
+        aead( const aead & ) = delete;
+        aead &operator = ( const aead & ) = delete;
+
+        const std::string &name( ) const
+        {
+            return name_;
+        }
+
+        /// encrypts data in place and writes tag_size bytes to tag
+        bool seal( std::uint64_t counter, char *data, size_t len,
+                   char *tag );
+
+        /// decrypts src to dst; false if the tag doesn't match
+        bool open( std::uint64_t counter, const char *src, size_t len,
+                   const char *tag, char *dst );
+    };
+
+    using aead_uptr = std::unique_ptr<aead>;
+
+    /// "" -> empty pointer; "aes-256-gcm", "chacha20-poly1305".
+    /// Throws std::runtime_error for an unknown name or a bad key
+    aead_uptr create_aead( const std::string &name, const std::string &key );
+
+    /// throws std::runtime_error for an unknown name
+    void check_aead_name( const std::string &name );
+
+    /// a key_size key of one direction of a connection:
+    /// HMAC-SHA256 of the label and the salt with the shared secret
+    std::string derive_key( const std::string &secret,
+                            const std::string &label,
+                            const std::string &salt );
+
+    /// from the system random generator; throws if it fails
+    std::string random_bytes( size_t len );
+
+}}
+
+#endif // AEAD_H
@@ -0,0 +1,343 @@
+#ifndef AQM_QUEUE_H
+#define AQM_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace msctl { namespace common {
+
+    struct queue_limits {
+
+        enum aqm_policy {
+            AQM_TAIL_DROP = 0,  /// drop new packets
+            AQM_HEAD_DROP = 1,  /// drop the oldest waiting packets
+            AQM_CODEL     = 2,  /// tail drop + CoDel sojourn time drop
+        };
+
+        size_t          max_packets    = 0;   /// 0 - no limit
+        size_t          max_bytes      = 0;   /// 0 - no limit
+        aqm_policy      policy         = AQM_TAIL_DROP;
+        std::uint32_t   codel_target   = 5;   /// milliseconds
+        std::uint32_t   codel_interval = 100; /// milliseconds
+
+        bool fits( size_t packets, size_t bytes ) const
+        {
+            return ( max_packets == 0 || packets <= max_packets )
+                && ( max_bytes   == 0 || bytes   <= max_bytes );
+        }
+    };
+
+    /// "" and "tail" -> AQM_TAIL_DROP; "head" -> AQM_HEAD_DROP;
+    /// "codel" -> AQM_CODEL
+    inline
+    bool parse_aqm_policy( const std::string &name,
+                           queue_limits::aqm_policy &out )
+    {
+        if( name.empty( ) || name == "tail" ) {
+            out = queue_limits::AQM_TAIL_DROP;
+        } else if( name == "head" ) {
+            out = queue_limits::AQM_HEAD_DROP;
+        } else if( name == "codel" ) {
+            out = queue_limits::AQM_CODEL;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    struct queue_stat {
+
+        std::uint64_t depth         = 0; /// packets in the queue now
+        std::uint64_t bytes         = 0; /// bytes in the queue now
+        std::uint64_t max_depth     = 0; /// the biggest depth seen
+        std::uint64_t tail_drops    = 0;
+        std::uint64_t head_drops    = 0;
+        std::uint64_t codel_drops   = 0;
+        std::uint64_t dropped_bytes = 0;
+
+        std::uint64_t drops( ) const
+        {
+            return tail_drops + head_drops + codel_drops;
+        }
+
+        queue_stat &operator += ( const queue_stat &other )
+        {
+            depth         += other.depth;
+            bytes         += other.bytes;
+            max_depth      = std::max( max_depth, other.max_depth );
+            tail_drops    += other.tail_drops;
+            head_drops    += other.head_drops;
+            codel_drops   += other.codel_drops;
+            dropped_bytes += other.dropped_bytes;
+            return *this;
+        }
+    };
+
+    /// FIFO with limits and a drop policy.
+    /// Not thread safe: push and pop have to be called from one strand;
+    /// stat( ) can be called from any thread.
+    template <typename T>
+    class aqm_queue {
+
+    public:
+
+        using clock_type = std::chrono::steady_clock;
+        using time_point = clock_type::time_point;
+        using duration   = clock_type::duration;
+
+    private:
+
+        struct entry {
+            T           value;
+            size_t      bytes;
+            time_point  stamp;
+        };
+
+        using counter_type = std::atomic<std::uint64_t>;
+
+        /// the only writer is the queue strand
+        static void add( counter_type &cnt, std::uint64_t value )
+        {
+            cnt.store( cnt.load( std::memory_order_relaxed ) + value,
+                       std::memory_order_relaxed );
+        }
+
+        std::deque<entry>   queue_;
+        size_t              bytes_ = 0;
+        queue_limits        limits_;
+
+        /// CoDel state; RFC 8289
+        bool                dropping_    = false;
+        time_point          first_above_ = time_point( );
+        time_point          drop_next_   = time_point( );
+        std::uint32_t       count_       = 0;
+        std::uint32_t       last_count_  = 0;
+
+        counter_type        depth_;
+        counter_type        depth_bytes_;
+        counter_type        max_depth_;
+        counter_type        tail_drops_;
+        counter_type        head_drops_;
+        counter_type        codel_drops_;
+        counter_type        dropped_bytes_;
+
+        void update_depth( )
+        {
+            const std::uint64_t depth = queue_.size( );
+            depth_.store( depth, std::memory_order_relaxed );
+            depth_bytes_.store( bytes_, std::memory_order_relaxed );
+            if( depth > max_depth_.load( std::memory_order_relaxed ) ) {
+                max_depth_.store( depth, std::memory_order_relaxed );
+            }
+        }
+
+        template <typename DropCall>
+        void drop_at( typename std::deque<entry>::iterator pos,
+                      counter_type &cnt, DropCall &drop )
+        {
+            add( cnt, 1 );
+            add( dropped_bytes_, pos->bytes );
+            bytes_ -= pos->bytes;
+            drop( pos->value );
+            queue_.erase( pos );
+        }
+
+        duration interval( ) const
+        {
+            return std::chrono::milliseconds( limits_.codel_interval );
+        }
+
+        duration target( ) const
+        {
+            return std::chrono::milliseconds( limits_.codel_target );
+        }
+
+        time_point control_law( time_point t ) const
+        {
+            using fduration = std::chrono::duration<double,
+                                                    duration::period>;
+            fduration next = fduration( interval( ) ) / std::sqrt( count_ );
+            return t + std::chrono::duration_cast<duration>( next );
+        }
+
+        /// the head has been waiting longer than target for an interval
+        bool ok_to_drop( time_point now )
+        {
+            /// one packet is not a standing queue
+            if( queue_.size( ) <= 1
+             || now - queue_.front( ).stamp < target( ) )
+            {
+                first_above_ = time_point( );
+                return false;
+            }
+
+            if( first_above_ == time_point( ) ) {
+                first_above_ = now + interval( );
+                return false;
+            }
+
+            return now >= first_above_;
+        }
+
+    public:
+
+        aqm_queue( )
+            :depth_(0)
+            ,depth_bytes_(0)
+            ,max_depth_(0)
+            ,tail_drops_(0)
+            ,head_drops_(0)
+            ,codel_drops_(0)
+            ,dropped_bytes_(0)
+        { }
+
+        aqm_queue( const aqm_queue & ) = delete;
+        aqm_queue &operator = ( const aqm_queue & ) = delete;
+
+        void set_limits( const queue_limits &lim )
+        {
+            limits_ = lim;
+        }
+
+        const queue_limits &limits( ) const
+        {
+            return limits_;
+        }
+
+        /// keep_front: the head is being written and can't be dropped.
+        /// An empty queue takes any packet.
+        /// Returns false if the new value has been dropped
+        template <typename DropCall>
+        bool push( T value, size_t bytes, bool keep_front, DropCall drop )
+        {
+            if( !limits_.fits( queue_.size( ) + 1, bytes_ + bytes ) ) {
+
+                if( limits_.policy == queue_limits::AQM_HEAD_DROP ) {
+                    const size_t first = keep_front ? 1 : 0;
+                    while( queue_.size( ) > first
+                        && !limits_.fits( queue_.size( ) + 1,
+                                          bytes_ + bytes ) )
+                    {
+                        drop_at( queue_.begin( ) + first, head_drops_, drop );
+                    }
+                }
+
+                if( !queue_.empty( )
+                 && !limits_.fits( queue_.size( ) + 1, bytes_ + bytes ) )
+                {
+                    add( tail_drops_, 1 );
+                    add( dropped_bytes_, bytes );
+                    drop( value );
+                    update_depth( );
+                    return false;
+                }
+            }
+
+            entry e { std::move( value ), bytes, time_point( ) };
+            if( limits_.policy == queue_limits::AQM_CODEL ) {
+                e.stamp = clock_type::now( );
+            }
+
+            queue_.emplace_back( std::move( e ) );
+            bytes_ += bytes;
+            update_depth( );
+            return true;
+        }
+
+        /// CoDel step; has to be called before the head is taken.
+        /// Drops heads that have been waiting too long
+        template <typename DropCall>
+        void codel_dequeue( DropCall drop )
+        {
+            if( limits_.policy != queue_limits::AQM_CODEL ) {
+                return;
+            }
+
+            if( queue_.empty( ) ) {
+                dropping_ = false;
+                return;
+            }
+
+            auto now = clock_type::now( );
+            bool ok = ok_to_drop( now );
+
+            if( dropping_ ) {
+                if( !ok ) {
+                    dropping_ = false;
+                }
+                while( dropping_ && now >= drop_next_ ) {
+                    drop_at( queue_.begin( ), codel_drops_, drop );
+                    ++count_;
+                    if( !ok_to_drop( now ) ) {
+                        dropping_ = false;
+                    } else {
+                        drop_next_ = control_law( drop_next_ );
+                    }
+                }
+            } else if( ok ) {
+                drop_at( queue_.begin( ), codel_drops_, drop );
+                dropping_ = true;
+
+                /// the last dropping state was recent; start from its rate
+                std::uint32_t delta = count_ - last_count_;
+                count_ = ( delta > 1 && now - drop_next_ < interval( ) * 16 )
+                       ? delta
+                       : 1;
+                drop_next_  = control_law( now );
+                last_count_ = count_;
+            }
+
+            update_depth( );
+        }
+
+        T &front( )
+        {
+            return queue_.front( ).value;
+        }
+
+        void pop( )
+        {
+            bytes_ -= queue_.front( ).bytes;
+            queue_.pop_front( );
+            update_depth( );
+        }
+
+        bool empty( ) const
+        {
+            return queue_.empty( );
+        }
+
+        size_t size( ) const
+        {
+            return queue_.size( );
+        }
+
+        /// the same as size( ) but can be called from any thread
+        std::uint64_t depth( ) const
+        {
+            return depth_.load( std::memory_order_relaxed );
+        }
+
+        queue_stat stat( ) const
+        {
+            queue_stat res;
+            res.depth         = depth_.load( std::memory_order_relaxed );
+            res.bytes         = depth_bytes_.load( std::memory_order_relaxed );
+            res.max_depth     = max_depth_.load( std::memory_order_relaxed );
+            res.tail_drops    = tail_drops_.load( std::memory_order_relaxed );
+            res.head_drops    = head_drops_.load( std::memory_order_relaxed );
+            res.codel_drops   = codel_drops_.load( std::memory_order_relaxed );
+            res.dropped_bytes = dropped_bytes_.load(
+                                                std::memory_order_relaxed );
+            return res;
+        }
+    };
+
+}}
+
+#endif // AQM_QUEUE_H
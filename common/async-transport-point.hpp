@@ -3,14 +3,22 @@
 
 #include "boost/asio.hpp"
 
+#include "packet-pool.h"
+#include "aqm-queue.h"
+
 #include <functional>
 #include <memory>
 
 #include <string>
-#include <queue>
+#include <vector>
 
 namespace msctl { namespace async_transport {
 
+    struct packet_slice {
+        char   *data;
+        size_t  length;
+    };
+
     template <typename ST>
     class point_iface: public std::enable_shared_from_this<point_iface<ST> > {
 
@@ -28,35 +36,23 @@ namespace msctl { namespace async_transport {
             OPT_DISPATCH_READ     = 0x02,
         };
 
+        /// default number of packets for one read event
+        static const size_t default_read_budget = 1;
+
         typedef std::function <
             void (const boost::system::error_code &)
         > write_closure;
 
     private:
 
-        typedef std::string message_type;
+        typedef common::packet_ptr message_type;
 
         struct queue_value {
-
-            typedef std::shared_ptr<queue_value> shared_type;
-
             message_type    message_;
             write_closure   success_;
-
-            queue_value( const char *data, size_t length )
-                :message_(data, length)
-            { }
-
-            static
-            shared_type create( const char *data, size_t length )
-            {
-                return std::make_shared<queue_value>( data, length );
-            }
         };
 
-        typedef typename queue_value::shared_type  queue_value_sptr;
-
-        typedef std::queue<queue_value_sptr> message_queue_type;
+        typedef common::aqm_queue<queue_value> message_queue_type;
 
         typedef void (this_type::*call_impl)( );
 
@@ -67,6 +63,9 @@ namespace msctl { namespace async_transport {
         message_queue_type                write_queue_;
 
         std::vector<char>                 read_buffer_;
+        size_t                            read_block_size_;
+        size_t                            read_budget_;
+        std::vector<packet_slice>         read_batch_;
         call_impl                         read_impl_;
         call_impl                         async_write_impl_;
 
@@ -97,6 +96,8 @@ namespace msctl { namespace async_transport {
             ,write_dispatcher_(ios_)
             ,stream_(ios_)
             ,read_buffer_(read_block_size)
+            ,read_block_size_(read_block_size)
+            ,read_budget_(default_read_budget)
             ,read_impl_(get_read_dispatch(opts))
             ,async_write_impl_(get_message_transform(opts))
             ,active_(true)
@@ -121,19 +122,31 @@ namespace msctl { namespace async_transport {
 
         /// =========== queue wrap calls =========== ///
 
-        void queue_push( const queue_value_sptr &new_mess )
+        static void queue_drop( queue_value &mess )
         {
-            write_queue_.push( new_mess );
+            if( mess.success_ ) {
+                mess.success_( boost::asio::error::no_buffer_space );
+            }
         }
 
-        const queue_value_sptr &queue_top( ) const
+        /// the head is being written if the queue is not empty
+        bool queue_push( const queue_value &new_mess )
+        {
+            return write_queue_.push( new_mess, new_mess.message_->size( ),
+                                      !write_queue_.empty( ),
+                                      &this_type::queue_drop );
+        }
+
+        queue_value &queue_top( )
         {
             return write_queue_.front( );
         }
 
+        /// the next head can be dropped by AQM here
         void queue_pop( )
         {
             write_queue_.pop( );
+            write_queue_.codel_dequeue( &this_type::queue_drop );
         }
 
         bool queue_empty( ) const
@@ -169,17 +182,17 @@ namespace msctl { namespace async_transport {
 
         void async_write_transform(  )
         {
-            std::string &top( queue_top( )->message_ );
+            message_type &top( queue_top( ).message_ );
 
-            top.assign( on_transform_message( top ) );
+            on_transform_message( top );
 
-            async_write( top.c_str( ), top.size( ), 0 );
+            async_write( top->data( ), top->size( ), 0 );
         }
 
         void async_write_no_transform(  )
         {
-            const std::string &top( queue_top( )->message_ );
-            async_write( top.c_str( ), top.size( ), 0);
+            const message_type &top( queue_top( ).message_ );
+            async_write( top->data( ), top->size( ), 0);
         }
 
         void write_handler( const boost::system::error_code &error,
@@ -188,7 +201,7 @@ namespace msctl { namespace async_transport {
                             size_t       total,
                             shared_type  /*this_inst*/ )
         {
-            queue_value &top( *queue_top( ) );
+            queue_value &top( queue_top( ) );
 
             if( !error ) {
 
@@ -196,9 +209,9 @@ namespace msctl { namespace async_transport {
 
                     total += bytes;
 
-                    const std::string &top_mess( top.message_ );
-                    async_write( top_mess.c_str( ) + total,
-                                 top_mess.size( )  - total, total );
+                    const message_type &top_mess( top.message_ );
+                    async_write( top_mess->data( ) + total,
+                                 top_mess->size( ) - total, total );
 
                 } else {
 
@@ -231,13 +244,11 @@ namespace msctl { namespace async_transport {
 
         }
 
-        void write_impl( const queue_value_sptr data, shared_type /*inst*/ )
+        void write_impl( const queue_value &data, shared_type /*inst*/ )
         {
             const bool empty = queue_empty( );
 
-            queue_push( data );
-
-            if( empty ) {
+            if( queue_push( data ) && empty ) {
                 async_write(  );
             }
         }
@@ -245,8 +256,9 @@ namespace msctl { namespace async_transport {
         void post_write( const char *data, size_t len,
                          const write_closure &close )
         {
-            queue_value_sptr inst(queue_value::create( data, len ));
-            inst->success_ = close;
+            queue_value inst;
+            inst.message_ = common::make_packet( data, len );
+            inst.success_ = close;
 
             write_dispatcher_.post(
                 std::bind( &this_type::write_impl, this,
@@ -265,7 +277,11 @@ namespace msctl { namespace async_transport {
                            size_t const bytes, shared_type /*inst*/ )
         {
             if( !error ) {
-                on_read( &read_buffer_[0], bytes );
+                read_batch_.clear( );
+                read_batch_.push_back( packet_slice { &read_buffer_[0],
+                                                      bytes } );
+                drain_read( );
+                on_read_batch( &read_batch_[0], read_batch_.size( ) );
                 async_read( );
             } else {
                 /// genegate error;
@@ -273,6 +289,42 @@ namespace msctl { namespace async_transport {
             }
         }
 
+#ifndef _WIN32
+        /// the descriptor is ready; read packets until EAGAIN or budget
+        /// errors are ignored here; the next async_read gets them
+        void drain_read( )
+        {
+            boost::system::error_code ec;
+            for( size_t i = read_batch_.size( ); i < read_budget_; ++i ) {
+
+                char *block = &read_buffer_[i * read_block_size_];
+
+                size_t bytes = stream_.read_some(
+                            boost::asio::buffer( block, read_block_size_ ),
+                            ec );
+                if( ec ) {
+                    break;
+                }
+
+                read_batch_.push_back( packet_slice { block, bytes } );
+            }
+        }
+
+        void set_read_non_blocking( )
+        {
+            if( read_budget_ > 1 ) {
+                boost::system::error_code ec;
+                stream_.non_blocking( true, ec );
+            }
+        }
+#else
+        void drain_read( )
+        { }
+
+        void set_read_non_blocking( )
+        { }
+#endif
+
         void start_read_impl_wrap(  )
         {
             namespace ph = std::placeholders;
@@ -303,6 +355,13 @@ namespace msctl { namespace async_transport {
 
         virtual void on_read( char *data, size_t length ) = 0;
 
+        virtual void on_read_batch( packet_slice *packets, size_t count )
+        {
+            for( size_t i = 0; i < count; ++i ) {
+                on_read( packets[i].data, packets[i].length );
+            }
+        }
+
         virtual void on_read_error( const boost::system::error_code &/*code*/ )
         { }
 
@@ -314,15 +373,27 @@ namespace msctl { namespace async_transport {
             throw;
         }
 
-        virtual std::string on_transform_message( std::string &message )
-        {
-            return message;
-        }
+        /// the packet can be changed in place or replaced by another one
+        virtual void on_transform_message( common::packet_ptr &/*message*/ )
+        { }
 
     public:
 
         virtual ~point_iface( ) { }
 
+    protected:
+
+        /// has to be called from the dispatcher;
+        /// the packet goes to the write queue without a closure
+        void write_in_dispatcher( message_type pkt )
+        {
+            queue_value inst;
+            inst.message_ = std::move( pkt );
+            write_impl( inst, shared_type( ) );
+        }
+
+    public:
+
         boost::asio::io_service &get_io_service( )
         {
             return ios_;
@@ -375,8 +446,41 @@ namespace msctl { namespace async_transport {
             post_write( data, length, closuse );
         }
 
+        /// max number of packets read for one readiness event;
+        /// has to be called before start_read
+        void set_read_budget( size_t packets )
+        {
+            read_budget_ = packets ? packets : 1;
+            read_buffer_.resize( read_block_size_ * read_budget_ );
+            read_batch_.reserve( read_budget_ );
+        }
+
+        size_t read_budget( ) const
+        {
+            return read_budget_;
+        }
+
+        /// limits and drop policy of the write queue;
+        /// has to be called before the first write
+        void set_queue_limits( const common::queue_limits &lim )
+        {
+            write_queue_.set_limits( lim );
+        }
+
+        common::queue_stat write_queue_stat( ) const
+        {
+            return write_queue_.stat( );
+        }
+
+        /// packets waiting or being written; any thread
+        std::uint64_t write_queue_depth( ) const
+        {
+            return write_queue_.depth( );
+        }
+
         void start_read( )
         {
+            set_read_non_blocking( );
             async_read( );
         }
 
@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "compress.h"
+
+namespace msctl { namespace common {
+
+namespace {
+
+    /// LZ4 block format; the same bytes the reference library reads
+    namespace lz4 {
+
+        const size_t min_match     = 4;
+        const size_t last_literals = 5;
+        const size_t mf_limit      = 12;    /// no match starts after it
+        const size_t max_offset    = 0xFFFF;
+        const unsigned max_hash_log = 12;
+
+        /// a miss after 2^skip_trigger misses in a row steps 2 bytes,
+        /// then 3 and so on; data with no matches is passed fast
+        const unsigned skip_trigger = 6;
+
+        std::uint32_t read32( const std::uint8_t *p )
+        {
+            std::uint32_t res;
+            memcpy( &res, p, sizeof(res) );
+            return res;
+        }
+
+        std::uint64_t read64( const std::uint8_t *p )
+        {
+            std::uint64_t res;
+            memcpy( &res, p, sizeof(res) );
+            return res;
+        }
+
+        /// the same bytes of a and b before the first different one;
+        /// 8 bytes at a time
+        size_t common_length( const std::uint8_t *a, const std::uint8_t *b,
+                              const std::uint8_t *b_end )
+        {
+            const std::uint8_t *begin = b;
+
+            while( b_end - b >= 8 ) {
+                const std::uint64_t diff = read64( a ) ^ read64( b );
+                if( diff ) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                    return ( b - begin ) + ( __builtin_ctzll( diff ) >> 3 );
+#else
+                    return ( b - begin ) + ( __builtin_clzll( diff ) >> 3 );
+#endif
+                }
+                a += 8;
+                b += 8;
+            }
+
+            while( b < b_end && *a == *b ) {
+                ++a;
+                ++b;
+            }
+            return b - begin;
+        }
+
+        /// the match can overlap the output; it is a pattern of offset
+        /// bytes. With room after the match it goes 8 bytes at a time and
+        /// can write up to 7 bytes more; the next sequence overwrites
+        /// them. Otherwise every memcpy doubles the copied part
+        void copy_match( std::uint8_t *op, size_t offset, size_t len,
+                         size_t room )
+        {
+            const std::uint8_t *match = op - offset;
+
+            if( offset >= 8 && room >= len + 7 ) {
+                for( size_t i = 0; i < len; i += 8 ) {
+                    memcpy( op + i, match + i, 8 );
+                }
+                return;
+            }
+
+            size_t done = 0;
+            while( done < len ) {
+                const size_t n = std::min( done + offset, len - done );
+                memcpy( op + done, match, n );
+                done += n;
+            }
+        }
+
+        std::uint32_t hash( std::uint32_t value, unsigned log )
+        {
+            return ( value * 2654435761U ) >> ( 32 - log );
+        }
+
+        /// smaller input -> smaller table to clear
+        unsigned hash_log( size_t len )
+        {
+            unsigned res = 8;
+            while( res < max_hash_log && ( size_t(1) << res ) < len ) {
+                ++res;
+            }
+            return res;
+        }
+
+        /// 255 255 ... rest
+        bool put_length( std::uint8_t *&op, const std::uint8_t *oend,
+                         size_t len )
+        {
+            while( len >= 255 ) {
+                if( op >= oend ) {
+                    return false;
+                }
+                *op++ = 255;
+                len -= 255;
+            }
+            if( op >= oend ) {
+                return false;
+            }
+            *op++ = static_cast<std::uint8_t>(len);
+            return true;
+        }
+
+        bool get_length( const std::uint8_t *&ip, const std::uint8_t *iend,
+                         size_t &len )
+        {
+            std::uint8_t b;
+            do {
+                if( ip >= iend ) {
+                    return false;
+                }
+                b = *ip++;
+                len += b;
+            } while( b == 255 );
+            return true;
+        }
+
+        bool put_sequence( std::uint8_t *&op, const std::uint8_t *oend,
+                           const std::uint8_t *lit, size_t lit_len,
+                           size_t offset, size_t match_len )
+        {
+            if( op >= oend ) {
+                return false;
+            }
+
+            std::uint8_t *token = op++;
+            const size_t  mlen  = match_len ? match_len - min_match : 0;
+
+            *token = static_cast<std::uint8_t>(
+                        ( ( lit_len < 15 ? lit_len : 15 ) << 4 )
+                      | ( mlen < 15 ? mlen : 15 ) );
+
+            if( lit_len >= 15 && !put_length( op, oend, lit_len - 15 ) ) {
+                return false;
+            }
+
+            if( size_t(oend - op) < lit_len ) {
+                return false;
+            }
+            memcpy( op, lit, lit_len );
+            op += lit_len;
+
+            if( match_len == 0 ) {
+                return true;
+            }
+
+            if( oend - op < 2 ) {
+                return false;
+            }
+            *op++ = static_cast<std::uint8_t>(offset);
+            *op++ = static_cast<std::uint8_t>(offset >> 8);
+
+            return ( mlen < 15 ) || put_length( op, oend, mlen - 15 );
+        }
+
+        size_t compress( const std::uint8_t *src, size_t len,
+                         std::uint8_t *dst, size_t cap )
+        {
+            std::uint8_t       *op   = dst;
+            const std::uint8_t *oend = dst + cap;
+            size_t              anchor = 0;
+
+            if( len > mf_limit ) {
+
+                const unsigned log = hash_log( len );
+                std::uint32_t table[1 << max_hash_log];
+                memset( table, 0, sizeof(table[0]) << log );
+
+                const size_t limit       = len - mf_limit;
+                const size_t match_limit = len - last_literals;
+
+                size_t ip       = 0;
+                size_t attempts = size_t(1) << skip_trigger;
+                while( ip < limit ) {
+
+                    const std::uint32_t seq = read32( src + ip );
+                    const std::uint32_t h   = hash( seq, log );
+
+                    /// positions are stored + 1; 0 is an empty cell
+                    const size_t ref = table[h];
+                    table[h] = static_cast<std::uint32_t>(ip + 1);
+
+                    if( ref == 0 || ip - ( ref - 1 ) > max_offset
+                     || read32( src + ref - 1 ) != seq )
+                    {
+                        ip += attempts++ >> skip_trigger;
+                        continue;
+                    }
+                    attempts = size_t(1) << skip_trigger;
+
+                    const size_t match = ref - 1;
+                    const size_t mlen  = min_match
+                                       + common_length(
+                                             src + match + min_match,
+                                             src + ip + min_match,
+                                             src + match_limit );
+
+                    if( !put_sequence( op, oend, src + anchor, ip - anchor,
+                                       ip - match, mlen ) )
+                    {
+                        return 0;
+                    }
+
+                    ip    += mlen;
+                    anchor = ip;
+
+                    /// the end of the match can start the next one
+                    if( ip < limit ) {
+                        const size_t prev = ip - 2;
+                        table[hash( read32( src + prev ), log )] =
+                                static_cast<std::uint32_t>(prev + 1);
+                    }
+                }
+            }
+
+            if( !put_sequence( op, oend, src + anchor, len - anchor, 0, 0 ) ) {
+                return 0;
+            }
+
+            return op - dst;
+        }
+
+        bool decompress( const std::uint8_t *src, size_t len,
+                         std::uint8_t *dst, size_t dst_len )
+        {
+            const std::uint8_t *ip   = src;
+            const std::uint8_t *iend = src + len;
+            std::uint8_t       *op   = dst;
+            std::uint8_t       *oend = dst + dst_len;
+
+            while( ip < iend ) {
+
+                const std::uint8_t token = *ip++;
+
+                size_t lit_len = token >> 4;
+                if( lit_len == 15 && !get_length( ip, iend, lit_len ) ) {
+                    return false;
+                }
+
+                if( size_t(iend - ip) < lit_len
+                 || size_t(oend - op) < lit_len )
+                {
+                    return false;
+                }
+                /// short literals are copied by 16 bytes if both sides
+                /// have room; the rest is overwritten
+                if( lit_len <= 16 && iend - ip >= 16 && oend - op >= 16 ) {
+                    memcpy( op, ip, 16 );
+                } else {
+                    memcpy( op, ip, lit_len );
+                }
+                ip += lit_len;
+                op += lit_len;
+
+                /// the last sequence has literals only
+                if( ip == iend ) {
+                    break;
+                }
+
+                if( iend - ip < 2 ) {
+                    return false;
+                }
+                const size_t offset = size_t(ip[0]) | ( size_t(ip[1]) << 8 );
+                ip += 2;
+
+                if( offset == 0 || offset > size_t(op - dst) ) {
+                    return false;
+                }
+
+                size_t mlen = token & 15;
+                if( mlen == 15 && !get_length( ip, iend, mlen ) ) {
+                    return false;
+                }
+                mlen += min_match;
+
+                if( size_t(oend - op) < mlen ) {
+                    return false;
+                }
+
+                copy_match( op, offset, mlen, oend - op );
+                op += mlen;
+            }
+
+            return op == oend;
+        }
+    }
+
+    class lz4_compressor: public compressor {
+
+    public:
+
+        const char *name( ) const override
+        {
+            return "lz4";
+        }
+
+        size_t max_compressed( size_t len ) const override
+        {
+            return len + len / 255 + 16;
+        }
+
+        size_t compress( const char *src, size_t len,
+                         char *dst, size_t cap ) const override
+        {
+            return lz4::compress( reinterpret_cast<const std::uint8_t *>(src),
+                                  len,
+                                  reinterpret_cast<std::uint8_t *>(dst),
+                                  cap );
+        }
+
+        bool decompress( const char *src, size_t len,
+                         char *dst, size_t dst_len ) const override
+        {
+            return lz4::decompress(
+                        reinterpret_cast<const std::uint8_t *>(src), len,
+                        reinterpret_cast<std::uint8_t *>(dst), dst_len );
+        }
+    };
+
+    /// bytes in the sample; more distinct values mean random data
+    const size_t sample_size     = 128;
+    const size_t random_distinct = 96;
+    const size_t min_compress    = 64;
+}
+
+    compressor_sptr create_compressor( const std::string &name )
+    {
+        if( name.empty( ) || name == "none" ) {
+            return compressor_sptr( );
+        } else if( name == "lz4" ) {
+            return std::make_shared<lz4_compressor>( );
+        }
+        throw std::runtime_error( "Invalid compression " + name );
+    }
+
+    bool looks_compressible( const char *data, size_t len )
+    {
+        if( len < min_compress ) {
+            return false;
+        }
+
+        bool   seen[256] = { false };
+        size_t distinct  = 0;
+
+        const size_t step = len > sample_size ? len / sample_size : 1;
+        const size_t last = len > sample_size ? sample_size : len;
+
+        for( size_t i = 0; i < last; ++i ) {
+            const std::uint8_t b = static_cast<std::uint8_t>(data[i * step]);
+            if( !seen[b] ) {
+                seen[b] = true;
+                ++distinct;
+            }
+        }
+
+        /// a short sample has less values to be random
+        return distinct * sample_size < random_distinct * last;
+    }
+
+}}
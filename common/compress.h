@@ -0,0 +1,123 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace msctl { namespace common {
+
+    /// block compressor for one frame; has to be thread safe
+    class compressor {
+
+    public:
+
+        virtual ~compressor( ) { }
+
+        virtual const char *name( ) const = 0;
+
+        /// the biggest result for len bytes of input
+        virtual size_t max_compressed( size_t len ) const = 0;
+
+        /// returns 0 if the result doesn't fit cap
+        virtual size_t compress( const char *src, size_t len,
+                                 char *dst, size_t cap ) const = 0;
+
+        /// dst_len is the exact length of the original data
+        virtual bool decompress( const char *src, size_t len,
+                                 char *dst, size_t dst_len ) const = 0;
+    };
+
+    using compressor_sptr = std::shared_ptr<compressor>;
+
+    /// "" and "none" -> empty pointer; "lz4" -> LZ4 block format.
+    /// Throws std::runtime_error for an unknown name
+    compressor_sptr create_compressor( const std::string &name );
+
+    /// a cheap look at a sample of bytes; compressed and encrypted data
+    /// has almost every byte value different
+    bool looks_compressible( const char *data, size_t len );
+
+    struct compress_stat {
+
+        std::uint64_t frames        = 0; /// compressed frames
+        std::uint64_t skipped       = 0; /// sent as is
+        std::uint64_t bytes_in      = 0; /// before compression
+        std::uint64_t bytes_out     = 0; /// after compression
+        std::uint64_t compress_ns   = 0;
+        std::uint64_t decompress_ns = 0;
+
+        double ratio( ) const
+        {
+            return bytes_in ? double(bytes_out) / double(bytes_in) : 1.0;
+        }
+    };
+
+    /// counters for many writers; relaxed atomics
+    class compress_counters {
+
+        using counter_type = std::atomic<std::uint64_t>;
+
+        counter_type frames_;
+        counter_type skipped_;
+        counter_type bytes_in_;
+        counter_type bytes_out_;
+        counter_type compress_ns_;
+        counter_type decompress_ns_;
+
+        static void add( counter_type &cnt, std::uint64_t value )
+        {
+            cnt.fetch_add( value, std::memory_order_relaxed );
+        }
+
+    public:
+
+        compress_counters( )
+            :frames_(0)
+            ,skipped_(0)
+            ,bytes_in_(0)
+            ,bytes_out_(0)
+            ,compress_ns_(0)
+            ,decompress_ns_(0)
+        { }
+
+        void add_frame( size_t in, size_t out, std::uint64_t ns )
+        {
+            add( frames_, 1 );
+            add( bytes_in_, in );
+            add( bytes_out_, out );
+            add( compress_ns_, ns );
+        }
+
+        void add_skipped( size_t len, std::uint64_t ns )
+        {
+            add( skipped_, 1 );
+            add( bytes_in_, len );
+            add( bytes_out_, len );
+            add( compress_ns_, ns );
+        }
+
+        void add_decompress( std::uint64_t ns )
+        {
+            add( decompress_ns_, ns );
+        }
+
+        compress_stat stat( ) const
+        {
+            compress_stat res;
+            res.frames        = frames_.load( std::memory_order_relaxed );
+            res.skipped       = skipped_.load( std::memory_order_relaxed );
+            res.bytes_in      = bytes_in_.load( std::memory_order_relaxed );
+            res.bytes_out     = bytes_out_.load( std::memory_order_relaxed );
+            res.compress_ns   = compress_ns_.load(
+                                                std::memory_order_relaxed );
+            res.decompress_ns = decompress_ns_.load(
+                                                std::memory_order_relaxed );
+            return res;
+        }
+    };
+
+}}
+
+#endif // COMPRESS_H
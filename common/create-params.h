@@ -21,6 +21,62 @@ namespace msctl { namespace common {
         param_map     params;
         bool          tcp_nowait = false;
         std::uint32_t max_queue  = 10;
+        std::uint32_t read_batch = 1;  /// packets per one TUN read event
+        std::string   backend;         /// TUN: asio, uring, packet, thread
+
+        /// TUN write queue; 0 - no limit
+        std::uint32_t queue_packets  = 1024;
+        std::uint32_t queue_bytes    = 4 * 1024 * 1024;
+        std::string   aqm;                  /// tail, head, codel
+        std::uint32_t codel_target   = 5;   /// milliseconds
+        std::uint32_t codel_interval = 100; /// milliseconds
+
+        /// thread backend
+        std::int32_t  cpu       = -1;   /// the thread's cpu; -1 - not pinned
+        std::uint32_t busy_poll = 0;    /// microseconds of spinning
+
+        /// bytes of packets in one batch frame; 0 - no batching
+        std::uint32_t batch_bytes = 0;
+
+        /// frames that wait for a TCP write go in one write;
+        /// bytes and frames of it. 0 bytes - no corking
+        std::uint32_t cork_bytes  = 0;
+        std::uint32_t cork_frames = 64;
+
+        /// UDP: datagrams of this size carry pieces of bigger frames
+        /// instead of IP fragments; 0 - a frame is one datagram
+        std::uint32_t fragment_size = 0;
+
+        /// UDP: frames get sequence numbers, duplicates are dropped;
+        /// up to reorder_depth frames after a gap wait for it for
+        /// reorder_ms at most. 0 depth - frames are never held
+        bool          sequence      = false;
+        std::uint32_t reorder_depth = 0;
+        std::uint32_t reorder_ms    = 20;
+
+        /// UDP forward error correction: none, xor, rs. Packet frames go
+        /// in groups of fec_data with fec_repair repair frames (1 for
+        /// xor); a group is finished after fec_ms without frames
+        std::string   fec;
+        std::uint32_t fec_data      = 8;
+        std::uint32_t fec_repair    = 2;
+        std::uint32_t fec_ms        = 20;
+
+        /// UDP: datagrams of one recvmmsg or sendmmsg of the agent's own
+        /// socket; 0 - the socket of srpc, a datagram per call.
+        /// udp_offload - GSO and GRO trains on that socket
+        std::uint32_t udp_batch     = 0;
+        bool          udp_offload   = false;
+
+        std::string   compress;         /// frame compression: none, lz4
+        bool          header_compress = false;  /// IPv4 TCP/UDP headers
+
+        /// frame check: "" - the default hash, none (TCP only), crc32c
+        std::string   integrity;
+
+        /// frame encryption: aes-256-gcm, chacha20-poly1305; "" - none.
+        /// The key is taken from the --key options by the client id
+        std::string   cipher;
 
         direction rcv;
         direction snd;
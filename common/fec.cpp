@@ -0,0 +1,603 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "fec.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MSCTL_GF256_X86 1
+#include <tmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define MSCTL_GF256_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace msctl { namespace common {
+
+namespace {
+
+    const unsigned gf_polynomial = 0x11D;
+
+    /// exp and log of the generator 2; mul[a][b] is a * b
+    struct gf_tables {
+
+        std::uint8_t exp[512];
+        std::uint8_t log[256];
+        std::uint8_t mul[256][256];
+
+        gf_tables( )
+        {
+            unsigned x = 1;
+            for( unsigned i = 0; i < 255; ++i ) {
+                exp[i] = static_cast<std::uint8_t>(x);
+                log[x] = static_cast<std::uint8_t>(i);
+                x <<= 1;
+                if( x & 0x100 ) {
+                    x ^= gf_polynomial;
+                }
+            }
+            for( unsigned i = 255; i < 512; ++i ) {
+                exp[i] = exp[i - 255];
+            }
+            log[0] = 0;
+
+            for( unsigned a = 0; a < 256; ++a ) {
+                for( unsigned b = 0; b < 256; ++b ) {
+                    mul[a][b] = ( a && b ) ? exp[log[a] + log[b]] : 0;
+                }
+            }
+        }
+    };
+
+    const gf_tables &tables( )
+    {
+        static const gf_tables res;
+        return res;
+    }
+
+    void xor_add( std::uint8_t *dst, const std::uint8_t *src, size_t len )
+    {
+        while( len >= 8 ) {
+            std::uint64_t d;
+            std::uint64_t s;
+            memcpy( &d, dst, 8 );
+            memcpy( &s, src, 8 );
+            d ^= s;
+            memcpy( dst, &d, 8 );
+            dst += 8;
+            src += 8;
+            len -= 8;
+        }
+        while( len-- ) {
+            *dst++ ^= *src++;
+        }
+    }
+
+#if defined(MSCTL_GF256_X86)
+
+    /// c * x is c * low nibble ^ c * high nibble; 16 bytes at once
+    __attribute__((target("ssse3")))
+    void mul_add_hard( std::uint8_t *dst, const std::uint8_t *src,
+                       std::uint8_t c, size_t len )
+    {
+        const auto &row( tables( ).mul[c] );
+
+        alignas(16) std::uint8_t lo[16];
+        alignas(16) std::uint8_t hi[16];
+        for( unsigned i = 0; i < 16; ++i ) {
+            lo[i] = row[i];
+            hi[i] = row[i << 4];
+        }
+
+        const __m128i tlo  = _mm_load_si128(
+                                reinterpret_cast<const __m128i *>(lo) );
+        const __m128i thi  = _mm_load_si128(
+                                reinterpret_cast<const __m128i *>(hi) );
+        const __m128i mask = _mm_set1_epi8( 0x0F );
+
+        size_t i = 0;
+        for( ; i + 16 <= len; i += 16 ) {
+            auto *d = reinterpret_cast<__m128i *>(dst + i);
+            const __m128i v = _mm_loadu_si128(
+                                reinterpret_cast<const __m128i *>(src + i) );
+            const __m128i l = _mm_shuffle_epi8( tlo,
+                                                _mm_and_si128( v, mask ) );
+            const __m128i h = _mm_shuffle_epi8( thi,
+                                _mm_and_si128( _mm_srli_epi64( v, 4 ),
+                                               mask ) );
+            _mm_storeu_si128( d, _mm_xor_si128( _mm_loadu_si128( d ),
+                                                _mm_xor_si128( l, h ) ) );
+        }
+
+        for( ; i < len; ++i ) {
+            dst[i] ^= row[src[i]];
+        }
+    }
+
+    bool detect_simd( )
+    {
+        return __builtin_cpu_supports( "ssse3" );
+    }
+
+#elif defined(MSCTL_GF256_NEON)
+
+    void mul_add_hard( std::uint8_t *dst, const std::uint8_t *src,
+                       std::uint8_t c, size_t len )
+    {
+        const auto &row( tables( ).mul[c] );
+
+        std::uint8_t lo[16];
+        std::uint8_t hi[16];
+        for( unsigned i = 0; i < 16; ++i ) {
+            lo[i] = row[i];
+            hi[i] = row[i << 4];
+        }
+
+        const uint8x16_t tlo  = vld1q_u8( lo );
+        const uint8x16_t thi  = vld1q_u8( hi );
+        const uint8x16_t mask = vdupq_n_u8( 0x0F );
+
+        size_t i = 0;
+        for( ; i + 16 <= len; i += 16 ) {
+            const uint8x16_t v = vld1q_u8( src + i );
+            const uint8x16_t l = vqtbl1q_u8( tlo, vandq_u8( v, mask ) );
+            const uint8x16_t h = vqtbl1q_u8( thi, vshrq_n_u8( v, 4 ) );
+            vst1q_u8( dst + i, veorq_u8( vld1q_u8( dst + i ),
+                                         veorq_u8( l, h ) ) );
+        }
+
+        for( ; i < len; ++i ) {
+            dst[i] ^= row[src[i]];
+        }
+    }
+
+    bool detect_simd( )
+    {
+        return true;
+    }
+
+#else
+
+    void mul_add_hard( std::uint8_t *dst, const std::uint8_t *src,
+                       std::uint8_t c, size_t len )
+    {
+        gf256_mul_add_soft( dst, src, c, len );
+    }
+
+    bool detect_simd( )
+    {
+        return false;
+    }
+
+#endif
+
+    /// the matrix row of repair j for data i; x_j and y_i never meet
+    std::uint8_t coefficient( int scheme, size_t j, size_t i )
+    {
+        if( scheme == FEC_XOR ) {
+            return 1;
+        }
+        return gf256_inv( static_cast<std::uint8_t>(
+                                j ^ ( fec_max_repair + i ) ) );
+    }
+
+    /// Gauss-Jordan; a is n x n by rows and is destroyed
+    bool invert( std::vector<std::uint8_t> &a, size_t n,
+                 std::vector<std::uint8_t> &res )
+    {
+        res.assign( n * n, 0 );
+        for( size_t i = 0; i < n; ++i ) {
+            res[i * n + i] = 1;
+        }
+
+        for( size_t col = 0; col < n; ++col ) {
+
+            size_t pivot = col;
+            while( pivot < n && a[pivot * n + col] == 0 ) {
+                ++pivot;
+            }
+            if( pivot == n ) {
+                return false;
+            }
+
+            if( pivot != col ) {
+                std::swap_ranges( &a[pivot * n], &a[pivot * n] + n,
+                                  &a[col * n] );
+                std::swap_ranges( &res[pivot * n], &res[pivot * n] + n,
+                                  &res[col * n] );
+            }
+
+            const std::uint8_t scale = gf256_inv( a[col * n + col] );
+            for( size_t k = 0; k < n; ++k ) {
+                a[col * n + k]   = gf256_mul( a[col * n + k],   scale );
+                res[col * n + k] = gf256_mul( res[col * n + k], scale );
+            }
+
+            for( size_t row = 0; row < n; ++row ) {
+                const std::uint8_t f = a[row * n + col];
+                if( row == col || f == 0 ) {
+                    continue;
+                }
+                for( size_t k = 0; k < n; ++k ) {
+                    a[row * n + k]   ^= gf256_mul( f, a[col * n + k] );
+                    res[row * n + k] ^= gf256_mul( f, res[col * n + k] );
+                }
+            }
+        }
+        return true;
+    }
+
+    std::uint8_t *bytes( std::string &s )
+    {
+        return reinterpret_cast<std::uint8_t *>(&s[0]);
+    }
+
+    const std::uint8_t *bytes( const char *s )
+    {
+        return reinterpret_cast<const std::uint8_t *>(s);
+    }
+
+    void write_head( char *out, std::uint32_t group, size_t index,
+                     size_t k, size_t m, fec_scheme scheme )
+    {
+        out[0] = static_cast<char>(group >> 24);
+        out[1] = static_cast<char>(group >> 16);
+        out[2] = static_cast<char>(group >>  8);
+        out[3] = static_cast<char>(group);
+        out[4] = static_cast<char>(index);
+        out[5] = static_cast<char>(k);
+        out[6] = static_cast<char>(m);
+        out[7] = static_cast<char>(scheme);
+    }
+}
+
+    std::uint8_t gf256_mul( std::uint8_t a, std::uint8_t b )
+    {
+        return tables( ).mul[a][b];
+    }
+
+    std::uint8_t gf256_inv( std::uint8_t a )
+    {
+        const auto &t( tables( ) );
+        return t.exp[255 - t.log[a]];
+    }
+
+    void gf256_mul_add_soft( std::uint8_t *dst, const std::uint8_t *src,
+                             std::uint8_t c, size_t len )
+    {
+        if( c == 0 ) {
+            return;
+        } else if( c == 1 ) {
+            xor_add( dst, src, len );
+            return;
+        }
+
+        const auto &row( tables( ).mul[c] );
+        for( size_t i = 0; i < len; ++i ) {
+            dst[i] ^= row[src[i]];
+        }
+    }
+
+    void gf256_mul_add( std::uint8_t *dst, const std::uint8_t *src,
+                        std::uint8_t c, size_t len )
+    {
+        static const bool simd = detect_simd( );
+        if( c == 0 ) {
+            return;
+        } else if( c == 1 ) {
+            xor_add( dst, src, len );
+        } else if( simd ) {
+            mul_add_hard( dst, src, c, len );
+        } else {
+            gf256_mul_add_soft( dst, src, c, len );
+        }
+    }
+
+    bool gf256_simd( )
+    {
+        return detect_simd( );
+    }
+
+    fec_scheme fec_scheme_by_name( const std::string &name )
+    {
+        if( name.empty( ) || name == "none" ) {
+            return FEC_NONE;
+        } else if( name == "xor" ) {
+            return FEC_XOR;
+        } else if( name == "rs" ) {
+            return FEC_RS;
+        }
+        throw std::runtime_error( "Unknown fec scheme '" + name + "'." );
+    }
+
+    void check_fec_params( fec_scheme scheme, size_t k, size_t m )
+    {
+        if( scheme == FEC_NONE ) {
+            return;
+        }
+        if( k < 2 || k > fec_max_data ) {
+            throw std::runtime_error( "Invalid number of fec data frames." );
+        }
+        if( m < 1 || m > fec_max_repair || ( scheme == FEC_XOR && m != 1 ) )
+        {
+            throw std::runtime_error(
+                        "Invalid number of fec repair frames." );
+        }
+    }
+
+    fec_encoder::fec_encoder( fec_scheme scheme, size_t k, size_t m )
+        :scheme_(scheme)
+        ,k_(k)
+        ,m_(scheme == FEC_XOR ? 1 : m)
+        ,repairs_(m_)
+    { }
+
+    bool fec_encoder::add( char *head, const char *data, size_t len )
+    {
+        write_head( head, group_, count_, k_, m_, scheme_ );
+
+        const size_t sym = len + 2;
+        if( sym > sym_len_ ) {
+            sym_len_ = sym;
+            for( auto &r: repairs_ ) {
+                r.resize( sym_len_, '\0' );
+            }
+        }
+
+        const std::uint8_t size[2] = {
+            static_cast<std::uint8_t>(len >> 8),
+            static_cast<std::uint8_t>(len)
+        };
+
+        for( size_t j = 0; j < m_; ++j ) {
+            const std::uint8_t c = coefficient( scheme_, j, count_ );
+            std::uint8_t *r = bytes( repairs_[j] );
+            gf256_mul_add( r,     size,          c, 2 );
+            gf256_mul_add( r + 2, bytes( data ), c, len );
+        }
+
+        stale_ = false;
+        return ++count_ >= k_;
+    }
+
+    bool fec_encoder::idle( )
+    {
+        const bool res = count_ && stale_;
+        stale_ = true;
+        return res;
+    }
+
+    void fec_encoder::finish( std::vector<std::string> &out )
+    {
+        if( count_ == 0 ) {
+            return;
+        }
+
+        for( size_t j = 0; j < m_; ++j ) {
+            std::string frame( fec_head_size, '\0' );
+            write_head( &frame[0], group_, count_ + j, count_, m_, scheme_ );
+            frame.append( repairs_[j] );
+            out.emplace_back( std::move( frame ) );
+            repairs_[j].clear( );
+            ++stat_.repairs;
+        }
+
+        ++stat_.groups;
+        ++group_;
+        count_   = 0;
+        sym_len_ = 0;
+    }
+
+    fec_decoder::fec_decoder( size_t groups )
+        :table_(groups ? groups : 1)
+    { }
+
+    /// the group of the id; the oldest one goes if there is no room
+    fec_decoder::group *fec_decoder::find( std::uint32_t id )
+    {
+        ++clock_;
+
+        group *free   = nullptr;
+        group *oldest = nullptr;
+        for( auto &g: table_ ) {
+            if( !g.used ) {
+                free = free ? free : &g;
+                continue;
+            }
+            if( g.id == id ) {
+                g.age = clock_;
+                return &g;
+            }
+            if( !oldest || g.age < oldest->age ) {
+                oldest = &g;
+            }
+        }
+
+        group *res = free;
+        if( !res ) {
+            res = oldest;
+            forget( *res );
+        }
+
+        res->used   = true;
+        res->done   = false;
+        res->id     = id;
+        res->k      = 0;
+        res->scheme = 0;
+        res->got    = 0;
+        res->top    = 0;
+        res->rgot   = 0;
+        res->age    = clock_;
+        res->data.resize( fec_max_data );
+        res->repairs.resize( fec_max_repair );
+        for( auto &d: res->data ) {
+            d.clear( );
+        }
+        for( auto &r: res->repairs ) {
+            r.clear( );
+        }
+        return res;
+    }
+
+    /// data frames the group has not got are lost now
+    void fec_decoder::forget( group &g )
+    {
+        if( !g.done ) {
+            const size_t expected = g.k ? g.k : g.top;
+            if( expected > g.got ) {
+                stat_.lost += expected - g.got;
+            }
+        }
+        g.used = false;
+    }
+
+    void fec_decoder::recover( group &g, std::vector<std::string> &out )
+    {
+        const size_t k = g.k;
+        if( g.done || k == 0 ) {
+            return;
+        }
+        if( g.got >= k ) {
+            g.done = true;
+            return;
+        }
+        if( g.got + g.rgot < k ) {
+            return;
+        }
+
+        std::vector<size_t> lost;
+        for( size_t i = 0; i < k; ++i ) {
+            if( g.data[i].empty( ) ) {
+                lost.push_back( i );
+            }
+        }
+
+        const size_t n = lost.size( );
+        std::vector<size_t> rows;
+        for( size_t j = 0; j < fec_max_repair && rows.size( ) < n; ++j ) {
+            if( !g.repairs[j].empty( ) ) {
+                rows.push_back( j );
+            }
+        }
+
+        g.done = true;
+        const size_t len = g.repairs[rows[0]].size( );
+        for( auto r: rows ) {
+            if( g.repairs[r].size( ) != len ) {
+                return;
+            }
+        }
+
+        /// the repairs without the frames that are here
+        std::vector<std::string> rest( n );
+        for( size_t a = 0; a < n; ++a ) {
+            rest[a] = g.repairs[rows[a]];
+        }
+        for( size_t i = 0; i < k; ++i ) {
+            const auto &sym( g.data[i] );
+            if( sym.empty( ) || sym.size( ) > len ) {
+                continue;
+            }
+            for( size_t a = 0; a < n; ++a ) {
+                gf256_mul_add( bytes( rest[a] ), bytes( sym.data( ) ),
+                               coefficient( g.scheme, rows[a], i ),
+                               sym.size( ) );
+            }
+        }
+
+        std::vector<std::uint8_t> matrix( n * n );
+        for( size_t a = 0; a < n; ++a ) {
+            for( size_t b = 0; b < n; ++b ) {
+                matrix[a * n + b] = coefficient( g.scheme, rows[a],
+                                                 lost[b] );
+            }
+        }
+
+        std::vector<std::uint8_t> inv;
+        if( !invert( matrix, n, inv ) ) {
+            return;
+        }
+
+        for( size_t b = 0; b < n; ++b ) {
+            std::string sym( len, '\0' );
+            for( size_t a = 0; a < n; ++a ) {
+                gf256_mul_add( bytes( sym ), bytes( rest[a].data( ) ),
+                               inv[b * n + a], len );
+            }
+
+            const size_t size = ( size_t(std::uint8_t(sym[0])) << 8 )
+                              |   size_t(std::uint8_t(sym[1]));
+            if( size + 2 > len ) {
+                continue;
+            }
+            out.emplace_back( sym.data( ) + 2, size );
+            g.data[lost[b]] = std::move( sym );
+            ++g.got;
+            ++stat_.recovered;
+        }
+    }
+
+    fec_decoder::result fec_decoder::add( const char *&data, size_t &len,
+                                          std::vector<std::string> &out )
+    {
+        if( len < fec_head_size ) {
+            return FEC_DROP;
+        }
+
+        const auto *head = bytes( data );
+        const std::uint32_t id = ( std::uint32_t(head[0]) << 24 )
+                               | ( std::uint32_t(head[1]) << 16 )
+                               | ( std::uint32_t(head[2]) <<  8 )
+                               |   std::uint32_t(head[3]);
+        const size_t index  = head[4];
+        const size_t k      = head[5];
+        const size_t m      = head[6];
+        const int    scheme = head[7];
+
+        if( ( scheme != FEC_XOR && scheme != FEC_RS )
+         || k == 0 || k > fec_max_data
+         || m == 0 || m > fec_max_repair
+         || index >= k + m )
+        {
+            return FEC_DROP;
+        }
+
+        group *g = find( id );
+
+        const char  *body = data + fec_head_size;
+        const size_t blen = len  - fec_head_size;
+
+        if( index < k ) {
+            auto &sym( g->data[index] );
+            if( !sym.empty( ) || blen > 0xFFFF ) {
+                return FEC_DROP;
+            }
+            sym.reserve( blen + 2 );
+            sym.push_back( static_cast<char>(blen >> 8) );
+            sym.push_back( static_cast<char>(blen) );
+            sym.append( body, blen );
+            ++g->got;
+            g->top = std::max( g->top, index + 1 );
+
+            recover( *g, out );
+            data = body;
+            len  = blen;
+            return FEC_DATA;
+        }
+
+        const size_t j = index - k;
+        if( ( g->k && g->k != k ) || !g->repairs[j].empty( ) || blen < 2 ) {
+            return FEC_DROP;
+        }
+
+        g->k      = static_cast<std::uint8_t>(k);
+        g->scheme = static_cast<std::uint8_t>(scheme);
+        g->repairs[j].assign( body, blen );
+        ++g->rgot;
+        ++stat_.repairs_in;
+
+        recover( *g, out );
+        return FEC_REPAIR;
+    }
+
+}}
@@ -0,0 +1,153 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace msctl { namespace common {
+
+    /// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1
+    std::uint8_t gf256_mul( std::uint8_t a, std::uint8_t b );
+
+    /// a can't be 0
+    std::uint8_t gf256_inv( std::uint8_t a );
+
+    /// dst ^= c * src; PSHUFB (SSSE3) or TBL (NEON) tables of nibbles
+    /// if the cpu has them
+    void gf256_mul_add( std::uint8_t *dst, const std::uint8_t *src,
+                        std::uint8_t c, size_t len );
+    void gf256_mul_add_soft( std::uint8_t *dst, const std::uint8_t *src,
+                             std::uint8_t c, size_t len );
+
+    /// gf256_mul_add( ) uses vector instructions
+    bool gf256_simd( );
+
+    /// forward error correction of the frames of a datagram transport.
+    /// Frames go in groups of k data frames and m repair frames; any k
+    /// of them give the whole group. Every frame has the header:
+    ///   4 bytes of big endian group id, the index, k, m, the scheme.
+    /// index < k - a data frame, the frame itself follows;
+    /// otherwise repair index - k follows.
+    /// A symbol is 2 bytes of big endian frame length and the frame;
+    /// a repair is the sum of the symbols of the group padded with
+    /// zeros, every symbol multiplied by its coefficient
+    enum fec_scheme {
+        FEC_NONE = 0,
+        FEC_XOR  = 1,   /// one repair frame, all the coefficients are 1
+        FEC_RS   = 2,   /// Reed-Solomon with a Cauchy matrix
+    };
+
+    static const size_t fec_head_size  = 8;
+    static const size_t fec_max_data   = 64;
+    static const size_t fec_max_repair = 16;
+
+    /// "" and "none", "xor", "rs";
+    /// throws std::runtime_error for another name
+    fec_scheme fec_scheme_by_name( const std::string &name );
+
+    /// throws std::runtime_error if k or m is out of the limits;
+    /// xor has one repair frame
+    void check_fec_params( fec_scheme scheme, size_t k, size_t m );
+
+    struct fec_stat {
+
+        std::uint64_t groups      = 0;  /// groups sent
+        std::uint64_t repairs     = 0;  /// repair frames sent
+        std::uint64_t repairs_in  = 0;  /// repair frames received
+        std::uint64_t recovered   = 0;  /// lost data frames restored
+        std::uint64_t lost        = 0;  /// lost data frames not restored
+    };
+
+    /// the writing side; the group is finished when it has k frames or
+    /// by finish( ) with fewer frames
+    class fec_encoder {
+
+        fec_scheme               scheme_;
+        size_t                   k_;
+        size_t                   m_;
+        std::uint32_t            group_   = 0;
+        size_t                   count_   = 0;
+        size_t                   sym_len_ = 0;
+        bool                     stale_   = false;
+        std::vector<std::string> repairs_;
+        fec_stat                 stat_;
+
+    public:
+
+        fec_encoder( fec_scheme scheme = FEC_NONE, size_t k = 0,
+                     size_t m = 0 );
+
+        /// the data frame goes to the group; head gets fec_head_size
+        /// bytes. Returns true if the group has k frames now
+        bool add( char *head, const char *data, size_t len );
+
+        /// the group has frames
+        bool pending( ) const
+        {
+            return count_ != 0;
+        }
+
+        /// true if the group has not got frames since the last call
+        bool idle( );
+
+        /// the repair frames of the group, header and repair each, are
+        /// added to out; the next group starts
+        void finish( std::vector<std::string> &out );
+
+        const fec_stat &stat( ) const
+        {
+            return stat_;
+        }
+    };
+
+    /// the reading side; groups are kept until the table is full
+    class fec_decoder {
+
+        struct group {
+            bool                     used    = false;
+            bool                     done    = false;
+            std::uint32_t            id      = 0;
+            std::uint8_t             k       = 0;   /// 0 - no repair yet
+            std::uint8_t             scheme  = 0;
+            size_t                   got     = 0;   /// data frames
+            size_t                   top     = 0;   /// the last index + 1
+            size_t                   rgot    = 0;   /// repair frames
+            std::uint64_t            age     = 0;
+            std::vector<std::string> data;          /// symbols by index
+            std::vector<std::string> repairs;
+        };
+
+        std::vector<group> table_;
+        std::uint64_t      clock_ = 0;
+        fec_stat           stat_;
+
+        group *find( std::uint32_t id );
+        void   forget( group &g );
+        void   recover( group &g, std::vector<std::string> &out );
+
+    public:
+
+        enum result {
+            FEC_DATA   = 0,     /// data and len have the data frame
+            FEC_REPAIR = 1,     /// a repair frame
+            FEC_DROP   = 2,     /// a bad or a repeated frame
+        };
+
+        fec_decoder( size_t groups = 8 );
+
+        /// a frame with the header; the data frames restored by it are
+        /// added to out
+        result add( const char *&data, size_t &len,
+                    std::vector<std::string> &out );
+
+        const fec_stat &stat( ) const
+        {
+            return stat_;
+        }
+    };
+
+}}
+
+#endif // FEC_H
@@ -0,0 +1,134 @@
+#include "fragment.h"
+
+namespace msctl { namespace common {
+
+    void write_frag_head( char *out, std::uint32_t id,
+                          std::uint8_t index, std::uint8_t count )
+    {
+        out[0] = static_cast<char>(frag_piece);
+        out[1] = static_cast<char>(id >> 24);
+        out[2] = static_cast<char>(id >> 16);
+        out[3] = static_cast<char>(id >>  8);
+        out[4] = static_cast<char>(id);
+        out[5] = static_cast<char>(index);
+        out[6] = static_cast<char>(count);
+    }
+
+    frag_reassembly::frag_reassembly( size_t max_len, size_t frames,
+                                      std::uint32_t timeout_ms )
+        :table_(frames ? frames : 1)
+        ,max_len_(max_len)
+        ,timeout_(std::chrono::milliseconds(timeout_ms))
+    { }
+
+    /// the entry of the frame; old entries are freed on the way and
+    /// the oldest one is taken if there is no free one
+    frag_reassembly::entry *frag_reassembly::find( std::uint32_t id,
+                                            clock_type::time_point now )
+    {
+        entry *found  = nullptr;
+        entry *free   = nullptr;
+        entry *oldest = nullptr;
+
+        for( auto &e: table_ ) {
+            if( e.used && now - e.start > timeout_ ) {
+                e.used = false;
+                ++dropped_;
+            }
+            if( !e.used ) {
+                free = free ? free : &e;
+                continue;
+            }
+            if( e.id == id ) {
+                found = &e;
+            }
+            if( !oldest || e.start < oldest->start ) {
+                oldest = &e;
+            }
+        }
+
+        if( found ) {
+            return found;
+        }
+
+        entry *res = free;
+        if( !res ) {
+            res = oldest;
+            ++dropped_;
+        }
+        res->used  = true;
+        res->id    = id;
+        res->count = 0;
+        res->got   = 0;
+        res->size  = 0;
+        res->start = now;
+        return res;
+    }
+
+    frag_reassembly::result frag_reassembly::add( const char *data,
+                                                  size_t len,
+                                                  std::string &out )
+    {
+        if( len <= frag_piece_head
+         || std::uint8_t(data[0]) != frag_piece )
+        {
+            return FRAG_DROP;
+        }
+
+        const auto *head = reinterpret_cast<const std::uint8_t *>(data);
+        const std::uint32_t id = ( std::uint32_t(head[1]) << 24 )
+                               | ( std::uint32_t(head[2]) << 16 )
+                               | ( std::uint32_t(head[3]) <<  8 )
+                               |   std::uint32_t(head[4]);
+        const std::uint8_t index = head[5];
+        const std::uint8_t count = head[6];
+
+        if( count < 2 || index >= count ) {
+            return FRAG_DROP;
+        }
+
+        entry *e = find( id, clock_type::now( ) );
+
+        if( e->count == 0 ) {
+            e->count = count;
+            e->pieces.resize( count );
+            for( auto &p: e->pieces ) {
+                p.clear( );
+            }
+        } else if( e->count != count ) {
+            e->used = false;
+            ++dropped_;
+            return FRAG_DROP;
+        }
+
+        auto &piece(e->pieces[index]);
+        const size_t body = len - frag_piece_head;
+
+        /// a repeated piece is ignored
+        if( !piece.empty( ) ) {
+            return FRAG_WAIT;
+        }
+
+        if( e->size + body > max_len_ ) {
+            e->used = false;
+            ++dropped_;
+            return FRAG_DROP;
+        }
+
+        piece.assign( data + frag_piece_head, body );
+        e->size += body;
+
+        if( ++e->got < e->count ) {
+            return FRAG_WAIT;
+        }
+
+        out.clear( );
+        out.reserve( e->size );
+        for( auto &p: e->pieces ) {
+            out.append( p );
+        }
+        e->used = false;
+        return FRAG_DONE;
+    }
+
+}}
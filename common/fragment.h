@@ -0,0 +1,81 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace msctl { namespace common {
+
+    /// frames of a datagram transport cut to the path MTU by the
+    /// application; a lost datagram loses its frame only, not the
+    /// fragments the kernel would make of a big datagram.
+    /// Every datagram starts with a header:
+    ///   whole frame: frag_whole, the frame
+    ///   a piece:     frag_piece, 4 bytes of big endian frame id,
+    ///                the index, the number of pieces, the piece
+    static const std::uint8_t frag_whole      = 0x00;
+    static const std::uint8_t frag_piece      = 0x01;
+    static const size_t       frag_whole_head = 1;
+    static const size_t       frag_piece_head = 7;
+    static const size_t       frag_max_pieces = 255;
+
+    /// the smallest datagram of a fragmenting transport; the pieces of
+    /// the biggest frame have to fit frag_max_pieces
+    static const size_t       frag_min_size   = 576;
+
+    /// writes frag_piece_head bytes
+    void write_frag_head( char *out, std::uint32_t id,
+                          std::uint8_t index, std::uint8_t count );
+
+    /// pieces of the frames of one peer. Frames are completed in any
+    /// order; an incomplete frame is dropped after the timeout or when
+    /// the table is full and a new frame comes
+    class frag_reassembly {
+
+        using clock_type = std::chrono::steady_clock;
+
+        struct entry {
+            bool                     used  = false;
+            std::uint32_t            id    = 0;
+            std::uint8_t             count = 0;
+            std::uint8_t             got   = 0;
+            size_t                   size  = 0;
+            clock_type::time_point   start;
+            std::vector<std::string> pieces;
+        };
+
+        std::vector<entry>   table_;
+        size_t               max_len_;
+        clock_type::duration timeout_;
+        std::uint64_t        dropped_ = 0;
+
+        entry *find( std::uint32_t id, clock_type::time_point now );
+
+    public:
+
+        enum result {
+            FRAG_DONE = 0,  /// out has the frame
+            FRAG_WAIT = 1,  /// more pieces are needed
+            FRAG_DROP = 2,  /// a bad piece
+        };
+
+        /// frames up to max_len bytes; up to frames of them at once
+        frag_reassembly( size_t max_len, size_t frames = 16,
+                         std::uint32_t timeout_ms = 2000 );
+
+        /// a datagram that starts with frag_piece
+        result add( const char *data, size_t len, std::string &out );
+
+        /// frames that were not completed
+        std::uint64_t dropped( ) const
+        {
+            return dropped_;
+        }
+    };
+
+}}
+
+#endif // FRAGMENT_H
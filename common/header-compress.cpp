@@ -0,0 +1,265 @@
+#include <cstring>
+
+#include "header-compress.h"
+
+namespace msctl { namespace common {
+
+namespace {
+
+    const size_t ip_header  = 20;
+    const size_t udp_header = 8;
+    const size_t tcp_header = 20;
+    const size_t key_size   = ip_header + 4;   /// the header and the ports
+
+    const std::uint8_t proto_tcp = 6;
+    const std::uint8_t proto_udp = 17;
+    const std::uint8_t tcp_urg   = 0x20;
+
+    /// ip id + TCP: seq, ack, offset and flags, window, checksum
+    const size_t tcp_dynamic = 2 + 14;
+    /// ip id + UDP: checksum
+    const size_t udp_dynamic = 2 + 2;
+
+    std::uint16_t get16( const std::uint8_t *p )
+    {
+        return static_cast<std::uint16_t>( ( p[0] << 8 ) | p[1] );
+    }
+
+    void put16( std::uint8_t *p, size_t value )
+    {
+        p[0] = static_cast<std::uint8_t>(value >> 8);
+        p[1] = static_cast<std::uint8_t>(value);
+    }
+
+    /// headers of IPv4 without options and not a fragment; TCP without
+    /// urgent data or UDP. Returns the length of the headers or 0
+    size_t flow_header_len( const std::uint8_t *p, size_t len )
+    {
+        if( len < ip_header + udp_header
+         || p[0] != 0x45
+         || get16( p + 2 ) != len
+         || ( get16( p + 6 ) & 0x3FFF ) != 0 )
+        {
+            return 0;
+        }
+
+        const std::uint8_t *l4 = p + ip_header;
+
+        if( p[9] == proto_tcp ) {
+            if( len < ip_header + tcp_header ) {
+                return 0;
+            }
+            const size_t hl = ip_header + ( l4[12] >> 4 ) * 4;
+            if( hl < ip_header + tcp_header || hl > len
+             || ( l4[13] & tcp_urg ) || get16( l4 + 18 ) != 0 )
+            {
+                return 0;
+            }
+            return hl;
+        } else if( p[9] == proto_udp ) {
+            return ( get16( l4 + 4 ) == len - ip_header )
+                 ? ip_header + udp_header
+                 : 0;
+        }
+        return 0;
+    }
+
+    /// the fields that change from packet to packet are zeroed
+    void make_key( const std::uint8_t *p, std::uint8_t *key )
+    {
+        memcpy( key, p, key_size );
+        put16( key + 2,  0 );   /// total length
+        put16( key + 4,  0 );   /// id
+        put16( key + 10, 0 );   /// checksum
+    }
+
+    std::uint16_t ip_checksum( const std::uint8_t *p )
+    {
+        std::uint32_t sum = 0;
+        for( size_t i = 0; i < ip_header; i += 2 ) {
+            sum += get16( p + i );
+        }
+        while( sum >> 16 ) {
+            sum = ( sum & 0xFFFF ) + ( sum >> 16 );
+        }
+        return static_cast<std::uint16_t>(~sum);
+    }
+}
+
+    size_t header_compressor::compress( const char *data, size_t len,
+                                        std::uint8_t *head, size_t &skip )
+    {
+        const auto  *p  = reinterpret_cast<const std::uint8_t *>(data);
+        const size_t hl = flow_header_len( p, len );
+
+        skip = 0;
+        if( hl == 0 ) {
+            return 0;
+        }
+
+        std::uint8_t key[key_size];
+        make_key( p, key );
+
+        size_t id = hc_contexts;
+        for( size_t i = 0; i < hc_contexts; ++i ) {
+            if( ctx_[i].valid && memcmp( ctx_[i].key, key, key_size ) == 0 ) {
+                id = i;
+                break;
+            }
+        }
+
+        /// a new flow takes a free or the least recently used context
+        if( id == hc_contexts ) {
+            id = 0;
+            for( size_t i = 0; i < hc_contexts; ++i ) {
+                if( !ctx_[i].valid ) {
+                    id = i;
+                    break;
+                } else if( ctx_[i].used < ctx_[id].used ) {
+                    id = i;
+                }
+            }
+            context &c( ctx_[id] );
+            memcpy( c.key, key, key_size );
+            ++c.gen;
+            c.valid = true;
+            c.since = refresh_;
+        }
+
+        context &c( ctx_[id] );
+        c.used = ++clock_;
+
+        head[0] = hc_mark;
+        head[1] = static_cast<std::uint8_t>(id);
+        head[2] = c.gen;
+
+        if( c.since >= refresh_ ) {
+            c.since = 0;
+            head[0] = hc_full_mark;
+            return hc_head_size;
+        }
+        ++c.since;
+
+        std::uint8_t       *pos = head + hc_head_size;
+        const std::uint8_t *l4  = p + ip_header;
+
+        memcpy( pos, p + 4, 2 );
+        pos += 2;
+
+        if( p[9] == proto_tcp ) {
+            memcpy( pos, l4 + 4, 14 );
+            pos += 14;
+            memcpy( pos, l4 + tcp_header, hl - ip_header - tcp_header );
+            pos += hl - ip_header - tcp_header;
+        } else {
+            memcpy( pos, l4 + 6, 2 );
+            pos += 2;
+        }
+
+        skip = hl;
+        return pos - head;
+    }
+
+    void header_compressor::reset( std::uint8_t id, std::uint8_t gen )
+    {
+        if( id < hc_contexts && ctx_[id].valid && ctx_[id].gen == gen ) {
+            ctx_[id].since = refresh_;
+        }
+    }
+
+    header_decompressor::result
+    header_decompressor::decompress( const char *&data, size_t &len,
+                                     std::uint8_t &id, std::uint8_t &gen )
+    {
+        const auto *p = reinterpret_cast<const std::uint8_t *>(data);
+
+        if( len < hc_head_size || p[1] >= hc_contexts ) {
+            return HC_DROP;
+        }
+
+        context &c( ctx_[p[1]] );
+
+        if( p[0] == hc_full_mark ) {
+            const std::uint8_t *body = p + hc_head_size;
+            const size_t        blen = len - hc_head_size;
+            if( flow_header_len( body, blen ) == 0 ) {
+                return HC_DROP;
+            }
+            make_key( body, c.key );
+            c.gen   = p[2];
+            c.valid = true;
+            c.asked = false;
+            data    = reinterpret_cast<const char *>(body);
+            len     = blen;
+            return HC_DONE;
+        }
+
+        if( !c.valid || c.gen != p[2] ) {
+            /// one request for a generation; a lost one is covered
+            /// by the sender's refresh
+            if( c.asked && c.asked_gen == p[2] ) {
+                return HC_DROP;
+            }
+            c.asked     = true;
+            c.asked_gen = p[2];
+            id  = p[1];
+            gen = p[2];
+            return HC_RESET;
+        }
+
+        const std::uint8_t *pos = p + hc_head_size;
+        const std::uint8_t *end = p + len;
+
+        size_t hl = ip_header + udp_header;
+        size_t dynamic = udp_dynamic;
+
+        if( c.key[9] == proto_tcp ) {
+            if( size_t(end - pos) < tcp_dynamic ) {
+                return HC_DROP;
+            }
+            const size_t off = ( pos[2 + 8] >> 4 ) * 4;
+            if( off < tcp_header ) {
+                return HC_DROP;
+            }
+            hl      = ip_header + off;
+            dynamic = tcp_dynamic + off - tcp_header;
+        }
+
+        if( size_t(end - pos) < dynamic ) {
+            return HC_DROP;
+        }
+
+        const size_t payload = ( end - pos ) - dynamic;
+        const size_t total   = hl + payload;
+        if( total > 0xFFFF ) {
+            return HC_DROP;
+        }
+
+        out_.resize( total );
+        auto *o = reinterpret_cast<std::uint8_t *>(&out_[0]);
+
+        memcpy( o, c.key, key_size );
+        put16( o + 2, total );
+        memcpy( o + 4, pos, 2 );
+        pos += 2;
+        put16( o + 10, ip_checksum( o ) );
+
+        std::uint8_t *l4 = o + ip_header;
+        if( c.key[9] == proto_tcp ) {
+            memcpy( l4 + 4, pos, 14 );      /// seq .. checksum
+            put16( l4 + 18, 0 );            /// urgent pointer
+            memcpy( l4 + tcp_header, pos + 14, dynamic - tcp_dynamic );
+        } else {
+            put16( l4 + 4, total - ip_header );
+            memcpy( l4 + 6, pos, 2 );
+        }
+        pos += dynamic - 2;
+
+        memcpy( o + hl, pos, payload );
+
+        data = &out_[0];
+        len  = total;
+        return HC_DONE;
+    }
+
+}}
@@ -0,0 +1,100 @@
+#ifndef HEADER_COMPRESS_H
+#define HEADER_COMPRESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace msctl { namespace common {
+
+    /// context compression of IPv4 + TCP/UDP headers of tunnel packets.
+    /// A flow (addresses, ports, tos, ttl) gets a context on both sides;
+    /// its first packet goes full with the context id and generation,
+    /// the next ones carry the context id and the changing fields only.
+    /// The receiver restores the headers and the IPv4 checksum.
+    ///
+    /// A compressed packet starts with a byte that IPv4 and IPv6 can't
+    /// have, so restored and plain packets go the same way:
+    ///   full:       hc_full_mark, id, gen, the packet
+    ///   compressed: hc_mark, id, gen, ip id,
+    ///               TCP: seq, ack, offset and flags, window, checksum,
+    ///                    options;
+    ///               UDP: checksum;
+    ///               the payload
+    /// Fields are sent as is, not as deltas of the previous packet, so
+    /// a lost frame doesn't break the next ones. A packet of an unknown
+    /// context is dropped and the sender is asked to send a full one
+    static const std::uint8_t hc_full_mark    = 0xF8;
+    static const std::uint8_t hc_mark         = 0xF9;
+    static const size_t       hc_head_size    = 3;
+    static const size_t       hc_contexts     = 16;
+    static const size_t       hc_max_head     = 64;   /// compress( ) head
+
+    inline bool is_header_compressed( const char *data, size_t len )
+    {
+        return len >= hc_head_size
+            && ( std::uint8_t(data[0]) == hc_full_mark
+              || std::uint8_t(data[0]) == hc_mark );
+    }
+
+    class header_compressor {
+
+        struct context {
+            std::uint8_t  key[24];  /// static fields of IP and the ports
+            std::uint8_t  gen      = 0;
+            bool          valid    = false;
+            std::uint32_t since    = 0;   /// packets since the full one
+            std::uint64_t used     = 0;
+        };
+
+        context       ctx_[hc_contexts];
+        std::uint64_t clock_ = 0;
+        std::uint32_t refresh_;
+
+    public:
+
+        /// every refresh packets of a flow a full one goes again
+        explicit header_compressor( std::uint32_t refresh = 256 )
+            :refresh_(refresh ? refresh : 1)
+        { }
+
+        /// the packet is data[skip .. len) after head[0 .. result).
+        /// Returns 0 if the packet goes as is
+        size_t compress( const char *data, size_t len,
+                         std::uint8_t *head, size_t &skip );
+
+        /// the peer has lost the context; the next packet goes full
+        void reset( std::uint8_t id, std::uint8_t gen );
+    };
+
+    class header_decompressor {
+
+        struct context {
+            std::uint8_t  key[24];
+            std::uint8_t  gen    = 0;
+            bool          valid  = false;
+            bool          asked  = false; /// reset of the gen is requested
+            std::uint8_t  asked_gen = 0;
+        };
+
+        context           ctx_[hc_contexts];
+        std::vector<char> out_;
+
+    public:
+
+        enum result {
+            HC_DONE,        /// the restored packet is in data and len
+            HC_DROP,        /// broken or of a lost context
+            HC_RESET,       /// the same as HC_DROP; ask for a full packet
+        };
+
+        /// data and len of a compressed packet are replaced with the
+        /// restored one; it lives till the next call.
+        /// HC_RESET gives the context id and generation for the sender
+        result decompress( const char *&data, size_t &len,
+                           std::uint8_t &id, std::uint8_t &gen );
+    };
+
+}}
+
+#endif // HEADER_COMPRESS_H
@@ -0,0 +1,229 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "integrity.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MSCTL_CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define MSCTL_CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace msctl { namespace common {
+
+namespace {
+
+    const std::uint32_t castagnoli = 0x82F63B78;
+
+    /// slicing by 8; table[k][b] is the crc of b and k zero bytes
+    struct crc_table {
+
+        std::uint32_t value[8][256];
+
+        crc_table( )
+        {
+            for( std::uint32_t b = 0; b < 256; ++b ) {
+                std::uint32_t crc = b;
+                for( int i = 0; i < 8; ++i ) {
+                    crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? castagnoli : 0 );
+                }
+                value[0][b] = crc;
+            }
+            for( std::uint32_t b = 0; b < 256; ++b ) {
+                for( int k = 1; k < 8; ++k ) {
+                    const std::uint32_t prev = value[k - 1][b];
+                    value[k][b] = ( prev >> 8 ) ^ value[0][prev & 0xFF];
+                }
+            }
+        }
+    };
+
+    const crc_table &table( )
+    {
+        static const crc_table res;
+        return res;
+    }
+
+    std::uint32_t update_soft( std::uint32_t crc,
+                               const std::uint8_t *p, size_t len )
+    {
+        const auto &t( table( ).value );
+
+        while( len >= 8 ) {
+            std::uint32_t lo;
+            std::uint32_t hi;
+            memcpy( &lo, p,     4 );
+            memcpy( &hi, p + 4, 4 );
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            lo = __builtin_bswap32( lo );
+            hi = __builtin_bswap32( hi );
+#endif
+            lo ^= crc;
+            crc = t[7][ lo        & 0xFF] ^ t[6][( lo >>  8 ) & 0xFF]
+                ^ t[5][( lo >> 16 ) & 0xFF] ^ t[4][  lo >> 24        ]
+                ^ t[3][ hi        & 0xFF] ^ t[2][( hi >>  8 ) & 0xFF]
+                ^ t[1][( hi >> 16 ) & 0xFF] ^ t[0][  hi >> 24        ];
+            p   += 8;
+            len -= 8;
+        }
+
+        while( len-- ) {
+            crc = ( crc >> 8 ) ^ t[0][( crc ^ *p++ ) & 0xFF];
+        }
+        return crc;
+    }
+
+#if defined(MSCTL_CRC32C_X86)
+
+    __attribute__((target("sse4.2")))
+    std::uint32_t update_hard( std::uint32_t crc,
+                               const std::uint8_t *p, size_t len )
+    {
+        unsigned long long crc64 = crc;
+        while( len >= 8 ) {
+            unsigned long long value;
+            memcpy( &value, p, 8 );
+            crc64 = __builtin_ia32_crc32di( crc64, value );
+            p   += 8;
+            len -= 8;
+        }
+        crc = static_cast<std::uint32_t>(crc64);
+        while( len-- ) {
+            crc = __builtin_ia32_crc32qi( crc, *p++ );
+        }
+        return crc;
+    }
+
+    bool detect_hardware( )
+    {
+        return __builtin_cpu_supports( "sse4.2" );
+    }
+
+#elif defined(MSCTL_CRC32C_ARM)
+
+    std::uint32_t update_hard( std::uint32_t crc,
+                               const std::uint8_t *p, size_t len )
+    {
+        while( len >= 8 ) {
+            std::uint64_t value;
+            memcpy( &value, p, 8 );
+            crc  = __crc32cd( crc, value );
+            p   += 8;
+            len -= 8;
+        }
+        while( len-- ) {
+            crc = __crc32cb( crc, *p++ );
+        }
+        return crc;
+    }
+
+    bool detect_hardware( )
+    {
+        return true;
+    }
+
+#else
+
+    std::uint32_t update_hard( std::uint32_t crc,
+                               const std::uint8_t *p, size_t len )
+    {
+        return update_soft( crc, p, len );
+    }
+
+    bool detect_hardware( )
+    {
+        return false;
+    }
+
+#endif
+
+    class integrity_none: public integrity {
+    public:
+        const char *name( ) const override
+        {
+            return "none";
+        }
+
+        size_t length( ) const override
+        {
+            return 0;
+        }
+
+        void get( const void *, size_t, void * ) const override
+        { }
+
+        bool check( const void *, size_t, const void * ) const override
+        {
+            return true;
+        }
+    };
+
+    /// big endian crc after the data
+    class integrity_crc32c: public integrity {
+    public:
+        const char *name( ) const override
+        {
+            return "crc32c";
+        }
+
+        size_t length( ) const override
+        {
+            return 4;
+        }
+
+        void get( const void *data, size_t len,
+                  void *result ) const override
+        {
+            const std::uint32_t crc = crc32c( data, len );
+            auto *res = static_cast<std::uint8_t *>(result);
+            res[0] = static_cast<std::uint8_t>(crc >> 24);
+            res[1] = static_cast<std::uint8_t>(crc >> 16);
+            res[2] = static_cast<std::uint8_t>(crc >>  8);
+            res[3] = static_cast<std::uint8_t>(crc);
+        }
+
+        bool check( const void *data, size_t len,
+                    const void *value ) const override
+        {
+            std::uint8_t tmp[4];
+            get( data, len, tmp );
+            return memcmp( tmp, value, sizeof(tmp) ) == 0;
+        }
+    };
+}
+
+    integrity_sptr create_integrity( const std::string &name )
+    {
+        if( name.empty( ) ) {
+            return integrity_sptr( );
+        } else if( name == "none" ) {
+            return std::make_shared<integrity_none>( );
+        } else if( name == "crc32c" ) {
+            return std::make_shared<integrity_crc32c>( );
+        }
+        throw std::runtime_error( "Invalid integrity " + name );
+    }
+
+    bool crc32c_hardware( )
+    {
+        static const bool res = detect_hardware( );
+        return res;
+    }
+
+    std::uint32_t crc32c( const void *data, size_t len )
+    {
+        const auto *p = static_cast<const std::uint8_t *>(data);
+        if( crc32c_hardware( ) ) {
+            return ~update_hard( 0xFFFFFFFF, p, len );
+        }
+        return ~update_soft( 0xFFFFFFFF, p, len );
+    }
+
+    std::uint32_t crc32c_soft( const void *data, size_t len )
+    {
+        const auto *p = static_cast<const std::uint8_t *>(data);
+        return ~update_soft( 0xFFFFFFFF, p, len );
+    }
+
+}}
@@ -0,0 +1,47 @@
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace msctl { namespace common {
+
+    /// the check value at the end of every frame
+    class integrity {
+
+    public:
+
+        virtual ~integrity( ) { }
+
+        virtual const char *name( ) const = 0;
+        virtual size_t length( ) const = 0;
+
+        /// writes length( ) bytes to result
+        virtual void get( const void *data, size_t len,
+                          void *result ) const = 0;
+
+        virtual bool check( const void *data, size_t len,
+                            const void *value ) const = 0;
+    };
+
+    using integrity_sptr = std::shared_ptr<integrity>;
+
+    /// "" -> empty pointer; the transport keeps its own hash.
+    /// "none" -> nothing is added; for TCP, that has its own checksums.
+    /// "crc32c" -> CRC-32C (Castagnoli); SSE4.2 or ARMv8 CRC if the cpu
+    /// has it.
+    /// Throws std::runtime_error for an unknown name
+    integrity_sptr create_integrity( const std::string &name );
+
+    /// CRC-32C with the initial value and the final xor
+    std::uint32_t crc32c( const void *data, size_t len );
+    std::uint32_t crc32c_soft( const void *data, size_t len );
+
+    /// the cpu has CRC-32C instructions; crc32c( ) uses them
+    bool crc32c_hardware( );
+
+}}
+
+#endif // INTEGRITY_H
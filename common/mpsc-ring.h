@@ -0,0 +1,127 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace msctl { namespace common {
+
+    /// bounded lock-free ring; many producers, one consumer.
+    /// Every cell has a sequence number; a producer takes a cell by CAS
+    /// on the tail and publishes it by the sequence store.
+    /// The size is rounded up to a power of 2
+    template <typename T>
+    class mpsc_ring {
+
+        struct cell {
+            std::atomic<size_t> seq;
+            T                   value;
+        };
+
+        static const size_t cache_line = 64;
+
+        static size_t round_size( size_t size )
+        {
+            size_t res = 2;
+            while( res < size ) {
+                res <<= 1;
+            }
+            return res;
+        }
+
+        std::unique_ptr<cell[]>      cells_;
+        const size_t                 mask_;
+
+        char                         pad0_[cache_line];
+        std::atomic<size_t>          tail_;    /// producers
+        char                         pad1_[cache_line];
+        size_t                       head_;    /// the consumer
+        std::atomic<std::uint64_t>   drops_;
+        char                         pad2_[cache_line];
+
+    public:
+
+        explicit mpsc_ring( size_t size )
+            :cells_(new cell[round_size( size )])
+            ,mask_(round_size( size ) - 1)
+            ,tail_(0)
+            ,head_(0)
+            ,drops_(0)
+        {
+            for( size_t i = 0; i <= mask_; ++i ) {
+                cells_[i].seq.store( i, std::memory_order_relaxed );
+            }
+        }
+
+        mpsc_ring( const mpsc_ring & ) = delete;
+        mpsc_ring &operator = ( const mpsc_ring & ) = delete;
+
+        /// any thread; returns false and drops the value if the ring is full
+        bool push( T value )
+        {
+            size_t pos = tail_.load( std::memory_order_relaxed );
+            cell  *c   = nullptr;
+
+            while( true ) {
+                c = &cells_[pos & mask_];
+                const size_t seq = c->seq.load( std::memory_order_acquire );
+                const std::intptr_t diff = static_cast<std::intptr_t>(seq)
+                                         - static_cast<std::intptr_t>(pos);
+                if( diff == 0 ) {
+                    if( tail_.compare_exchange_weak( pos, pos + 1,
+                                                std::memory_order_relaxed ) )
+                    {
+                        break;
+                    }
+                } else if( diff < 0 ) {
+                    drops_.fetch_add( 1, std::memory_order_relaxed );
+                    return false;
+                } else {
+                    pos = tail_.load( std::memory_order_relaxed );
+                }
+            }
+
+            c->value = std::move( value );
+            c->seq.store( pos + 1, std::memory_order_release );
+            return true;
+        }
+
+        /// the consumer only
+        bool pop( T &out )
+        {
+            cell *c = &cells_[head_ & mask_];
+            if( c->seq.load( std::memory_order_acquire ) != head_ + 1 ) {
+                return false;
+            }
+
+            out      = std::move( c->value );
+            c->value = T( );
+            c->seq.store( head_ + mask_ + 1, std::memory_order_release );
+            ++head_;
+            return true;
+        }
+
+        /// the consumer only
+        bool empty( ) const
+        {
+            const cell *c = &cells_[head_ & mask_];
+            return c->seq.load( std::memory_order_acquire ) != head_ + 1;
+        }
+
+        size_t capacity( ) const
+        {
+            return mask_ + 1;
+        }
+
+        /// values dropped because the ring was full
+        std::uint64_t drops( ) const
+        {
+            return drops_.load( std::memory_order_relaxed );
+        }
+    };
+
+}}
+
+#endif // MPSC_RING_H
@@ -0,0 +1,616 @@
+#include "../tuntap-queue.h"
+
+#if defined(__linux__)
+
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "posix-utils.h"
+
+#if defined(TPACKET3_HDRLEN)
+#define MSCTL_TPACKET_V3_SUPPORTED 1
+#endif
+
+namespace msctl { namespace common {
+
+#if defined(MSCTL_TPACKET_V3_SUPPORTED)
+
+namespace {
+
+    namespace ba = boost::asio;
+    namespace ph = std::placeholders;
+
+    using error_code = boost::system::error_code;
+    using fd_keeper  = utilities::fd_keeper;
+
+    const size_t    RX_BLOCK_SIZE  = 256 * 1024;
+    const size_t    RX_BLOCK_COUNT = 64;
+    const size_t    TX_MIN_FRAMES  = 256;
+
+    /// ms; a block that is not full is given to us after that time
+    const unsigned  RX_BLOCK_TOV   = 1;
+
+    /// tpacket3_hdr is followed by sockaddr_ll in rx frames;
+    /// tx data starts right after the header
+    const size_t    FRAME_HDR_LEN  = TPACKET_ALIGN(sizeof(tpacket3_hdr));
+
+    void throw_errno( const std::string &name )
+    {
+        utilities::throw_errno( name );
+    }
+
+    size_t align_up( size_t value, size_t align )
+    {
+        return ( value + align - 1 ) / align * align;
+    }
+
+    template <typename T>
+    T load_acquire( const T *ptr )
+    {
+        return __atomic_load_n( ptr, __ATOMIC_ACQUIRE );
+    }
+
+    template <typename T>
+    void store_release( T *ptr, T value )
+    {
+        __atomic_store_n( ptr, value, __ATOMIC_RELEASE );
+    }
+
+    /// AF_PACKET socket with TPACKET_V3 rx and tx rings
+    /// bound to an existing ethernet interface (e.g. one end of a veth).
+    /// Rx blocks are handed to the read call without a syscall per packet;
+    /// tx frames are filled here and sent by one send( ) per flush.
+    /// The other end has to accept the frames without ARP:
+    /// the peer MAC is learned from received frames (broadcast until then)
+    class packet_queue: public tuntap_queue,
+                        public std::enable_shared_from_this<packet_queue> {
+
+        using this_type   = packet_queue;
+        using shared_type = std::shared_ptr<this_type>;
+
+        ba::io_service               &ios_;
+        ba::io_service::strand        dispatcher_;
+        ba::posix::stream_descriptor  sock_;
+
+        char                         *map_       = nullptr;
+        size_t                        map_len_   = 0;
+
+        tpacket_req3                  rx_req_;
+        tpacket_req3                  tx_req_;
+        char                         *rx_ring_   = nullptr;
+        char                         *tx_ring_   = nullptr;
+        size_t                        rx_next_   = 0;
+        size_t                        tx_next_   = 0;
+
+        size_t                        block_;
+        std::uint32_t                 busy_poll_;
+        std::uint8_t                  my_mac_[ETH_ALEN];
+        std::uint8_t                  peer_mac_[ETH_ALEN];
+
+        std::vector<packet_slice>     batch_;
+        aqm_queue<packet_ptr>         backlog_;
+
+        mpsc_ring<packet_ptr>         incoming_;
+        std::atomic<bool>             flush_posted_;
+        bool                          wait_send_    = false;
+
+        bool                          active_       = true;
+
+    public:
+
+        packet_queue( ba::io_service &ios, const queue_params &params )
+            :ios_(ios)
+            ,dispatcher_(ios_)
+            ,sock_(ios_)
+            ,block_(params.block_size)
+            ,busy_poll_(params.busy_poll)
+            ,incoming_(incoming_ring_size( params.limits ))
+            ,flush_posted_(false)
+        {
+            memset( &rx_req_, 0, sizeof(rx_req_) );
+            memset( &tx_req_, 0, sizeof(tx_req_) );
+            memset( my_mac_,   0x00, sizeof(my_mac_) );
+            memset( peer_mac_, 0xFF, sizeof(peer_mac_) );
+            backlog_.set_limits( params.limits );
+        }
+
+        ~packet_queue( )
+        {
+            if( map_ ) {
+                munmap( map_, map_len_ );
+            }
+        }
+
+        /// fanout_id != 0 joins the socket to a fanout group
+        void init( const std::string &iface, std::uint16_t fanout_id )
+        {
+            fd_keeper s( ::socket( AF_PACKET, SOCK_RAW,
+                                   htons( ETH_P_ALL ) ) );
+            if( s.fd_ < 0 ) {
+                throw_errno( "packet_queue. socket(AF_PACKET)" );
+            }
+
+            int opt = TPACKET_V3;
+            if( setsockopt( s, SOL_PACKET, PACKET_VERSION,
+                            &opt, sizeof(opt) ) < 0 )
+            {
+                throw_errno( "packet_queue. setsockopt(PACKET_VERSION)" );
+            }
+
+            /// bad tx frames are skipped instead of stopping the ring
+            opt = 1;
+            setsockopt( s, SOL_PACKET, PACKET_LOSS, &opt, sizeof(opt) );
+
+#if defined(PACKET_QDISC_BYPASS)
+            opt = 1;
+            setsockopt( s, SOL_PACKET, PACKET_QDISC_BYPASS,
+                        &opt, sizeof(opt) );
+#endif
+
+#if defined(PACKET_IGNORE_OUTGOING)
+            opt = 1;
+            setsockopt( s, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+                        &opt, sizeof(opt) );
+#endif
+
+#if defined(SO_BUSY_POLL)
+            /// needs CAP_NET_ADMIN to raise; not fatal
+            if( busy_poll_ ) {
+                opt = static_cast<int>(busy_poll_);
+                setsockopt( s, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof(opt) );
+            }
+#endif
+
+            const unsigned ifindex = if_nametoindex( iface.c_str( ) );
+            if( ifindex == 0 ) {
+                throw_errno( "packet_queue. if_nametoindex(" + iface + ")" );
+            }
+
+            read_mac( s, iface );
+            setup_rings( s );
+
+            sockaddr_ll addr;
+            memset( &addr, 0, sizeof(addr) );
+            addr.sll_family   = AF_PACKET;
+            addr.sll_protocol = htons( ETH_P_ALL );
+            addr.sll_ifindex  = static_cast<int>(ifindex);
+
+            if( bind( s, reinterpret_cast<sockaddr *>(&addr),
+                      sizeof(addr) ) < 0 )
+            {
+                throw_errno( "packet_queue. bind(" + iface + ")" );
+            }
+
+            if( fanout_id ) {
+                opt = fanout_id | ( PACKET_FANOUT_HASH << 16 );
+                if( setsockopt( s, SOL_PACKET, PACKET_FANOUT,
+                                &opt, sizeof(opt) ) < 0 )
+                {
+                    throw_errno( "packet_queue. setsockopt(PACKET_FANOUT)" );
+                }
+            }
+
+            sock_.assign( s.release( ) );
+        }
+
+        void start_read( ) override
+        {
+            dispatcher_.post( std::bind( &this_type::start_read_impl, this,
+                                         shared_from_this( ) ) );
+        }
+
+        void write( const char *data, size_t length ) override
+        {
+            if( length == 0 || length > block_ ) {
+                return;
+            }
+
+            if( !incoming_.push( make_packet( data, length ) ) ) {
+                return;
+            }
+
+            if( !flush_posted_.exchange( true ) ) {
+                dispatcher_.post( std::bind( &this_type::flush_writes, this,
+                                             shared_from_this( ) ) );
+            }
+        }
+
+        void close( ) override
+        {
+            dispatcher_.post( std::bind( &this_type::close_impl, this,
+                                         shared_from_this( ) ) );
+        }
+
+        const char *backend_name( ) const override
+        {
+            return "packet";
+        }
+
+        queue_stat write_queue_stat( ) const override
+        {
+            queue_stat res = backlog_.stat( );
+            res.tail_drops += incoming_.drops( );
+            return res;
+        }
+
+    private:
+
+        static void drop_packet( packet_ptr & )
+        { }
+
+        void read_mac( int fd, const std::string &iface )
+        {
+            struct ifreq ifr;
+            memset( &ifr, 0, sizeof(ifr) );
+            strncpy( ifr.ifr_name, iface.c_str( ), IFNAMSIZ - 1 );
+
+            if( ioctl( fd, SIOCGIFHWADDR, &ifr ) < 0 ) {
+                throw_errno( "packet_queue. ioctl(SIOCGIFHWADDR)" );
+            }
+
+            if( ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER ) {
+                throw std::runtime_error( "packet_queue. " + iface
+                                        + " is not an ethernet interface." );
+            }
+
+            memcpy( my_mac_, ifr.ifr_hwaddr.sa_data, ETH_ALEN );
+        }
+
+        void setup_rings( int fd )
+        {
+            const size_t page = static_cast<size_t>(sysconf( _SC_PAGESIZE ));
+
+            /// rx: frames have variable size in V3; tp_frame_size is
+            /// only the limit for one packet
+            const size_t rx_frame = TPACKET_ALIGN( FRAME_HDR_LEN
+                                                 + sizeof(sockaddr_ll)
+                                                 + ETH_HLEN + block_ );
+            const size_t rx_block = std::max( RX_BLOCK_SIZE,
+                                              align_up( rx_frame, page ) );
+
+            rx_req_.tp_block_size      = static_cast<unsigned>(rx_block);
+            rx_req_.tp_block_nr        = RX_BLOCK_COUNT;
+            rx_req_.tp_frame_size      = static_cast<unsigned>(rx_frame);
+            rx_req_.tp_frame_nr        = static_cast<unsigned>(
+                                  ( rx_block / rx_frame ) * RX_BLOCK_COUNT );
+            rx_req_.tp_retire_blk_tov  = RX_BLOCK_TOV;
+
+            if( setsockopt( fd, SOL_PACKET, PACKET_RX_RING,
+                            &rx_req_, sizeof(rx_req_) ) < 0 )
+            {
+                throw_errno( "packet_queue. setsockopt(PACKET_RX_RING)" );
+            }
+
+            /// tx: fixed frames; no block timer or private area in V3
+            const size_t tx_frame = TPACKET_ALIGN( FRAME_HDR_LEN
+                                                 + sizeof(sockaddr_ll)
+                                                 + ETH_HLEN + block_ );
+            const size_t tx_block = align_up( tx_frame, page );
+            const size_t per_block = tx_block / tx_frame;
+            const size_t tx_count = ( TX_MIN_FRAMES + per_block - 1 )
+                                  / per_block;
+
+            tx_req_.tp_block_size = static_cast<unsigned>(tx_block);
+            tx_req_.tp_block_nr   = static_cast<unsigned>(tx_count);
+            tx_req_.tp_frame_size = static_cast<unsigned>(tx_frame);
+            tx_req_.tp_frame_nr   = static_cast<unsigned>(per_block
+                                                          * tx_count);
+
+            if( setsockopt( fd, SOL_PACKET, PACKET_TX_RING,
+                            &tx_req_, sizeof(tx_req_) ) < 0 )
+            {
+                throw_errno( "packet_queue. setsockopt(PACKET_TX_RING)" );
+            }
+
+            /// rx ring goes first in the mapping
+            const size_t rx_len = rx_block * RX_BLOCK_COUNT;
+            const size_t tx_len = tx_block * tx_count;
+
+            void *res = mmap( nullptr, rx_len + tx_len,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, 0 );
+            if( res == MAP_FAILED ) {
+                throw_errno( "packet_queue. mmap" );
+            }
+
+            map_     = static_cast<char *>(res);
+            map_len_ = rx_len + tx_len;
+            rx_ring_ = map_;
+            tx_ring_ = map_ + rx_len;
+        }
+
+        void close_impl( shared_type )
+        {
+            if( active_ ) {
+                active_ = false;
+                error_code ec;
+                sock_.close( ec );
+            }
+        }
+
+        /// ================ read ================ ///
+
+        void start_read_impl( shared_type )
+        {
+            wait_read( );
+        }
+
+        void wait_read( )
+        {
+            sock_.async_read_some( ba::null_buffers( ),
+                dispatcher_.wrap(
+                    std::bind( &this_type::on_readable, this,
+                               ph::_1, shared_from_this( ) ) ) );
+        }
+
+        void on_readable( const error_code &err, shared_type )
+        {
+            if( err ) {
+                if( active_ && error_call_ ) {
+                    error_call_( err );
+                }
+                return;
+            }
+
+            if( !active_ ) {
+                return;
+            }
+
+            read_blocks( );
+            wait_read( );
+        }
+
+        tpacket_block_desc *rx_block( size_t id )
+        {
+            return reinterpret_cast<tpacket_block_desc *>(
+                        rx_ring_ + id * rx_req_.tp_block_size );
+        }
+
+        /// every ready block is one batch;
+        /// its slices are valid until the block is given back
+        void read_blocks( )
+        {
+            for( size_t i = 0; i < rx_req_.tp_block_nr; ++i ) {
+
+                tpacket_block_desc *desc = rx_block( rx_next_ );
+                auto status = load_acquire( &desc->hdr.bh1.block_status );
+                if( !( status & TP_STATUS_USER ) ) {
+                    break;
+                }
+
+                read_block( desc );
+
+                store_release( &desc->hdr.bh1.block_status,
+                               static_cast<std::uint32_t>(TP_STATUS_KERNEL) );
+
+                rx_next_ = ( rx_next_ + 1 ) % rx_req_.tp_block_nr;
+            }
+        }
+
+        void read_block( tpacket_block_desc *desc )
+        {
+            batch_.clear( );
+
+            char *ptr = reinterpret_cast<char *>(desc)
+                      + desc->hdr.bh1.offset_to_first_pkt;
+
+            for( std::uint32_t i = 0; i < desc->hdr.bh1.num_pkts; ++i ) {
+                auto hdr = reinterpret_cast<tpacket3_hdr *>(ptr);
+                on_frame( hdr );
+                ptr += hdr->tp_next_offset;
+            }
+
+            if( !batch_.empty( ) ) {
+                read_call_( &batch_[0], batch_.size( ) );
+            }
+        }
+
+        void on_frame( tpacket3_hdr *hdr )
+        {
+            /// truncated; the packet is bigger than the block
+            if( hdr->tp_snaplen < hdr->tp_len
+             || hdr->tp_snaplen <= ETH_HLEN )
+            {
+                return;
+            }
+
+            char *frame = reinterpret_cast<char *>(hdr);
+            auto sll = reinterpret_cast<const sockaddr_ll *>(
+                                                    frame + FRAME_HDR_LEN );
+
+            /// our own writes; if PACKET_IGNORE_OUTGOING is not there
+            if( sll->sll_pkttype == PACKET_OUTGOING ) {
+                return;
+            }
+
+            char *eth = frame + hdr->tp_mac;
+
+            std::uint16_t proto;
+            memcpy( &proto, eth + 2 * ETH_ALEN, sizeof(proto) );
+            proto = ntohs( proto );
+
+            if( proto != ETH_P_IP && proto != ETH_P_IPV6 ) {
+                return;
+            }
+
+            memcpy( peer_mac_, eth + ETH_ALEN, ETH_ALEN );
+
+            batch_.push_back( packet_slice { eth + ETH_HLEN,
+                                             hdr->tp_snaplen - ETH_HLEN } );
+        }
+
+        /// ================ write ================ ///
+
+        tpacket3_hdr *tx_frame( size_t id )
+        {
+            const size_t per_block = tx_req_.tp_block_size
+                                   / tx_req_.tp_frame_size;
+            return reinterpret_cast<tpacket3_hdr *>(
+                        tx_ring_
+                      + ( id / per_block ) * tx_req_.tp_block_size
+                      + ( id % per_block ) * tx_req_.tp_frame_size );
+        }
+
+        void flush_writes( shared_type )
+        {
+            /// a producer that comes after this store posts again
+            flush_posted_ = false;
+
+            packet_ptr w;
+            while( incoming_.pop( w ) ) {
+                if( active_ ) {
+                    size_t len = w->size( );
+                    backlog_.push( std::move( w ), len, false,
+                                   &this_type::drop_packet );
+                }
+            }
+
+            if( !active_ ) {
+                return;
+            }
+
+            send_backlog( );
+        }
+
+        /// fills free tx frames; one send( ) for all of them
+        void send_backlog( )
+        {
+            size_t count = 0;
+
+            while( !backlog_.empty( ) ) {
+
+                backlog_.codel_dequeue( &this_type::drop_packet );
+                if( backlog_.empty( ) ) {
+                    break;
+                }
+
+                tpacket3_hdr *hdr = tx_frame( tx_next_ );
+                if( load_acquire( &hdr->tp_status ) != TP_STATUS_AVAILABLE ) {
+                    break;
+                }
+
+                const packet_ptr &top( backlog_.front( ) );
+                const bool v6 = ( top->data( )[0] & 0xF0 ) == 0x60;
+                const std::uint16_t proto = htons( v6 ? ETH_P_IPV6
+                                                      : ETH_P_IP );
+
+                char *eth = reinterpret_cast<char *>(hdr) + FRAME_HDR_LEN;
+                memcpy( eth,                peer_mac_, ETH_ALEN );
+                memcpy( eth + ETH_ALEN,     my_mac_,   ETH_ALEN );
+                memcpy( eth + 2 * ETH_ALEN, &proto,    sizeof(proto) );
+                memcpy( eth + ETH_HLEN, top->data( ), top->size( ) );
+
+                hdr->tp_len         = static_cast<std::uint32_t>(
+                                                ETH_HLEN + top->size( ) );
+                hdr->tp_next_offset = 0;
+
+                store_release( &hdr->tp_status,
+                               static_cast<std::uint32_t>(
+                                                TP_STATUS_SEND_REQUEST ) );
+
+                tx_next_ = ( tx_next_ + 1 ) % tx_req_.tp_frame_nr;
+                backlog_.pop( );
+                ++count;
+            }
+
+            if( count && ::send( sock_.native_handle( ), nullptr, 0,
+                                 MSG_DONTWAIT ) < 0 )
+            {
+                if( errno != EAGAIN && errno != ENOBUFS && error_call_ ) {
+                    error_call_( error_code( errno,
+                                         boost::system::system_category( ) ) );
+                }
+            }
+
+            if( !backlog_.empty( ) ) {
+                wait_write( );
+            }
+        }
+
+        /// POLLOUT: the kernel has given back a tx frame
+        void wait_write( )
+        {
+            if( wait_send_ ) {
+                return;
+            }
+            wait_send_ = true;
+            sock_.async_write_some( ba::null_buffers( ),
+                dispatcher_.wrap(
+                    std::bind( &this_type::on_writable, this,
+                               ph::_1, shared_from_this( ) ) ) );
+        }
+
+        void on_writable( const error_code &err, shared_type )
+        {
+            wait_send_ = false;
+
+            if( err ) {
+                if( active_ && error_call_ ) {
+                    error_call_( err );
+                }
+                return;
+            }
+
+            if( active_ ) {
+                send_backlog( );
+            }
+        }
+    };
+}
+
+    tuntap_queue_list create_packet_queues( boost::asio::io_service &ios,
+                                            const std::string &iface,
+                                            std::uint32_t count,
+                                            const queue_params &params )
+    {
+        tuntap_queue_list res;
+
+        /// sockets of one device share the fanout group;
+        /// the id has to be unique on the host
+        std::uint16_t fanout_id = 0;
+        if( count > 1 ) {
+            fanout_id = static_cast<std::uint16_t>(
+                    ( getpid( ) << 4 ) ^ if_nametoindex( iface.c_str( ) ) );
+            fanout_id = fanout_id ? fanout_id : 1;
+        }
+
+        for( std::uint32_t i = 0; i < ( count ? count : 1 ); ++i ) {
+            auto inst = std::make_shared<packet_queue>( ios, params );
+            inst->init( iface, fanout_id );
+            res.emplace_back( inst );
+        }
+
+        return res;
+    }
+
+#else
+
+    tuntap_queue_list create_packet_queues( boost::asio::io_service &,
+                                            const std::string &,
+                                            std::uint32_t,
+                                            const queue_params & )
+    {
+        throw std::runtime_error( "packet backend. "
+                                  "TPACKET_V3 is not supported." );
+    }
+
+#endif
+
+}}
+
+#endif
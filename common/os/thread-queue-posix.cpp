@@ -0,0 +1,344 @@
+#include "../tuntap-queue.h"
+
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace msctl { namespace common {
+
+namespace {
+
+    using error_code = boost::system::error_code;
+    using clock_type = std::chrono::steady_clock;
+
+    void cpu_relax( )
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause( );
+#endif
+    }
+
+    bool set_non_blocking( int fd )
+    {
+        int flags = fcntl( fd, F_GETFL, 0 );
+        return ( flags >= 0 )
+            && ( fcntl( fd, F_SETFL, flags | O_NONBLOCK ) >= 0 );
+    }
+
+    bool pin_thread( int cpu )
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        return pthread_setaffinity_np( pthread_self( ),
+                                       sizeof(set), &set ) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    /// the device loop on its own thread.
+    /// Reads and writes are non-blocking; the thread spins for
+    /// busy_poll microseconds after the last packet and then sleeps
+    /// in poll( ) on the device and on a wake pipe for the writers.
+    /// The thread keeps the queue alive until close( )
+    class thread_queue: public tuntap_queue,
+                        public std::enable_shared_from_this<thread_queue> {
+
+        using this_type   = thread_queue;
+        using shared_type = std::shared_ptr<this_type>;
+
+        device_info                   hdl_;
+        int                           wake_[2] = { -1, -1 };
+
+        size_t                        block_;
+        size_t                        budget_;
+        int                           cpu_;
+        clock_type::duration          spin_;
+
+        std::vector<char>             buffer_;
+        std::vector<packet_slice>     batch_;
+        aqm_queue<packet_ptr>         backlog_;
+
+        mpsc_ring<packet_ptr>         incoming_;
+        std::atomic<size_t>           queued_;    /// in the ring
+
+        std::atomic<bool>             running_;
+        std::atomic<bool>             reading_;
+        std::atomic<bool>             sleeping_;
+
+    public:
+
+        thread_queue( const queue_params &params )
+            :block_(params.block_size)
+            ,budget_(params.read_budget ? params.read_budget : 1)
+            ,cpu_(params.cpu)
+            ,spin_(std::chrono::microseconds( params.busy_poll ))
+            ,buffer_(block_ * budget_)
+            ,incoming_(incoming_ring_size( params.limits ))
+            ,queued_(0)
+            ,running_(true)
+            ,reading_(false)
+            ,sleeping_(false)
+        {
+            batch_.reserve( budget_ );
+            backlog_.set_limits( params.limits );
+        }
+
+        ~thread_queue( )
+        {
+            for( auto fd: wake_ ) {
+                if( fd >= 0 ) {
+                    ::close( fd );
+                }
+            }
+        }
+
+        bool init( device_info &hdl )
+        {
+            if( pipe( wake_ ) < 0 ) {
+                return false;
+            }
+
+            if( !set_non_blocking( wake_[0] )
+             || !set_non_blocking( wake_[1] )
+             || !set_non_blocking( hdl.get( ) ) )
+            {
+                return false;
+            }
+
+            hdl_ = std::move( hdl );
+
+            std::thread( &this_type::run, this, shared_from_this( ) )
+                    .detach( );
+            return true;
+        }
+
+        void start_read( ) override
+        {
+            reading_ = true;
+            wake( );
+        }
+
+        void write( const char *data, size_t length ) override
+        {
+            if( length == 0 || length > block_ ) {
+                return;
+            }
+
+            ++queued_;
+            if( !incoming_.push( make_packet( data, length ) ) ) {
+                --queued_;
+                return;
+            }
+
+            /// pairs with the fence in sleep( )
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            if( sleeping_ ) {
+                wake( );
+            }
+        }
+
+        /// a packet can't overtake the queued ones
+        void write_through( const char *data, size_t length ) override
+        {
+            if( queued_ == 0 && backlog_.depth( ) == 0 && running_ ) {
+                ssize_t res = ::write( hdl_.get( ), data, length );
+                if( res >= 0 || ( errno != EAGAIN && errno != EINTR ) ) {
+                    return;
+                }
+            }
+            write( data, length );
+        }
+
+        void close( ) override
+        {
+            running_ = false;
+            wake( );
+        }
+
+        const char *backend_name( ) const override
+        {
+            return "thread";
+        }
+
+        queue_stat write_queue_stat( ) const override
+        {
+            queue_stat res = backlog_.stat( );
+            res.tail_drops += incoming_.drops( );
+            return res;
+        }
+
+    private:
+
+        static void drop_packet( packet_ptr & )
+        { }
+
+        void report( int code )
+        {
+            if( error_call_ ) {
+                error_call_( error_code( code,
+                                         boost::system::system_category( ) ) );
+            }
+        }
+
+        void wake( )
+        {
+            char c = 0;
+            if( ::write( wake_[1], &c, 1 ) < 0 ) {
+                /// the pipe is full; the thread is going to wake anyway
+            }
+        }
+
+        void clear_wake( )
+        {
+            char tmp[64];
+            while( ::read( wake_[0], tmp, sizeof(tmp) ) > 0 )
+            { }
+        }
+
+        /// returns the number of packets read
+        size_t read_packets( )
+        {
+            batch_.clear( );
+            for( size_t i = 0; i < budget_; ++i ) {
+                char *block = &buffer_[i * block_];
+                ssize_t res = ::read( hdl_.get( ), block, block_ );
+                if( res > 0 ) {
+                    batch_.push_back( packet_slice { block,
+                                                 static_cast<size_t>(res) } );
+                } else {
+                    if( res < 0 && errno != EAGAIN && errno != EINTR ) {
+                        report( errno );
+                    }
+                    break;
+                }
+            }
+
+            if( !batch_.empty( ) ) {
+                read_call_( &batch_[0], batch_.size( ) );
+            }
+            return batch_.size( );
+        }
+
+        /// returns the number of packets written
+        size_t write_packets( )
+        {
+            packet_ptr w;
+            while( incoming_.pop( w ) ) {
+                size_t len = w->size( );
+                backlog_.push( std::move( w ), len, false,
+                               &this_type::drop_packet );
+                --queued_;
+            }
+
+            size_t count = 0;
+            while( !backlog_.empty( ) ) {
+
+                backlog_.codel_dequeue( &this_type::drop_packet );
+                if( backlog_.empty( ) ) {
+                    break;
+                }
+
+                const packet_ptr &top( backlog_.front( ) );
+                ssize_t res = ::write( hdl_.get( ), top->data( ),
+                                       top->size( ) );
+                if( res < 0 ) {
+                    if( errno == EAGAIN || errno == EINTR ) {
+                        break;
+                    }
+                    /// the packet is lost; the device is still here
+                    report( errno );
+                }
+                backlog_.pop( );
+                ++count;
+            }
+            return count;
+        }
+
+        void sleep( )
+        {
+            sleeping_ = true;
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+
+            /// a writer could miss sleeping_; look once more
+            if( incoming_.empty( ) && running_ ) {
+
+                pollfd fds[2];
+                fds[0].fd      = wake_[0];
+                fds[0].events  = POLLIN;
+                fds[0].revents = 0;
+                fds[1].fd      = hdl_.get( );
+                fds[1].events  = ( reading_ ? POLLIN : 0 )
+                               | ( backlog_.empty( ) ? 0 : POLLOUT );
+                fds[1].revents = 0;
+
+                if( poll( fds, 2, -1 ) < 0 && errno != EINTR ) {
+                    report( errno );
+                }
+
+                if( fds[0].revents ) {
+                    clear_wake( );
+                }
+            }
+
+            sleeping_ = false;
+        }
+
+        void run( shared_type /*keeper*/ )
+        {
+            if( cpu_ >= 0 && !pin_thread( cpu_ ) ) {
+                report( errno ? errno : EINVAL );
+            }
+
+            auto last = clock_type::now( );
+
+            while( running_ ) {
+
+                size_t done = write_packets( );
+
+                if( reading_ ) {
+                    done += read_packets( );
+                }
+
+                if( done ) {
+                    last = clock_type::now( );
+                } else if( clock_type::now( ) - last < spin_ ) {
+                    cpu_relax( );
+                } else {
+                    sleep( );
+                    last = clock_type::now( );
+                }
+            }
+
+            /// the device is closed with the last reference to the queue;
+            /// write_through can be using it right now
+        }
+    };
+}
+
+    tuntap_queue_sptr create_thread_queue( boost::asio::io_service &,
+                                           device_info &hdl,
+                                           const queue_params &params )
+    {
+        auto inst = std::make_shared<thread_queue>( params );
+        if( !inst->init( hdl ) ) {
+            return tuntap_queue_sptr( );
+        }
+        return inst;
+    }
+
+}}
+
+#endif
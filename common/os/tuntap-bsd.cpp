@@ -7,7 +7,10 @@
 #include <iostream>
 
 #include <netinet/in.h>
+#include <net/if.h>
 #include <net/if_tun.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <netinet/ip.h>
 
 
@@ -18,6 +21,7 @@
 #include <netdb.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "../utilities.h"
 
@@ -62,6 +66,28 @@ namespace {
     }
 
 
+    int set_dev_mtu( const char *devname, std::uint32_t mtu )
+    {
+        struct ifreq ifr;
+        fd_keeper s;
+
+        memset( &ifr, 0, sizeof(ifr) );
+        strncpy( ifr.ifr_name, devname, IFNAMSIZ );
+
+        s.fd_ = socket( AF_INET, SOCK_DGRAM, 0 );
+
+        if( s.fd_ < 0 ) {
+            return -1;
+        }
+
+        ifr.ifr_mtu = static_cast<int>(mtu);
+
+        if( ioctl( s, SIOCSIFMTU, &ifr ) < 0 ) {
+            return -1;
+        }
+        return 0;
+    }
+
     int set_v4_params( native_handle /*device*/,
                        const char *devname,
                        std::uint32_t ip0,
@@ -138,6 +164,11 @@ namespace {
         return 0;
     }
 
+    int set_mtu( const std::string &name, std::uint32_t mtu )
+    {
+        return set_dev_mtu( name.c_str( ), mtu );
+    }
+
     device_info open_tun( const std::string &hint_name )
     {
         device_info res;
@@ -153,6 +184,25 @@ namespace {
         return std::move( res );
     }
 
+    device_info_list open_tun( const std::string &hint_name,
+                               const open_params &params ) /// one queue only
+    {
+        if( params.vnet_hdr ) {
+            throw std::runtime_error( "open_tun. vnet header "
+                                      "is not supported." );
+        }
+        device_info_list res;
+        res.emplace_back( open_tun( hint_name ) );
+
+        if( params.mtu && set_dev_mtu( res[0].name( ).c_str( ),
+                                       params.mtu ) < 0 )
+        {
+            throw_errno( "open_tun. ioctl(SIOCSIFMTU)" );
+        }
+
+        return res;
+    }
+
     int del_tun( const std::string &name )
     {
         std::ostringstream cmd;
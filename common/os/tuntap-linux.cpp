@@ -68,6 +68,28 @@ namespace {
         return 0;
     }
 
+    int set_dev_mtu( const char *devname, std::uint32_t mtu )
+    {
+        struct ifreq ifr;
+        fd_keeper s;
+
+        memset( &ifr, 0, sizeof(ifr) );
+        strncpy(ifr.ifr_name, devname, IFNAMSIZ);
+
+        s.fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+
+        if( s.fd_ < 0 ) {
+            return -1;
+        }
+
+        ifr.ifr_mtu = static_cast<int>(mtu);
+
+        if (ioctl(s, SIOCSIFMTU, &ifr) < 0 ) {
+            return -1;
+        }
+        return 0;
+    }
+
     int opentuntap( std::string &in_out, int flags, bool persis )
     {
         const char *clonedev = TUNTAP_DEVICE_NAME;
@@ -113,6 +135,22 @@ namespace {
         return fd;
     }
 
+    int set_vnet_offload( int fd )
+    {
+        int hdr_size = static_cast<int>(TUN_VNET_HDR_SIZE);
+
+        if( ioctl( fd, TUNSETVNETHDRSZ, &hdr_size ) < 0 ) {
+            return -1;
+        }
+
+        unsigned offload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+        if( ioctl( fd, TUNSETOFFLOAD, offload ) < 0 ) {
+            return -1;
+        }
+
+        return 0;
+    }
+
     int set_v4_param( const char *devname,
                       unsigned long code,
                       std::uint32_t param )
@@ -200,6 +238,11 @@ namespace {
         return set_dev_up( name.c_str( ) );
     }
 
+    int set_mtu( const std::string &name, std::uint32_t mtu )
+    {
+        return set_dev_mtu( name.c_str( ), mtu );
+    }
+
     device_info open_tun( const std::string &hint_name )
     {
         device_info res;
@@ -218,6 +261,59 @@ namespace {
         return std::move( res );
     }
 
+    device_info_list open_tun( const std::string &hint_name,
+                               const open_params &params )
+    {
+        device_info_list res;
+
+        const std::uint32_t queues = params.queues ? params.queues : 1;
+
+        int flags = IFF_TUN | IFF_NO_PI;
+
+        if( queues > 1 ) {
+#ifdef IFF_MULTI_QUEUE
+            flags |= IFF_MULTI_QUEUE;
+#else
+            throw std::runtime_error( "open_tun. "
+                                      "IFF_MULTI_QUEUE is not supported." );
+#endif
+        }
+
+        if( params.vnet_hdr ) {
+            flags |= IFF_VNET_HDR;
+        }
+
+        /// the first call resolves the name;
+        /// all other queues are attached to the same device
+        std::string name = hint_name;
+
+        res.reserve( queues );
+        for( std::uint32_t i = 0; i < queues; ++i ) {
+
+            auto hdl = opentuntap( name, flags, true );
+
+            if( hdl == common::TUN_HANDLE_INVALID_VALUE ) {
+                throw_errno( "open_tun." );
+            }
+
+            device_info next;
+            next.assign_name( name );
+            next.assign( hdl );
+
+            if( params.vnet_hdr && set_vnet_offload( hdl ) < 0 ) {
+                throw_errno( "open_tun. ioctl(TUNSETOFFLOAD)" );
+            }
+
+            res.emplace_back( std::move( next ) );
+        }
+
+        if( params.mtu && set_dev_mtu( name.c_str( ), params.mtu ) < 0 ) {
+            throw_errno( "open_tun. ioctl(SIOCSIFMTU)" );
+        }
+
+        return res;
+    }
+
     void close_handle( native_handle hdl )
     {
         ::close( hdl );
@@ -241,8 +337,17 @@ namespace {
         strncpy(ifr.ifr_name, name.c_str( ), IFNAMSIZ);
 
         if( ioctl( fd, TUNSETIFF, static_cast<void *>(&ifr) ) < 0 ) {
+#ifdef IFF_MULTI_QUEUE
+            /// multiqueue device can't be attached without the flag
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+            if( ioctl( fd, TUNSETIFF, static_cast<void *>(&ifr) ) < 0 ) {
+                close( fd );
+                return -1;
+            }
+#else
             close( fd );
             return -1;
+#endif
         }
 
         ioctl( fd, TUNSETPERSIST, 0 );
@@ -197,6 +197,23 @@ namespace {
         return std::move( res );
     }
 
+    device_info_list open_tun( const std::string &hint_name,
+                               const open_params &params ) /// one queue only
+    {
+        if( params.vnet_hdr ) {
+            throw std::runtime_error( "open_tun. vnet header "
+                                      "is not supported." );
+        }
+        device_info_list res;
+        res.emplace_back( open_tun( hint_name ) );
+
+        if( params.mtu ) {
+            set_mtu( res[0].name( ), params.mtu );
+        }
+
+        return res;
+    }
+
     tstring get_device( const tstring &hint, tstring &outname )
     {
         status_checker chker( "get_device" );
@@ -378,6 +395,22 @@ namespace {
     {
         return 0;
     }
+
+    int set_mtu( const std::string &name, std::uint32_t mtu )
+    {
+        std::ostringstream cmd;
+        auto ws = charset::make_ws_string( name, CP_UTF8 );
+        auto mb = charset::make_mb_string( ws );
+
+        using utilities::decorators::quote;
+
+        /// netsh interface ipv4 set subinterface "iface name" mtu=N
+        cmd << "netsh interface ipv4 set subinterface " << quote( mb, '"' )
+            << " mtu=" << mtu
+            << " store=active > NUL"
+               ;
+        return system( cmd.str( ).c_str( ) );
+    }
 }}
 
 
@@ -0,0 +1,649 @@
+#include "../tuntap-queue.h"
+
+#if defined(__linux__)
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define MSCTL_URING_SUPPORTED 1
+#endif
+
+namespace msctl { namespace common {
+
+#if defined(MSCTL_URING_SUPPORTED)
+
+namespace {
+
+    namespace ba = boost::asio;
+    namespace ph = std::placeholders;
+
+    using error_code = boost::system::error_code;
+
+    const std::uint64_t WRITE_TAG       = 1ULL << 63;
+    const size_t        MIN_WRITE_SLOTS = 64;
+
+    int sys_setup( unsigned entries, io_uring_params *p )
+    {
+        return static_cast<int>(syscall( __NR_io_uring_setup, entries, p ));
+    }
+
+    int sys_enter( int fd, unsigned submit )
+    {
+        return static_cast<int>(syscall( __NR_io_uring_enter, fd,
+                                         submit, 0, 0, nullptr, 0 ));
+    }
+
+    int sys_register( int fd, unsigned opcode, const void *arg, unsigned nr )
+    {
+        return static_cast<int>(syscall( __NR_io_uring_register,
+                                         fd, opcode, arg, nr ));
+    }
+
+    template <typename T>
+    T load_acquire( const T *ptr )
+    {
+        return __atomic_load_n( ptr, __ATOMIC_ACQUIRE );
+    }
+
+    template <typename T>
+    void store_release( T *ptr, T value )
+    {
+        __atomic_store_n( ptr, value, __ATOMIC_RELEASE );
+    }
+
+    void *map_ring( int fd, size_t len, off_t offset )
+    {
+        void *res = mmap( nullptr, len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, offset );
+        return ( res == MAP_FAILED ) ? nullptr : res;
+    }
+
+    /// plain io_uring; sq is used from one strand only
+    class ring {
+
+        int              fd_       = -1;
+
+        void            *sq_ptr_   = nullptr;
+        void            *cq_ptr_   = nullptr;
+        size_t           sq_len_   = 0;
+        size_t           cq_len_   = 0;
+
+        io_uring_sqe    *sqes_     = nullptr;
+        size_t           sqes_len_ = 0;
+
+        unsigned        *sq_head_  = nullptr;
+        unsigned        *sq_tail_  = nullptr;
+        unsigned        *sq_array_ = nullptr;
+        unsigned         sq_mask_  = 0;
+        unsigned         sq_size_  = 0;
+        unsigned         sq_local_ = 0;
+
+        unsigned        *cq_head_  = nullptr;
+        unsigned        *cq_tail_  = nullptr;
+        io_uring_cqe    *cqes_     = nullptr;
+        unsigned         cq_mask_  = 0;
+
+    public:
+
+        ring( )                          = default;
+        ring( const ring & )             = delete;
+        ring &operator = ( const ring & ) = delete;
+
+        ~ring( )
+        {
+            destroy( );
+        }
+
+        int fd( ) const
+        {
+            return fd_;
+        }
+
+        bool init( unsigned entries )
+        {
+            io_uring_params p;
+            memset( &p, 0, sizeof(p) );
+
+            fd_ = sys_setup( entries, &p );
+            if( fd_ < 0 ) {
+                return false;
+            }
+
+            sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_len_ = p.cq_off.cqes  + p.cq_entries * sizeof(io_uring_cqe);
+
+            const bool single = !!(p.features & IORING_FEAT_SINGLE_MMAP);
+            if( single ) {
+                sq_len_ = cq_len_ = std::max( sq_len_, cq_len_ );
+            }
+
+            sq_ptr_ = map_ring( fd_, sq_len_, IORING_OFF_SQ_RING );
+            if( !sq_ptr_ ) {
+                return false;
+            }
+
+            cq_ptr_ = single ? sq_ptr_
+                             : map_ring( fd_, cq_len_, IORING_OFF_CQ_RING );
+            if( !cq_ptr_ ) {
+                return false;
+            }
+
+            sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe *>(
+                        map_ring( fd_, sqes_len_, IORING_OFF_SQES ) );
+            if( !sqes_ ) {
+                return false;
+            }
+
+            auto sq = static_cast<char *>(sq_ptr_);
+            sq_head_  = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+            sq_tail_  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            sq_mask_  = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            sq_size_  = p.sq_entries;
+            sq_local_ = *sq_tail_;
+
+            auto cq = static_cast<char *>(cq_ptr_);
+            cq_head_  = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            cq_tail_  = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            cqes_     = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+            cq_mask_  = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+
+            return true;
+        }
+
+        void destroy( )
+        {
+            if( sqes_ ) {
+                munmap( sqes_, sqes_len_ );
+                sqes_ = nullptr;
+            }
+            if( cq_ptr_ && cq_ptr_ != sq_ptr_ ) {
+                munmap( cq_ptr_, cq_len_ );
+            }
+            cq_ptr_ = nullptr;
+            if( sq_ptr_ ) {
+                munmap( sq_ptr_, sq_len_ );
+                sq_ptr_ = nullptr;
+            }
+            if( fd_ >= 0 ) {
+                ::close( fd_ );
+                fd_ = -1;
+            }
+        }
+
+        int register_call( unsigned opcode, const void *arg, unsigned nr )
+        {
+            return sys_register( fd_, opcode, arg, nr );
+        }
+
+        io_uring_sqe *get_sqe( )
+        {
+            if( sq_local_ - load_acquire( sq_head_ ) >= sq_size_ ) {
+                return nullptr;
+            }
+            unsigned id = sq_local_ & sq_mask_;
+            io_uring_sqe *sqe = &sqes_[id];
+            memset( sqe, 0, sizeof(*sqe) );
+            sq_array_[id] = id;
+            ++sq_local_;
+            return sqe;
+        }
+
+        /// one syscall for everything prepared since the last submit
+        int submit( )
+        {
+            unsigned count = sq_local_ - *sq_tail_;
+            if( count == 0 ) {
+                return 0;
+            }
+            store_release( sq_tail_, sq_local_ );
+            return sys_enter( fd_, count );
+        }
+
+        template <typename Call>
+        size_t reap( Call call )
+        {
+            size_t   res  = 0;
+            unsigned head = *cq_head_;
+            unsigned tail = load_acquire( cq_tail_ );
+            while( head != tail ) {
+                call( cqes_[head & cq_mask_] );
+                ++head;
+                ++res;
+            }
+            store_release( cq_head_, head );
+            return res;
+        }
+    };
+
+    /// registered memory for all read and write slots;
+    /// it is mmap-ed so the pages are never reused by the heap
+    class slot_memory {
+
+        char   *ptr_ = nullptr;
+        size_t  len_ = 0;
+
+    public:
+
+        slot_memory( )                                 = default;
+        slot_memory( const slot_memory & )             = delete;
+        slot_memory &operator = ( const slot_memory & ) = delete;
+
+        ~slot_memory( )
+        {
+            if( ptr_ ) {
+                munmap( ptr_, len_ );
+            }
+        }
+
+        bool init( size_t len )
+        {
+            void *res = mmap( nullptr, len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if( res == MAP_FAILED ) {
+                return false;
+            }
+            ptr_ = static_cast<char *>(res);
+            len_ = len;
+            return true;
+        }
+
+        char *data( )
+        {
+            return ptr_;
+        }
+
+        size_t size( ) const
+        {
+            return len_;
+        }
+    };
+
+    class uring_queue: public tuntap_queue,
+                       public std::enable_shared_from_this<uring_queue> {
+
+        using this_type   = uring_queue;
+        using shared_type = std::shared_ptr<this_type>;
+
+        ba::io_service               &ios_;
+        ba::io_service::strand        dispatcher_;
+        ba::posix::stream_descriptor  event_;
+        device_info                   hdl_;
+
+        /// memory has to outlive the ring
+        slot_memory                   memory_;
+        ring                          ring_;
+
+        size_t                        block_;
+        size_t                        read_slots_;
+        size_t                        write_slots_;
+
+        std::vector<size_t>           free_writes_;
+        aqm_queue<packet_ptr>         backlog_;
+
+        std::vector<packet_slice>     batch_;
+        std::vector<size_t>           done_reads_;
+
+        mpsc_ring<packet_ptr>         incoming_;
+        std::atomic<bool>             flush_posted_;
+
+        /// packets longer than a slot; they can't be written
+        std::atomic<std::uint64_t>    oversize_drops_;
+        std::atomic<std::uint64_t>    oversize_bytes_;
+
+        bool                          active_ = true;
+
+    public:
+
+        uring_queue( ba::io_service &ios, const queue_params &params )
+            :ios_(ios)
+            ,dispatcher_(ios_)
+            ,event_(ios_)
+            ,block_(params.block_size)
+            ,read_slots_(params.read_budget ? params.read_budget : 1)
+            ,write_slots_(std::max( read_slots_, MIN_WRITE_SLOTS ))
+            ,incoming_(incoming_ring_size( params.limits ))
+            ,flush_posted_(false)
+            ,oversize_drops_(0)
+            ,oversize_bytes_(0)
+        {
+            batch_.reserve( read_slots_ );
+            done_reads_.reserve( read_slots_ );
+            free_writes_.reserve( write_slots_ );
+            for( size_t i = 0; i < write_slots_; ++i ) {
+                free_writes_.push_back( i );
+            }
+            backlog_.set_limits( params.limits );
+        }
+
+        bool init( device_info &hdl )
+        {
+            const size_t slots = read_slots_ + write_slots_;
+
+            if( !ring_.init( static_cast<unsigned>(slots) ) ) {
+                return false;
+            }
+
+            if( !memory_.init( slots * block_ ) ) {
+                return false;
+            }
+
+            iovec iov;
+            iov.iov_base = memory_.data( );
+            iov.iov_len  = memory_.size( );
+            if( ring_.register_call( IORING_REGISTER_BUFFERS, &iov, 1 ) < 0 ) {
+                return false;
+            }
+
+            int fds[1] = { hdl.get( ) };
+            if( ring_.register_call( IORING_REGISTER_FILES, fds, 1 ) < 0 ) {
+                return false;
+            }
+
+            int efd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+            if( efd < 0 ) {
+                return false;
+            }
+            event_.assign( efd );
+
+            if( ring_.register_call( IORING_REGISTER_EVENTFD, &efd, 1 ) < 0 ) {
+                return false;
+            }
+
+            /// io_uring polls the blocking fd itself;
+            /// O_NONBLOCK would give us -EAGAIN completions
+            int flags = fcntl( hdl.get( ), F_GETFL, 0 );
+            if( flags >= 0 ) {
+                fcntl( hdl.get( ), F_SETFL, flags & ~O_NONBLOCK );
+            }
+
+            hdl_ = std::move( hdl );
+            return true;
+        }
+
+        void start_read( ) override
+        {
+            dispatcher_.post( std::bind( &this_type::start_read_impl, this,
+                                         shared_from_this( ) ) );
+        }
+
+        void write( const char *data, size_t length ) override
+        {
+            if( length > block_ ) {
+                oversize_drops_.fetch_add( 1, std::memory_order_relaxed );
+                oversize_bytes_.fetch_add( length,
+                                           std::memory_order_relaxed );
+                return;
+            }
+
+            if( !incoming_.push( make_packet( data, length ) ) ) {
+                return;
+            }
+
+            if( !flush_posted_.exchange( true ) ) {
+                dispatcher_.post( std::bind( &this_type::flush_writes, this,
+                                             shared_from_this( ) ) );
+            }
+        }
+
+        void close( ) override
+        {
+            dispatcher_.post( std::bind( &this_type::close_impl, this,
+                                         shared_from_this( ) ) );
+        }
+
+        const char *backend_name( ) const override
+        {
+            return "uring";
+        }
+
+        queue_stat write_queue_stat( ) const override
+        {
+            queue_stat res = backlog_.stat( );
+            res.tail_drops    += incoming_.drops( );
+            res.tail_drops    += oversize_drops_.load( );
+            res.dropped_bytes += oversize_bytes_.load( );
+            return res;
+        }
+
+    private:
+
+        static void drop_packet( packet_ptr & )
+        { }
+
+        char *slot_data( size_t slot )
+        {
+            return memory_.data( ) + slot * block_;
+        }
+
+        char *write_slot_data( size_t slot )
+        {
+            return slot_data( read_slots_ + slot );
+        }
+
+        void close_impl( shared_type )
+        {
+            if( active_ ) {
+                active_ = false;
+                error_code ec;
+                event_.close( ec );
+                ring_.destroy( );
+                hdl_.assign( TUN_HANDLE_INVALID_VALUE );
+            }
+        }
+
+        void start_read_impl( shared_type )
+        {
+            for( size_t i = 0; i < read_slots_; ++i ) {
+                prep_read( i );
+            }
+            submit( );
+            wait_events( );
+        }
+
+        void prep_read( size_t slot )
+        {
+            io_uring_sqe *sqe = ring_.get_sqe( );
+            if( sqe ) {
+                sqe->opcode    = IORING_OP_READ_FIXED;
+                sqe->flags     = IOSQE_FIXED_FILE;
+                sqe->fd        = 0;
+                sqe->addr      = reinterpret_cast<std::uint64_t>(
+                                                        slot_data( slot ) );
+                sqe->len       = static_cast<std::uint32_t>(block_);
+                sqe->buf_index = 0;
+                sqe->user_data = slot;
+            }
+        }
+
+        /// writes of one submission are linked; the device gets them
+        /// in the same order as they were posted
+        void prep_writes( )
+        {
+#if defined(IOSQE_IO_HARDLINK)
+            const std::uint8_t link = IOSQE_IO_HARDLINK;
+#else
+            const std::uint8_t link = IOSQE_IO_LINK;
+#endif
+            io_uring_sqe *last = nullptr;
+
+            while( !backlog_.empty( ) && !free_writes_.empty( ) ) {
+
+                backlog_.codel_dequeue( &this_type::drop_packet );
+                if( backlog_.empty( ) ) {
+                    break;
+                }
+
+                io_uring_sqe *sqe = ring_.get_sqe( );
+                if( !sqe ) {
+                    break;
+                }
+
+                size_t slot = free_writes_.back( );
+                free_writes_.pop_back( );
+
+                const packet_ptr &top( backlog_.front( ) );
+                char *dst = write_slot_data( slot );
+                memcpy( dst, top->data( ), top->size( ) );
+
+                sqe->opcode    = IORING_OP_WRITE_FIXED;
+                sqe->flags     = IOSQE_FIXED_FILE;
+                sqe->fd        = 0;
+                sqe->addr      = reinterpret_cast<std::uint64_t>(dst);
+                sqe->len       = static_cast<std::uint32_t>(top->size( ));
+                sqe->buf_index = 0;
+                sqe->user_data = WRITE_TAG | slot;
+
+                if( last ) {
+                    last->flags |= link;
+                }
+                last = sqe;
+
+                backlog_.pop( );
+            }
+        }
+
+        void submit( )
+        {
+            if( ring_.submit( ) < 0 && error_call_ ) {
+                error_call_( error_code( errno,
+                                         boost::system::system_category( ) ) );
+            }
+        }
+
+        void flush_writes( shared_type )
+        {
+            /// a producer that comes after this store posts again
+            flush_posted_ = false;
+
+            packet_ptr w;
+            while( incoming_.pop( w ) ) {
+                /// nothing is in flight in the backlog;
+                /// any packet can be dropped
+                if( active_ ) {
+                    size_t len = w->size( );
+                    backlog_.push( std::move( w ), len, false,
+                                   &this_type::drop_packet );
+                }
+            }
+
+            if( !active_ ) {
+                return;
+            }
+
+            prep_writes( );
+            submit( );
+        }
+
+        void wait_events( )
+        {
+            event_.async_read_some( ba::null_buffers( ),
+                dispatcher_.wrap(
+                    std::bind( &this_type::on_event, this,
+                               ph::_1, shared_from_this( ) ) ) );
+        }
+
+        void on_event( const error_code &err, shared_type )
+        {
+            if( err ) {
+                if( active_ && error_call_ ) {
+                    error_call_( err );
+                }
+                return;
+            }
+
+            std::uint64_t counter = 0;
+            if( ::read( event_.native_handle( ),
+                        &counter, sizeof(counter) ) < 0 )
+            {
+                /// nothing; completions are reaped anyway
+            }
+
+            process_completions( );
+
+            if( active_ ) {
+                wait_events( );
+            }
+        }
+
+        void on_cqe( const io_uring_cqe &cqe )
+        {
+            if( cqe.user_data & WRITE_TAG ) {
+                free_writes_.push_back(
+                            static_cast<size_t>(cqe.user_data & ~WRITE_TAG) );
+                return;
+            }
+
+            auto slot = static_cast<size_t>(cqe.user_data);
+
+            if( cqe.res > 0 ) {
+                batch_.push_back( packet_slice { slot_data( slot ),
+                                  static_cast<size_t>(cqe.res) } );
+                done_reads_.push_back( slot );
+            } else if( cqe.res == -EAGAIN || cqe.res == -EINTR ) {
+                done_reads_.push_back( slot );
+            } else if( error_call_ ) {
+                error_call_( error_code( -cqe.res,
+                                         boost::system::system_category( ) ) );
+            }
+        }
+
+        void process_completions( )
+        {
+            batch_.clear( );
+            done_reads_.clear( );
+
+            ring_.reap( [this]( const io_uring_cqe &cqe ) { on_cqe( cqe ); } );
+
+            if( !batch_.empty( ) ) {
+                read_call_( &batch_[0], batch_.size( ) );
+            }
+
+            /// slots are free now; read them again
+            for( auto slot: done_reads_ ) {
+                prep_read( slot );
+            }
+
+            prep_writes( );
+            submit( );
+        }
+    };
+}
+
+    tuntap_queue_sptr create_uring_queue( boost::asio::io_service &ios,
+                                          device_info &hdl,
+                                          const queue_params &params )
+    {
+        auto inst = std::make_shared<uring_queue>( ios, params );
+        if( !inst->init( hdl ) ) {
+            return tuntap_queue_sptr( );
+        }
+        return inst;
+    }
+
+#else
+
+    tuntap_queue_sptr create_uring_queue( boost::asio::io_service &,
+                                          device_info &,
+                                          const queue_params & )
+    {
+        return tuntap_queue_sptr( );
+    }
+
+#endif
+
+}}
+
+#endif
@@ -0,0 +1,206 @@
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "packet-pool.h"
+
+namespace msctl { namespace common {
+
+namespace {
+
+    /// free buffers per thread
+    const size_t small_max_free = 1024;
+    const size_t large_max_free = 32;
+
+    struct pool_registry {
+        std::mutex                  lock;
+        std::vector<packet_pool *>  pools;
+    };
+
+    pool_registry &registry( )
+    {
+        static pool_registry inst;
+        return inst;
+    }
+
+    struct oversize_counter {
+        std::atomic<std::uint64_t> value;
+        oversize_counter( )
+            :value(0)
+        { }
+    };
+
+    oversize_counter &oversize( )
+    {
+        static oversize_counter inst;
+        return inst;
+    }
+
+    THREAD_LOCAL packet_pool *s_small_pool = nullptr;
+    THREAD_LOCAL packet_pool *s_large_pool = nullptr;
+}
+
+    //////////// packet_buffer
+
+    packet_buffer *packet_buffer::create( packet_pool *owner, size_t capacity )
+    {
+        void *mem = ::operator new( sizeof(packet_buffer) + capacity );
+        return new (mem) packet_buffer( owner, capacity );
+    }
+
+    void packet_buffer::destroy( packet_buffer *buf )
+    {
+        buf->~packet_buffer( );
+        ::operator delete( buf );
+    }
+
+    void packet_buffer::release( )
+    {
+        if( refs_.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+            if( owner_ ) {
+                owner_->put( this );
+            } else {
+                destroy( this );
+            }
+        }
+    }
+
+    //////////// packet_pool
+
+    packet_pool::packet_pool( size_t block, size_t max_free )
+        :block_(block)
+        ,max_free_(max_free)
+        ,returned_(nullptr)
+        ,hits_(0)
+        ,misses_(0)
+        ,remote_(0)
+    {
+        auto &reg(registry( ));
+        std::lock_guard<std::mutex> lck(reg.lock);
+        reg.pools.push_back( this );
+    }
+
+    packet_pool *packet_pool::local( size_t length )
+    {
+        if( length <= small_block ) {
+            if( !s_small_pool ) {
+                s_small_pool = new packet_pool( small_block, small_max_free );
+            }
+            return s_small_pool;
+        } else if( length <= large_block ) {
+            if( !s_large_pool ) {
+                s_large_pool = new packet_pool( large_block, large_max_free );
+            }
+            return s_large_pool;
+        }
+        return nullptr;
+    }
+
+    packet_pool::stat packet_pool::total_stat( )
+    {
+        stat res;
+        auto &reg(registry( ));
+        std::lock_guard<std::mutex> lck(reg.lock);
+        for( auto p: reg.pools ) {
+            res.hits   += p->hits_.load( std::memory_order_relaxed );
+            res.misses += p->misses_.load( std::memory_order_relaxed );
+            res.remote += p->remote_.load( std::memory_order_relaxed );
+        }
+        res.oversize = oversize( ).value.load( std::memory_order_relaxed );
+        return res;
+    }
+
+    packet_ptr packet_pool::get( )
+    {
+        if( !free_ ) {
+            /// take everything other threads gave back
+            free_ = returned_.exchange( nullptr, std::memory_order_acquire );
+            trim( );
+        }
+
+        packet_buffer *buf = free_;
+        if( buf ) {
+            free_ = buf->next_;
+            --free_count_;
+            buf->next_ = nullptr;
+            buf->size_ = 0;
+            hits_.fetch_add( 1, std::memory_order_relaxed );
+        } else {
+            buf = packet_buffer::create( this, block_ );
+            misses_.fetch_add( 1, std::memory_order_relaxed );
+        }
+        return packet_ptr( buf );
+    }
+
+    void packet_pool::put( packet_buffer *buf )
+    {
+        const bool local_thread = ( this == s_small_pool )
+                               || ( this == s_large_pool );
+        if( local_thread ) {
+            if( free_count_ >= max_free_ ) {
+                packet_buffer::destroy( buf );
+            } else {
+                buf->next_ = free_;
+                free_      = buf;
+                ++free_count_;
+            }
+        } else {
+            remote_.fetch_add( 1, std::memory_order_relaxed );
+            buf->next_ = returned_.load( std::memory_order_relaxed );
+            while( !returned_.compare_exchange_weak( buf->next_, buf,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed ) )
+            { }
+        }
+    }
+
+    /// free_ has the list taken from returned_; count it and cut the tail
+    void packet_pool::trim( )
+    {
+        size_t count = 0;
+        packet_buffer *last = nullptr;
+        packet_buffer *next = free_;
+
+        while( next && count < max_free_ ) {
+            last = next;
+            next = next->next_;
+            ++count;
+        }
+
+        if( last ) {
+            last->next_ = nullptr;
+        }
+
+        while( next ) {
+            packet_buffer *tmp = next->next_;
+            packet_buffer::destroy( next );
+            next = tmp;
+        }
+
+        free_count_ = count;
+    }
+
+    //////////// helpers
+
+    packet_ptr make_packet( size_t length )
+    {
+        auto pool = packet_pool::local( length );
+        packet_ptr res;
+        if( pool ) {
+            res = pool->get( );
+        } else {
+            oversize( ).value.fetch_add( 1, std::memory_order_relaxed );
+            res = packet_ptr( packet_buffer::create( nullptr, length ) );
+        }
+        res->resize( length );
+        return res;
+    }
+
+    packet_ptr make_packet( const char *data, size_t length )
+    {
+        auto res = make_packet( length );
+        std::memcpy( res->data( ), data, length );
+        return res;
+    }
+
+}}
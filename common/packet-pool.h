@@ -0,0 +1,215 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+namespace msctl { namespace common {
+
+    class packet_pool;
+    class packet_ptr;
+
+    /// uninitialized packet; pooled if length fits a block
+    packet_ptr make_packet( size_t length );
+
+    /// buffer for one packet; header and data are one allocation
+    class packet_buffer {
+
+        friend class packet_pool;
+        friend class packet_ptr;
+        friend packet_ptr make_packet( size_t length );
+
+        std::atomic<std::uint32_t>  refs_;
+        packet_pool                *owner_;
+        packet_buffer              *next_;
+        size_t                      capacity_;
+        size_t                      size_;
+
+        packet_buffer( packet_pool *owner, size_t capacity )
+            :refs_(0)
+            ,owner_(owner)
+            ,next_(nullptr)
+            ,capacity_(capacity)
+            ,size_(0)
+        { }
+
+        static packet_buffer *create( packet_pool *owner, size_t capacity );
+        static void destroy( packet_buffer *buf );
+
+        void release( );
+
+    public:
+
+        char *data( )
+        {
+            return reinterpret_cast<char *>(this + 1);
+        }
+
+        const char *data( ) const
+        {
+            return reinterpret_cast<const char *>(this + 1);
+        }
+
+        size_t size( ) const
+        {
+            return size_;
+        }
+
+        size_t capacity( ) const
+        {
+            return capacity_;
+        }
+
+        /// doesn't allocate; length has to be <= capacity
+        void resize( size_t length )
+        {
+            size_ = length;
+        }
+
+        void assign( const char *data, size_t length )
+        {
+            std::memcpy( this->data( ), data, length );
+            size_ = length;
+        }
+    };
+
+    /// intrusive pointer; copies don't allocate
+    class packet_ptr {
+
+        packet_buffer *buf_ = nullptr;
+
+        void reset_impl( )
+        {
+            if( buf_ ) {
+                buf_->release( );
+                buf_ = nullptr;
+            }
+        }
+
+    public:
+
+        packet_ptr( ) = default;
+
+        explicit packet_ptr( packet_buffer *buf )
+            :buf_(buf)
+        {
+            if( buf_ ) {
+                buf_->refs_.fetch_add( 1, std::memory_order_relaxed );
+            }
+        }
+
+        packet_ptr( const packet_ptr &other )
+            :packet_ptr(other.buf_)
+        { }
+
+        packet_ptr( packet_ptr &&other )
+            :buf_(other.buf_)
+        {
+            other.buf_ = nullptr;
+        }
+
+        packet_ptr &operator = ( packet_ptr other )
+        {
+            std::swap( buf_, other.buf_ );
+            return *this;
+        }
+
+        ~packet_ptr( )
+        {
+            reset_impl( );
+        }
+
+        void reset( )
+        {
+            reset_impl( );
+        }
+
+        packet_buffer *get( ) const
+        {
+            return buf_;
+        }
+
+        packet_buffer *operator -> ( ) const
+        {
+            return buf_;
+        }
+
+        packet_buffer &operator * ( ) const
+        {
+            return *buf_;
+        }
+
+        explicit operator bool ( ) const
+        {
+            return buf_ != nullptr;
+        }
+
+        /// true if nobody else holds the buffer
+        bool unique( ) const
+        {
+            return buf_ && buf_->refs_.load( std::memory_order_acquire ) == 1;
+        }
+    };
+
+    /// free lists of one size class for one thread.
+    /// Only the owner thread takes buffers from the pool; other threads
+    /// return them through a lock-free list that the owner picks up
+    /// when its own list is empty.
+    /// Pools are never destroyed: buffers can outlive their thread.
+    class packet_pool {
+
+        friend class packet_buffer;
+
+    public:
+
+        struct stat {
+            std::uint64_t hits     = 0; /// taken from a free list
+            std::uint64_t misses   = 0; /// allocated
+            std::uint64_t remote   = 0; /// returned by other threads
+            std::uint64_t oversize = 0; /// too big for any pool
+        };
+
+        static const size_t small_block = 4 * 1024;
+        static const size_t large_block = 68 * 1024;
+
+        /// pool of the current thread that fits the length
+        static packet_pool *local( size_t length );
+
+        /// sum of all pools of all threads
+        static stat total_stat( );
+
+        packet_ptr get( );
+
+        size_t block_size( ) const
+        {
+            return block_;
+        }
+
+    private:
+
+        packet_pool( size_t block, size_t max_free );
+
+        void put( packet_buffer *buf );
+        void trim( );
+
+        const size_t                  block_;
+        const size_t                  max_free_;
+
+        packet_buffer                *free_       = nullptr;
+        size_t                        free_count_ = 0;
+
+        std::atomic<packet_buffer *>  returned_;
+
+        std::atomic<std::uint64_t>    hits_;
+        std::atomic<std::uint64_t>    misses_;
+        std::atomic<std::uint64_t>    remote_;
+    };
+
+    packet_ptr make_packet( const char *data, size_t length );
+
+}}
+
+#endif // PACKET_POOL_H
@@ -0,0 +1,114 @@
+#include <algorithm>
+
+#include "reorder-buffer.h"
+
+namespace msctl { namespace common {
+
+    reorder_buffer::reorder_buffer( size_t depth, std::uint32_t max_wait_ms )
+        :depth_(depth)
+        ,max_wait_(std::chrono::milliseconds(max_wait_ms))
+    { }
+
+    reorder_buffer::verdict reorder_buffer::accept( std::uint32_t seq,
+                                                    const packet_cb &cb )
+    {
+        const std::uint64_t num = window_.extend( seq );
+
+        if( !window_.fresh( num ) ) {
+            if( num == 0 || window_.too_old( num ) ) {
+                ++stat_.late_drops;
+            } else {
+                ++stat_.duplicates;
+            }
+            return SEQ_DROP;
+        }
+
+        ++stat_.frames;
+        if( num < window_.top( ) ) {
+            ++stat_.reordered;
+        }
+        window_.mark( num );
+
+        if( depth_ == 0 ) {
+            return SEQ_PASS;
+        }
+
+        if( num == next_ ) {
+            next_ = num + 1;
+            return SEQ_PASS;
+        }
+
+        /// its gap is given up already
+        if( num < next_ ) {
+            return SEQ_PASS;
+        }
+
+        /// no room; the first gap goes and its held run with it
+        if( held_.size( ) >= depth_ ) {
+            ++stat_.gaps;
+            if( num < held_.begin( )->first ) {
+                next_ = num + 1;
+                return SEQ_PASS;
+            }
+            next_ = held_.begin( )->first;
+            release_ready( cb );
+            if( num == next_ ) {
+                next_ = num + 1;
+                return SEQ_PASS;
+            }
+        }
+
+        held_[num].time = clock_type::now( );
+        current_ = num;
+
+        ++stat_.held;
+        if( held_.size( ) > stat_.max_depth ) {
+            stat_.max_depth = held_.size( );
+        }
+        return SEQ_HOLD;
+    }
+
+    void reorder_buffer::hold( const char *data, size_t len )
+    {
+        auto f = held_.find( current_ );
+        if( f != held_.end( ) ) {
+            f->second.packets.emplace_back( data, len );
+        }
+    }
+
+    void reorder_buffer::release_ready( const packet_cb &cb )
+    {
+        while( !held_.empty( ) && held_.begin( )->first <= next_ ) {
+            auto f = held_.begin( );
+            for( auto &p: f->second.packets ) {
+                cb( p.data( ), p.size( ) );
+            }
+            next_ = std::max( next_, f->first + 1 );
+            held_.erase( f );
+        }
+    }
+
+    void reorder_buffer::release( const packet_cb &cb )
+    {
+        const auto now = clock_type::now( );
+
+        for( ;; ) {
+            release_ready( cb );
+
+            bool expired = false;
+            for( auto &h: held_ ) {
+                if( now - h.second.time >= max_wait_ ) {
+                    expired = true;
+                    break;
+                }
+            }
+
+            if( !expired ) {
+                break;
+            }
+            next_ = held_.begin( )->first;
+            ++stat_.gaps;
+        }
+    }
+
+}}
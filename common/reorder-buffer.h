@@ -0,0 +1,100 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "replay-window.h"
+
+namespace msctl { namespace common {
+
+    /// frames of one datagram peer by their sequence numbers
+    struct reorder_stat {
+
+        std::uint64_t frames     = 0;   /// accepted
+        std::uint64_t reordered  = 0;   /// came after a bigger number
+        std::uint64_t duplicates = 0;
+        std::uint64_t late_drops = 0;   /// behind the window
+        std::uint64_t held       = 0;   /// waited for a gap
+        std::uint64_t gaps       = 0;   /// gaps given up
+        std::uint64_t max_depth  = 0;   /// frames held at once
+    };
+
+    /// a frame is accepted once; a frame after a gap can be held until
+    /// the gap is filled, up to depth frames and max_wait. The packets of
+    /// a held frame are held with it and go in the order of the numbers.
+    /// Numbers start at 1, a lost first frame is a gap too.
+    /// depth 0 - frames are checked and never held
+    class reorder_buffer {
+
+        using clock_type = std::chrono::steady_clock;
+
+        struct frame {
+            clock_type::time_point   time;
+            std::vector<std::string> packets;
+        };
+
+        replay_window                   window_;
+        std::map<std::uint64_t, frame>  held_;
+        std::uint64_t                   next_    = 1;  /// the first is 1
+        std::uint64_t                   current_ = 0;
+        size_t                          depth_;
+        clock_type::duration            max_wait_;
+        reorder_stat                    stat_;
+
+    public:
+
+        enum verdict {
+            SEQ_PASS = 0,   /// the frame goes now
+            SEQ_HOLD = 1,   /// packets of the frame go to hold( )
+            SEQ_DROP = 2,   /// a duplicate or too old
+        };
+
+        using packet_cb = std::function<void (const char *, size_t)>;
+
+    private:
+
+        /// the held frames from next_ on without a gap
+        void release_ready( const packet_cb &cb );
+
+    public:
+
+        reorder_buffer( size_t depth = 0, std::uint32_t max_wait_ms = 0 );
+
+        /// the sequence number of a frame; its low 32 bits. A frame that
+        /// finds no room gives up the first gap; the held frames after
+        /// it go to cb before the frame
+        verdict accept( std::uint32_t seq, const packet_cb &cb );
+
+        /// a packet of the frame accept( ) has held
+        void hold( const char *data, size_t len );
+
+        /// packets that can go now in order. A gap that is older than
+        /// max_wait or leaves no room for the next frame is given up
+        void release( const packet_cb &cb );
+
+        /// frames are held
+        bool holding( ) const
+        {
+            return !held_.empty( );
+        }
+
+        size_t depth( ) const
+        {
+            return depth_;
+        }
+
+        const reorder_stat &stat( ) const
+        {
+            return stat_;
+        }
+    };
+
+}}
+
+#endif // REORDER_BUFFER_H
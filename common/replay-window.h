@@ -0,0 +1,67 @@
+#ifndef REPLAY_WINDOW_H
+#define REPLAY_WINDOW_H
+
+#include <cstdint>
+
+namespace msctl { namespace common {
+
+    /// counters of a datagram peer that are seen once; a datagram can
+    /// come late for replay_window::size counters. 0 is not a counter
+    class replay_window {
+
+        std::uint64_t top_  = 0;
+        std::uint64_t mask_ = 0;    /// bit N - top_ - N is seen
+
+    public:
+
+        static const std::uint64_t size = 64;
+
+        /// the counter is new and not too old
+        bool fresh( std::uint64_t counter ) const
+        {
+            if( counter == 0 ) {
+                return false;
+            } else if( counter > top_ ) {
+                return true;
+            }
+            const std::uint64_t back = top_ - counter;
+            return ( back < size ) && !( mask_ & ( std::uint64_t(1) << back ) );
+        }
+
+        /// the counter is behind the window
+        bool too_old( std::uint64_t counter ) const
+        {
+            return counter <= top_ && top_ - counter >= size;
+        }
+
+        void mark( std::uint64_t counter )
+        {
+            if( counter > top_ ) {
+                const std::uint64_t shift = counter - top_;
+                mask_ = ( shift < size ) ? ( mask_ << shift ) : 0;
+                mask_ |= 1;
+                top_   = counter;
+            } else {
+                mask_ |= std::uint64_t(1) << ( top_ - counter );
+            }
+        }
+
+        /// the biggest counter seen
+        std::uint64_t top( ) const
+        {
+            return top_;
+        }
+
+        /// the full counter of its low 32 bits; the one nearest to the top
+        std::uint64_t extend( std::uint32_t low ) const
+        {
+            const std::int64_t diff = static_cast<std::int32_t>(
+                                low - static_cast<std::uint32_t>(top_) );
+            const std::int64_t res  = static_cast<std::int64_t>(top_) + diff;
+            return res > 0 ? static_cast<std::uint64_t>(res) : 0;
+        }
+    };
+
+}}
+
+#endif // REPLAY_WINDOW_H
@@ -0,0 +1,214 @@
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include "tuntap-queue.h"
+
+namespace msctl { namespace common {
+
+namespace {
+
+    class asio_queue: public tuntap_transport, public tuntap_queue {
+
+        using parent_type = tuntap_transport;
+        using shared_type = parent_type::shared_type;
+
+        /// writers don't post to the strand one by one;
+        /// the first one posts a flush for all of them
+        mpsc_ring<packet_ptr>   incoming_;
+        std::atomic<bool>       flush_posted_;
+        std::atomic<size_t>     queued_;   /// in the ring
+
+    public:
+
+        asio_queue( boost::asio::io_service &ios, const queue_params &params )
+            :parent_type( ios, params.block_size,
+                          parent_type::OPT_DISPATCH_READ )
+            ,incoming_(incoming_ring_size( params.limits ))
+            ,flush_posted_(false)
+            ,queued_(0)
+        {
+            set_read_budget( params.read_budget );
+            set_queue_limits( params.limits );
+        }
+
+        void start_read( ) override
+        {
+            parent_type::start_read( );
+        }
+
+        void write( const char *data, size_t length ) override
+        {
+            ++queued_;
+            if( !incoming_.push( make_packet( data, length ) ) ) {
+                --queued_;
+                return;
+            }
+
+            if( !flush_posted_.exchange( true ) ) {
+                dispatch( std::bind( &asio_queue::flush_writes, this,
+                                     shared_from_this( ) ) );
+            }
+        }
+
+#if !defined(_WIN32)
+        /// a packet can't overtake the queued ones;
+        /// a tun write doesn't block
+        void write_through( const char *data, size_t length ) override
+        {
+            if( queued_ == 0 && write_queue_depth( ) == 0 ) {
+                auto res = ::write( get_stream( ).native_handle( ),
+                                    data, length );
+                if( res >= 0 || ( errno != EAGAIN && errno != ENOBUFS ) ) {
+                    return;
+                }
+            }
+            write( data, length );
+        }
+#endif
+
+        void close( ) override
+        {
+            parent_type::close( );
+        }
+
+        const char *backend_name( ) const override
+        {
+            return "asio";
+        }
+
+        queue_stat write_queue_stat( ) const override
+        {
+            queue_stat res = parent_type::write_queue_stat( );
+            res.tail_drops += incoming_.drops( );
+            return res;
+        }
+
+    private:
+
+        void flush_writes( shared_type )
+        {
+            /// a producer that comes after this store posts again
+            flush_posted_ = false;
+
+            packet_ptr pkt;
+            while( incoming_.pop( pkt ) ) {
+                write_in_dispatcher( std::move( pkt ) );
+                --queued_;
+            }
+        }
+
+        void on_read( char *data, size_t length ) override
+        {
+            packet_slice pkt { data, length };
+            on_read_batch( &pkt, 1 );
+        }
+
+        void on_read_batch( packet_slice *packets, size_t count ) override
+        {
+            read_call_( packets, count );
+        }
+
+        void on_read_error( const error_code &err ) override
+        {
+            if( error_call_ ) {
+                error_call_( err );
+            }
+        }
+    };
+}
+
+    bool parse_queue_backend( const std::string &name,
+                              queue_params::backend_type &out )
+    {
+        if( name.empty( ) || name == "asio" ) {
+            out = queue_params::BACKEND_ASIO;
+        } else if( name == "uring" ) {
+            out = queue_params::BACKEND_URING;
+        } else if( name == "packet" ) {
+            out = queue_params::BACKEND_PACKET;
+        } else if( name == "thread" ) {
+            out = queue_params::BACKEND_THREAD;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void fill_queue_params( const create_parameters &opts,
+                            queue_params &out )
+    {
+        if( !parse_queue_backend( opts.backend, out.backend ) ) {
+            throw std::runtime_error( "Invalid device backend "
+                                      + opts.backend );
+        }
+
+        if( !parse_aqm_policy( opts.aqm, out.limits.policy ) ) {
+            throw std::runtime_error( "Invalid queue policy " + opts.aqm );
+        }
+
+        out.read_budget           = opts.read_batch;
+        out.limits.max_packets    = opts.queue_packets;
+        out.limits.max_bytes      = opts.queue_bytes;
+        out.limits.codel_target   = opts.codel_target;
+        out.limits.codel_interval = opts.codel_interval;
+        out.cpu                   = opts.cpu;
+        out.busy_poll             = opts.busy_poll;
+    }
+
+    tuntap_queue_sptr create_asio_queue( boost::asio::io_service &ios,
+                                         device_info &hdl,
+                                         const queue_params &params )
+    {
+        auto inst = std::make_shared<asio_queue>( ios, params );
+        inst->get_stream( ).assign( hdl.release( ) );
+        return inst;
+    }
+
+    tuntap_queue_sptr create_queue( boost::asio::io_service &ios,
+                                    device_info &hdl,
+                                    const queue_params &params )
+    {
+        tuntap_queue_sptr res;
+        if( params.backend == queue_params::BACKEND_URING ) {
+            res = create_uring_queue( ios, hdl, params );
+        } else if( params.backend == queue_params::BACKEND_THREAD ) {
+            res = create_thread_queue( ios, hdl, params );
+        }
+        if( !res ) {
+            res = create_asio_queue( ios, hdl, params );
+        }
+        return res;
+    }
+
+#if !defined(__linux__)
+    tuntap_queue_sptr create_uring_queue( boost::asio::io_service &,
+                                          device_info &,
+                                          const queue_params & )
+    {
+        return tuntap_queue_sptr( );
+    }
+
+    tuntap_queue_list create_packet_queues( boost::asio::io_service &,
+                                            const std::string &,
+                                            std::uint32_t,
+                                            const queue_params & )
+    {
+        throw std::runtime_error( "packet backend is supported "
+                                  "on linux only." );
+    }
+#endif
+
+#if defined(_WIN32)
+    tuntap_queue_sptr create_thread_queue( boost::asio::io_service &,
+                                           device_info &,
+                                           const queue_params & )
+    {
+        return tuntap_queue_sptr( );
+    }
+#endif
+
+}}
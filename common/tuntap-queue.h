@@ -0,0 +1,141 @@
+#ifndef TUNTAP_QUEUE_H
+#define TUNTAP_QUEUE_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tuntap.h"
+#include "aqm-queue.h"
+#include "mpsc-ring.h"
+#include "create-params.h"
+
+namespace msctl { namespace common {
+
+    /// one queue (fd) of a tun device;
+    /// hides the way packets are read from and written to the device
+    class tuntap_queue {
+
+    public:
+
+        using error_code = boost::system::error_code;
+        using read_call  = std::function<void (packet_slice *, size_t)>;
+        using error_call = std::function<void (const error_code &)>;
+
+        virtual ~tuntap_queue( ) { }
+
+        virtual void start_read( ) = 0;
+        virtual void write( const char *data, size_t length ) = 0;
+
+        /// writes the packet to the device right from the caller's memory
+        /// if nothing is waiting for the device; otherwise it is the same
+        /// as write( )
+        virtual void write_through( const char *data, size_t length )
+        {
+            write( data, length );
+        }
+        virtual void close( ) = 0;
+
+        virtual const char *backend_name( ) const = 0;
+
+        /// depth and drops of the packets waiting for the device
+        virtual queue_stat write_queue_stat( ) const = 0;
+
+        void write( const std::string &data )
+        {
+            write( data.c_str( ), data.size( ) );
+        }
+
+        /// has to be assigned before start_read
+        void assign_read_call( read_call call )
+        {
+            read_call_ = std::move( call );
+        }
+
+        void assign_error_call( error_call call )
+        {
+            error_call_ = std::move( call );
+        }
+
+    protected:
+
+        read_call   read_call_;
+        error_call  error_call_;
+    };
+
+    using tuntap_queue_sptr = std::shared_ptr<tuntap_queue>;
+    using tuntap_queue_list = std::vector<tuntap_queue_sptr>;
+
+    struct queue_params {
+
+        enum backend_type {
+            BACKEND_ASIO   = 0,
+            BACKEND_URING  = 1,
+            BACKEND_PACKET = 2,
+            BACKEND_THREAD = 3,
+        };
+
+        backend_type  backend     = BACKEND_ASIO;
+        size_t        block_size  = TUN_DEFAULT_BLOCK;
+        size_t        read_budget = 1;
+        queue_limits  limits;
+        int           cpu         = -1; /// thread backend; -1 - not pinned
+        std::uint32_t busy_poll   = 0;  /// microseconds of spinning
+    };
+
+    /// size of the lock-free ring between the writers and the queue;
+    /// bigger than the write queue limit to cover a burst
+    inline size_t incoming_ring_size( const queue_limits &lim )
+    {
+        const size_t min_size = 1024;
+        const size_t max_size = 64 * 1024;
+        const size_t res = lim.max_packets ? lim.max_packets * 2 : max_size;
+        return std::min( std::max( res, min_size ), max_size );
+    }
+
+    /// "" and "asio" -> BACKEND_ASIO; "uring" -> BACKEND_URING;
+    /// "packet" -> BACKEND_PACKET; "thread" -> BACKEND_THREAD
+    bool parse_queue_backend( const std::string &name,
+                              queue_params::backend_type &out );
+
+    /// backend, read budget and write queue limits from the options;
+    /// throws std::runtime_error for an unknown backend or aqm policy
+    void fill_queue_params( const create_parameters &opts,
+                            queue_params &out );
+
+    /// the queue takes the handle;
+    /// uring and thread backends fall back to asio if they can't start
+    tuntap_queue_sptr create_queue( boost::asio::io_service &ios,
+                                    device_info &hdl,
+                                    const queue_params &params );
+
+    tuntap_queue_sptr create_asio_queue( boost::asio::io_service &ios,
+                                         device_info &hdl,
+                                         const queue_params &params );
+
+    /// returns empty pointer if io_uring is not available;
+    /// the handle is not touched in this case
+    tuntap_queue_sptr create_uring_queue( boost::asio::io_service &ios,
+                                          device_info &hdl,
+                                          const queue_params &params );
+
+    /// the device is served by its own thread pinned to params.cpu;
+    /// the thread spins for params.busy_poll microseconds before it
+    /// sleeps. Returns empty pointer if the thread can't be set up;
+    /// the handle is not touched in this case
+    tuntap_queue_sptr create_thread_queue( boost::asio::io_service &ios,
+                                           device_info &hdl,
+                                           const queue_params &params );
+
+    /// AF_PACKET TPACKET_V3 rings on an existing ethernet interface
+    /// instead of a tun device (linux only); count sockets are joined
+    /// into one fanout group. Throws std::runtime_error
+    tuntap_queue_list create_packet_queues( boost::asio::io_service &ios,
+                                            const std::string &iface,
+                                            std::uint32_t count,
+                                            const queue_params &params );
+
+}}
+
+#endif // TUNTAP_QUEUE_H
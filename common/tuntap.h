@@ -1,7 +1,9 @@
 #ifndef TUNTAP_H
 #define TUNTAP_H
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include "async-transport-point.hpp"
 #include "boost/asio/ip/address_v4.hpp"
 #include "boost/asio/ip/address_v6.hpp"
@@ -16,6 +18,8 @@ namespace msctl { namespace common {
 
 #ifndef _WIN32
 
+    using packet_slice = async_transport::packet_slice;
+
     using stream_type = boost::asio::posix::stream_descriptor;
     using tuntap_transport = async_transport::point_iface<stream_type>;
     using native_handle = stream_type::native_handle_type;
@@ -23,6 +27,8 @@ namespace msctl { namespace common {
 
 #else
 
+    using packet_slice = async_transport::packet_slice;
+
     using stream_type = boost::asio::windows::stream_handle;
     using tuntap_transport = async_transport::point_iface<stream_type>;
     using native_handle = stream_type::native_handle_type;
@@ -112,9 +118,51 @@ namespace msctl { namespace common {
         }
     };
 
+    using device_info_list = std::vector<device_info>;
+
+    /// sizeof(virtio_net_hdr); every packet starts with it in vnet mode
+    static const size_t TUN_VNET_HDR_SIZE = 10;
+
+    /// max size of a GSO super-packet
+    static const size_t TUN_GSO_MAX_SIZE  = 64 * 1024;
+
+    /// read block for a device that keeps its own MTU
+    static const size_t TUN_DEFAULT_BLOCK = 2048;
+
+    /// MTU range for a device; 65535 is the biggest IP packet
+    static const std::uint32_t TUN_MTU_MIN = 68;
+    static const std::uint32_t TUN_MTU_MAX = 65535;
+
+    struct open_params {
+        /// number of queues (fds) for the device;
+        /// more than 1 requires IFF_MULTI_QUEUE support (linux only)
+        std::uint32_t queues   = 1;
+
+        /// IFF_VNET_HDR + TSO4/TSO6/CSUM offloads (linux only);
+        /// the device reads and writes GSO super-packets
+        bool          vnet_hdr = false;
+
+        /// MTU for the device; 0 - keep the current one
+        std::uint32_t mtu      = 0;
+    };
+
+    /// read block that fits one packet (or super-packet) of the device
+    inline
+    size_t tun_block_size( const open_params &params )
+    {
+        if( params.vnet_hdr ) {
+            return TUN_VNET_HDR_SIZE + TUN_GSO_MAX_SIZE;
+        }
+        return params.mtu ? std::max<size_t>( params.mtu, TUN_MTU_MIN )
+                          : TUN_DEFAULT_BLOCK;
+    }
+
     int device_up( const std::string &name );
+    int set_mtu( const std::string &name, std::uint32_t mtu );
 
     device_info open_tun( const std::string &hint_name );
+    device_info_list open_tun( const std::string &hint_name,
+                               const open_params &params );
     int del_tun( const std::string &name );
     void setup_device( native_handle device,
                        const std::string &name,
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "udp-batch.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#endif
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define MSCTL_UDP_OFFLOAD 1
+#endif
+
+namespace msctl { namespace common {
+
+namespace {
+
+#if defined(_WIN32)
+    using addr_len = int;
+#else
+    using addr_len = socklen_t;
+#endif
+
+    bool would_block( )
+    {
+#if defined(_WIN32)
+        return WSAGetLastError( ) == WSAEWOULDBLOCK;
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+    }
+
+#if defined(__linux__)
+
+#if defined(MSCTL_UDP_OFFLOAD)
+    /// UDP_SEGMENT sends a short, UDP_GRO gives an int
+    const size_t control_size = CMSG_SPACE(sizeof(int));
+#else
+    const size_t control_size = 0;
+#endif
+
+    struct mmsg_batch {
+
+        mmsghdr msgs[udp_batch_max];
+        iovec   iovs[udp_batch_max];
+        alignas(cmsghdr)
+        char    controls[udp_batch_max][control_size ? control_size : 1];
+
+        /// the buffers and the addresses of the datagrams
+        unsigned fill( const udp_datagram *dgs, size_t count )
+        {
+            const size_t n = std::min( count, udp_batch_max );
+            for( size_t i = 0; i < n; ++i ) {
+                auto &d(const_cast<udp_datagram &>(dgs[i]));
+                iovs[i].iov_base = d.data;
+                iovs[i].iov_len  = d.len;
+
+                msghdr &h(msgs[i].msg_hdr);
+                h.msg_name       = d.peer.data( );
+                h.msg_namelen    = static_cast<addr_len>(d.peer.capacity( ));
+                h.msg_iov        = &iovs[i];
+                h.msg_iovlen     = 1;
+                h.msg_control    = nullptr;
+                h.msg_controllen = 0;
+                h.msg_flags      = 0;
+                msgs[i].msg_len  = 0;
+            }
+            return static_cast<unsigned>(n);
+        }
+
+#if defined(MSCTL_UDP_OFFLOAD)
+
+        /// room for the segment of a GRO train
+        void expect_segment( unsigned i )
+        {
+            msghdr &h(msgs[i].msg_hdr);
+            h.msg_control    = controls[i];
+            h.msg_controllen = control_size;
+        }
+
+        /// 0 - not a train
+        size_t read_segment( unsigned i )
+        {
+            msghdr &h(msgs[i].msg_hdr);
+            for( cmsghdr *cm = CMSG_FIRSTHDR( &h ); cm;
+                 cm = CMSG_NXTHDR( &h, cm ) )
+            {
+                if( cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO ) {
+                    int value = 0;
+                    memcpy( &value, CMSG_DATA(cm), sizeof(value) );
+                    return value > 0 ? static_cast<size_t>(value) : 0;
+                }
+            }
+            return 0;
+        }
+
+        /// the message is a train of UDP_SEGMENT
+        void set_segment( unsigned i, size_t segment )
+        {
+            msghdr &h(msgs[i].msg_hdr);
+            memset( controls[i], 0, control_size );
+            h.msg_control    = controls[i];
+            h.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t));
+
+            cmsghdr *cm    = CMSG_FIRSTHDR( &h );
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type  = UDP_SEGMENT;
+            cm->cmsg_len   = CMSG_LEN(sizeof(std::uint16_t));
+            const auto seg = static_cast<std::uint16_t>(segment);
+            memcpy( CMSG_DATA(cm), &seg, sizeof(seg) );
+        }
+#endif
+    };
+
+#else
+
+    /// the result of a loop: what is done or the error of the first one
+    int loop_result( size_t done )
+    {
+        if( done ) {
+            return static_cast<int>(done);
+        }
+        return would_block( ) ? 0 : -1;
+    }
+
+#endif
+
+}
+
+    int udp_recv_batch( udp_handle hdl, udp_datagram *dgs, size_t count )
+    {
+#if defined(__linux__)
+        mmsg_batch batch;
+        const unsigned n = batch.fill( dgs, count );
+#if defined(MSCTL_UDP_OFFLOAD)
+        for( unsigned i = 0; i < n; ++i ) {
+            batch.expect_segment( i );
+        }
+#endif
+
+        const int res = recvmmsg( hdl, batch.msgs, n, 0, nullptr );
+        if( res < 0 ) {
+            return would_block( ) ? 0 : -1;
+        }
+
+        for( int i = 0; i < res; ++i ) {
+            dgs[i].len = batch.msgs[i].msg_len;
+            dgs[i].peer.resize( batch.msgs[i].msg_hdr.msg_namelen );
+#if defined(MSCTL_UDP_OFFLOAD)
+            const size_t segment = batch.read_segment( i );
+            dgs[i].segment = segment < dgs[i].len ? segment : 0;
+#else
+            dgs[i].segment = 0;
+#endif
+        }
+        return res;
+#else
+        size_t done = 0;
+        for( ; done < count; ++done ) {
+            auto &d(dgs[done]);
+            auto alen = static_cast<addr_len>(d.peer.capacity( ));
+            const auto res = recvfrom( hdl, d.data,
+                                       static_cast<int>(d.len), 0,
+                                       d.peer.data( ), &alen );
+            if( res < 0 ) {
+                break;
+            }
+            d.len     = static_cast<size_t>(res);
+            d.segment = 0;
+            d.peer.resize( static_cast<size_t>(alen) );
+        }
+        return loop_result( done );
+#endif
+    }
+
+    int udp_send_batch( udp_handle hdl, const udp_datagram *dgs,
+                        size_t count )
+    {
+#if defined(__linux__)
+        mmsg_batch batch;
+        const unsigned n = batch.fill( dgs, count );
+        for( unsigned i = 0; i < n; ++i ) {
+            batch.msgs[i].msg_hdr.msg_namelen =
+                    static_cast<addr_len>(dgs[i].peer.size( ));
+#if defined(MSCTL_UDP_OFFLOAD)
+            if( dgs[i].segment && dgs[i].segment < dgs[i].len ) {
+                batch.set_segment( i, dgs[i].segment );
+            }
+#endif
+        }
+
+        const int res = sendmmsg( hdl, batch.msgs, n, 0 );
+        if( res < 0 ) {
+            return would_block( ) ? 0 : -1;
+        }
+        return res;
+#else
+        size_t done = 0;
+        for( ; done < count; ++done ) {
+            auto &d(dgs[done]);
+            const auto res = sendto( hdl, d.data,
+                                     static_cast<int>(d.len), 0,
+                                     d.peer.data( ),
+                                     static_cast<addr_len>(d.peer.size( )) );
+            if( res < 0 ) {
+                break;
+            }
+        }
+        return loop_result( done );
+#endif
+    }
+
+    bool udp_batch_native( )
+    {
+#if defined(__linux__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool udp_set_gro( udp_handle hdl, bool value )
+    {
+#if defined(MSCTL_UDP_OFFLOAD)
+        int opt = value ? 1 : 0;
+        return setsockopt( hdl, SOL_UDP, UDP_GRO, &opt, sizeof(opt) ) == 0;
+#else
+        (void)hdl;
+        return !value;
+#endif
+    }
+
+    bool udp_offload_native( )
+    {
+#if defined(MSCTL_UDP_OFFLOAD)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+}}
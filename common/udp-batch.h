@@ -0,0 +1,55 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <cstddef>
+
+#include "boost/asio/ip/udp.hpp"
+
+namespace msctl { namespace common {
+
+    /// datagrams of one call; recvmmsg and sendmmsg take up to 1024
+    static const size_t udp_batch_max = 64;
+
+    using udp_handle   = boost::asio::ip::udp::socket::native_handle_type;
+    using udp_endpoint = boost::asio::ip::udp::endpoint;
+
+    struct udp_datagram {
+        char         *data    = nullptr;
+        size_t        len     = 0;  /// the buffer size for reading;
+                                    /// the datagram length after it
+        udp_endpoint  peer;         /// the source or the destination
+        size_t        segment = 0;  /// a train: the size of every
+                                    /// datagram in it but the last one;
+                                    /// 0 - one datagram
+    };
+
+    /// many datagrams with one system call: recvmmsg and sendmmsg on
+    /// linux, a loop of recvfrom and sendto on the other systems.
+    /// The socket has to be non-blocking; the calls return the number
+    /// of entries done, 0 if the socket is not ready, -1 for an error
+    /// of the first entry (errno or WSAGetLastError has it)
+    int udp_recv_batch( udp_handle hdl, udp_datagram *dgs, size_t count );
+    int udp_send_batch( udp_handle hdl, const udp_datagram *dgs,
+                        size_t count );
+
+    /// the calls are real batches, not loops
+    bool udp_batch_native( );
+
+    /// segmentation offload: a train of datagrams of the same size to
+    /// one peer goes to the kernel as one buffer; the last one can be
+    /// shorter. Up to udp_train_max datagrams and 64K of data.
+    /// udp_send_batch sends an entry with a segment as a train with
+    /// UDP_SEGMENT; after udp_set_gro udp_recv_batch gives trains and
+    /// their segments. Trains need udp_offload_native( )
+    static const size_t udp_train_max = 64;
+
+    /// UDP_GRO; the kernel gives trains of datagrams to the socket.
+    /// Returns false if the system doesn't have it
+    bool udp_set_gro( udp_handle hdl, bool value );
+
+    /// the system has UDP_SEGMENT and UDP_GRO
+    bool udp_offload_native( );
+
+}}
+
+#endif // UDP_BATCH_H
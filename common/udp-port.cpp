@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "udp-port.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <errno.h>
+#endif
+
+namespace msctl { namespace common {
+
+namespace {
+
+    namespace ba = boost::asio;
+    namespace ph = std::placeholders;
+
+    /// reads of one readiness; the other sockets get the thread then
+    const size_t READ_ROUNDS = 4;
+
+    /// a GRO train fits it; a GSO train is an IPv4 datagram at most
+    const size_t TRAIN_BUFFER = 64 * 1024;
+    const size_t TRAIN_BYTES  = 65507;
+
+    /// trains of one call; a read with GRO has a buffer for each of them
+    const size_t TRAIN_SLOTS  = 8;
+
+    udp_port::error_code last_error( )
+    {
+#if defined(_WIN32)
+        const int code = WSAGetLastError( );
+#else
+        const int code = errno;
+#endif
+        return udp_port::error_code( code,
+                                     boost::system::system_category( ) );
+    }
+
+    /// the kernel doesn't take trains: the device has no checksum
+    /// offload or a segment is bigger than the MTU
+    bool train_refused( const udp_port::error_code &err )
+    {
+        namespace errc = boost::system::errc;
+        return err == errc::io_error || err == errc::invalid_argument;
+    }
+}
+
+    udp_port::udp_port( ba::io_service &ios, const udp_port_params &params )
+        :ios_(ios)
+        ,dispatcher_(ios)
+        ,socket_(ios)
+        ,batch_(std::max<size_t>( 1, std::min( params.batch,
+                                               udp_batch_max ) ))
+        ,buffer_(params.buffer)
+        ,in_(batch_)
+        ,flush_posted_(false)
+        ,read_calls_(0)
+        ,datagrams_in_(0)
+        ,write_calls_(0)
+        ,datagrams_out_(0)
+        ,write_errors_(0)
+        ,trains_in_(0)
+        ,trains_out_(0)
+    {
+        if( params.offload && udp_offload_native( ) ) {
+            gso_ = true;
+            train_.resize( TRAIN_BUFFER * TRAIN_SLOTS );
+        }
+    }
+
+    std::shared_ptr<udp_port> udp_port::create( ba::io_service &ios,
+                                          const udp_port_params &params )
+    {
+        return std::make_shared<udp_port>( std::ref(ios), params );
+    }
+
+    void udp_port::open( const udp_endpoint &local )
+    {
+        socket_.open( local.protocol( ) );
+        socket_.bind( local );
+        socket_.non_blocking( true );
+        if( gso_ ) {
+            gro_ = udp_set_gro( socket_.native_handle( ), true );
+        }
+
+        /// a read slot takes a train with GRO
+        if( gro_ ) {
+            read_slots_ = std::min( batch_, TRAIN_SLOTS );
+            read_size_  = TRAIN_BUFFER;
+        } else {
+            read_slots_ = batch_;
+            read_size_  = buffer_;
+        }
+        memory_.resize( read_slots_ * read_size_ );
+    }
+
+    void udp_port::start_read( )
+    {
+        dispatcher_.post( std::bind( &this_type::start_read_impl, this,
+                                     shared_from_this( ) ) );
+    }
+
+    void udp_port::write( const udp_endpoint &peer, const char *data,
+                          size_t len, write_done done )
+    {
+        {
+            std::lock_guard<std::mutex> lck(out_lock_);
+            out_.push_back( out_datagram { peer, data, len,
+                                           std::move( done ) } );
+        }
+
+        if( !flush_posted_.exchange( true ) ) {
+            dispatcher_.post( std::bind( &this_type::flush, this,
+                                         shared_from_this( ) ) );
+        }
+    }
+
+    void udp_port::close( )
+    {
+        dispatcher_.post( std::bind( &this_type::close_impl, this,
+                                     shared_from_this( ) ) );
+    }
+
+    udp_endpoint udp_port::local_endpoint( ) const
+    {
+        error_code ec;
+        return socket_.local_endpoint( ec );
+    }
+
+    udp_port_stat udp_port::stat( ) const
+    {
+        udp_port_stat res;
+        res.read_calls    = read_calls_;
+        res.datagrams_in  = datagrams_in_;
+        res.write_calls   = write_calls_;
+        res.datagrams_out = datagrams_out_;
+        res.write_errors  = write_errors_;
+        res.trains_in     = trains_in_;
+        res.trains_out    = trains_out_;
+        return res;
+    }
+
+    /// ================ read ================ ///
+
+    void udp_port::start_read_impl( shared_type )
+    {
+        wait_read( );
+    }
+
+    void udp_port::wait_read( )
+    {
+        socket_.async_receive( ba::null_buffers( ),
+            dispatcher_.wrap(
+                std::bind( &this_type::on_readable, this,
+                           ph::_1, shared_from_this( ) ) ) );
+    }
+
+    void udp_port::on_readable( const error_code &err, shared_type )
+    {
+        if( err ) {
+            return;
+        }
+
+        read_batches( );
+
+        if( socket_.is_open( ) ) {
+            wait_read( );
+        }
+    }
+
+    void udp_port::read_batches( )
+    {
+        for( size_t round = 0; round < READ_ROUNDS; ++round ) {
+
+            for( size_t i = 0; i < read_slots_; ++i ) {
+                in_[i].data = &memory_[i * read_size_];
+                in_[i].len  = read_size_;
+            }
+
+            const int res = udp_recv_batch( socket_.native_handle( ),
+                                            &in_[0], read_slots_ );
+            if( res <= 0 ) {
+                break;
+            }
+
+            ++read_calls_;
+            deliver( static_cast<size_t>(res) );
+
+            if( static_cast<size_t>(res) < read_slots_ ) {
+                break;
+            }
+        }
+    }
+
+    /// the trains of GRO go to the read call as their datagrams
+    void udp_port::deliver( size_t count )
+    {
+        const udp_datagram *list = &in_[0];
+
+        if( gro_ ) {
+            split_.clear( );
+            for( size_t i = 0; i < count; ++i ) {
+                split_train( in_[i] );
+            }
+            list  = &split_[0];
+            count = split_.size( );
+        }
+
+        datagrams_in_ += count;
+        if( read_call_ ) {
+            read_call_( list, count );
+        }
+    }
+
+    void udp_port::split_train( const udp_datagram &train )
+    {
+        if( train.segment == 0 ) {
+            split_.push_back( train );
+            return;
+        }
+
+        ++trains_in_;
+        for( size_t pos = 0; pos < train.len; pos += train.segment ) {
+            udp_datagram dg;
+            dg.data = train.data + pos;
+            dg.len  = std::min( train.segment, train.len - pos );
+            dg.peer = train.peer;
+            split_.push_back( dg );
+        }
+    }
+
+    /// ================ write ================ ///
+
+    void udp_port::flush( shared_type )
+    {
+        /// a producer that comes after this store posts again
+        flush_posted_ = false;
+        {
+            std::lock_guard<std::mutex> lck(out_lock_);
+            std::move( out_.begin( ), out_.end( ),
+                       std::back_inserter( sending_ ) );
+            out_.clear( );
+        }
+
+        if( !wait_send_ ) {
+            send_pending( );
+        }
+    }
+
+    void udp_port::send_pending( )
+    {
+        if( !socket_.is_open( ) ) {
+            complete( sending_.size( ), ba::error::operation_aborted );
+            return;
+        }
+
+        while( !sending_.empty( ) ) {
+
+            const size_t count = fill_send_list( );
+            const int res = udp_send_batch( socket_.native_handle( ),
+                                            &send_list_[0], count );
+            if( res > 0 ) {
+                size_t done = 0;
+                for( int i = 0; i < res; ++i ) {
+                    done += send_counts_[i];
+                    if( send_counts_[i] > 1 ) {
+                        ++trains_out_;
+                    }
+                }
+                ++write_calls_;
+                datagrams_out_ += done;
+                complete( done, error_code( ) );
+            } else if( res == 0 ) {
+                wait_write( );
+                return;
+            } else {
+                const error_code err = last_error( );
+                if( send_counts_[0] > 1 && train_refused( err ) ) {
+                    /// the datagrams go one by one in the batches now
+                    gso_ = false;
+                    continue;
+                }
+                /// the first one goes with its error, the others try again
+                ++write_errors_;
+                complete( send_counts_[0], err );
+            }
+        }
+    }
+
+    /// up to batch_ entries from the head of the list; the datagrams of
+    /// a train are copied to train_ and go as one entry
+    size_t udp_port::fill_send_list( )
+    {
+        send_list_.clear( );
+        send_counts_.clear( );
+
+        size_t next = 0;    /// in sending_
+        size_t used = 0;    /// of train_
+        while( send_list_.size( ) < batch_ && next < sending_.size( ) ) {
+
+            const auto &first(sending_[next]);
+
+            size_t bytes = 0;
+            const size_t train = gso_ ? train_length( next, bytes ) : 1;
+            if( train > 1 && used + bytes > train_.size( ) ) {
+                break;
+            }
+
+            udp_datagram dg;
+            dg.peer = first.peer;
+            if( train > 1 ) {
+                dg.data    = &train_[used];
+                dg.len     = bytes;
+                dg.segment = first.len;
+                for( size_t i = next; i < next + train; ++i ) {
+                    memcpy( &train_[used], sending_[i].data,
+                            sending_[i].len );
+                    used += sending_[i].len;
+                }
+            } else {
+                /// sendmmsg takes iovec; the data is only read
+                dg.data = const_cast<char *>(first.data);
+                dg.len  = first.len;
+            }
+
+            send_list_.push_back( dg );
+            send_counts_.push_back( train );
+            next += train;
+        }
+        return send_list_.size( );
+    }
+
+    /// the datagrams from start that make a train: one peer, the size
+    /// of the first one; the last one can be shorter
+    size_t udp_port::train_length( size_t start, size_t &bytes ) const
+    {
+        const auto  &first(sending_[start]);
+        const size_t segment = first.len;
+        const size_t limit   = std::min( sending_.size( ) - start,
+                                         udp_train_max );
+
+        bytes = segment;
+        size_t count = 1;
+        while( count < limit ) {
+            const auto &next(sending_[start + count]);
+            if( next.len > segment || next.len == 0
+             || bytes + next.len > TRAIN_BYTES
+             || !( next.peer == first.peer ) )
+            {
+                break;
+            }
+            bytes += next.len;
+            ++count;
+            if( next.len < segment ) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    /// POLLOUT: the socket buffer has room again
+    void udp_port::wait_write( )
+    {
+        wait_send_ = true;
+        socket_.async_send( ba::null_buffers( ),
+            dispatcher_.wrap(
+                std::bind( &this_type::on_writable, this,
+                           ph::_1, shared_from_this( ) ) ) );
+    }
+
+    void udp_port::on_writable( const error_code &err, shared_type )
+    {
+        wait_send_ = false;
+        if( err ) {
+            complete( sending_.size( ), err );
+            return;
+        }
+        send_pending( );
+    }
+
+    void udp_port::complete( size_t count, const error_code &err )
+    {
+        /// the callbacks can write again; they see the list without these
+        std::vector<out_datagram> done;
+        done.reserve( count );
+        std::move( sending_.begin( ), sending_.begin( ) + count,
+                   std::back_inserter( done ) );
+        sending_.erase( sending_.begin( ), sending_.begin( ) + count );
+
+        for( auto &d: done ) {
+            if( d.done ) {
+                d.done( err );
+            }
+        }
+    }
+
+    void udp_port::close_impl( shared_type )
+    {
+        error_code ec;
+        socket_.close( ec );
+    }
+
+}}
@@ -0,0 +1,149 @@
+#ifndef UDP_PORT_H
+#define UDP_PORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "boost/asio.hpp"
+
+#include "udp-batch.h"
+
+namespace msctl { namespace common {
+
+    struct udp_port_params {
+        size_t batch   = udp_batch_max; /// datagrams of one system call
+        size_t buffer  = 64 * 1024;     /// the biggest datagram read
+        bool   offload = false;         /// UDP_SEGMENT and UDP_GRO
+    };
+
+    struct udp_port_stat {
+        std::uint64_t read_calls    = 0;
+        std::uint64_t datagrams_in  = 0;
+        std::uint64_t write_calls   = 0;
+        std::uint64_t datagrams_out = 0;
+        std::uint64_t write_errors  = 0;
+        std::uint64_t trains_in     = 0;    /// GRO reads of many datagrams
+        std::uint64_t trains_out    = 0;    /// GSO writes
+    };
+
+    /// a UDP socket of the agent itself; datagrams of many peers are read
+    /// with one recvmmsg and written with one sendmmsg. write( ) can be
+    /// called from any thread; the socket is used on the strand only and
+    /// the datagrams written meanwhile go with the next call.
+    /// With offload the datagrams of one size to one peer that are
+    /// written one after another go as a GSO train, an entry of the same
+    /// sendmmsg; recvmmsg gives trains of GRO that are cut back into
+    /// datagrams. A train the kernel doesn't take turns GSO off
+    class udp_port: public std::enable_shared_from_this<udp_port> {
+
+    public:
+
+        using error_code = boost::system::error_code;
+        using read_call  = std::function<void (const udp_datagram *,
+                                               size_t)>;
+        using write_done = std::function<void (const error_code &)>;
+
+    private:
+
+        using this_type   = udp_port;
+        using shared_type = std::shared_ptr<this_type>;
+
+        struct out_datagram {
+            udp_endpoint  peer;
+            const char   *data;
+            size_t        len;
+            write_done    done;
+        };
+
+        using counter_type = std::atomic<std::uint64_t>;
+
+        boost::asio::io_service            &ios_;
+        boost::asio::io_service::strand     dispatcher_;
+        boost::asio::ip::udp::socket        socket_;
+
+        size_t                              batch_;
+        size_t                              buffer_;
+        size_t                              read_slots_ = 0;
+        size_t                              read_size_  = 0;
+        std::vector<char>                   memory_;
+        std::vector<udp_datagram>           in_;
+        std::vector<udp_datagram>           split_;     /// GRO datagrams
+        read_call                           read_call_;
+
+        std::mutex                          out_lock_;
+        std::vector<out_datagram>           out_;       /// under out_lock_
+        std::atomic<bool>                   flush_posted_;
+        bool                                wait_send_ = false;
+        std::vector<out_datagram>           sending_;   /// the strand's
+        std::vector<udp_datagram>           send_list_;
+        std::vector<size_t>                 send_counts_; /// datagrams
+
+        bool                                gso_ = false;
+        bool                                gro_ = false;
+        std::vector<char>                   train_;     /// GSO trains
+
+        counter_type                        read_calls_;
+        counter_type                        datagrams_in_;
+        counter_type                        write_calls_;
+        counter_type                        datagrams_out_;
+        counter_type                        write_errors_;
+        counter_type                        trains_in_;
+        counter_type                        trains_out_;
+
+        void start_read_impl( shared_type );
+        void wait_read( );
+        void on_readable( const error_code &err, shared_type );
+        void read_batches( );
+        void deliver( size_t count );
+        void split_train( const udp_datagram &train );
+
+        void flush( shared_type );
+        void send_pending( );
+        size_t fill_send_list( );
+        size_t train_length( size_t start, size_t &bytes ) const;
+        void wait_write( );
+        void on_writable( const error_code &err, shared_type );
+        void complete( size_t count, const error_code &err );
+
+        void close_impl( shared_type );
+
+    public:
+
+        udp_port( boost::asio::io_service &ios,
+                  const udp_port_params &params );
+
+        static std::shared_ptr<udp_port> create(
+                                        boost::asio::io_service &ios,
+                                        const udp_port_params &params );
+
+        /// the socket is bound to local; throws boost::system::system_error
+        void open( const udp_endpoint &local );
+
+        /// has to be assigned before start_read
+        void assign_read_call( read_call call )
+        {
+            read_call_ = std::move( call );
+        }
+
+        void start_read( );
+
+        /// the datagram is written later, data has to live until done
+        void write( const udp_endpoint &peer, const char *data, size_t len,
+                    write_done done );
+
+        void close( );
+
+        udp_endpoint local_endpoint( ) const;
+
+        udp_port_stat stat( ) const;
+    };
+
+    using udp_port_sptr = std::shared_ptr<udp_port>;
+
+}}
+
+#endif // UDP_PORT_H
@@ -26,6 +26,7 @@ namespace utilities {
 
         namespace v4 {
             bool is_multicast(std::uint32_t addr );
+            bool is_broadcast(std::uint32_t addr );
         }
 
     }
@@ -0,0 +1,80 @@
+#ifndef WRITE_STAT_H
+#define WRITE_STAT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace msctl { namespace common {
+
+    /// writes of one connection to its socket
+    struct write_stat {
+
+        std::uint64_t writes = 0;   /// calls of the transport write
+        std::uint64_t frames = 0;   /// frames in them
+        std::uint64_t bytes  = 0;
+        std::uint64_t corked = 0;   /// writes of more than one frame
+        std::uint64_t drops  = 0;   /// frames that couldn't be written
+
+        double frames_per_write( ) const
+        {
+            return writes ? double(frames) / double(writes) : 0.0;
+        }
+    };
+
+    /// can be changed by all the writers of a connection
+    class write_counters {
+
+        using counter_type = std::atomic<std::uint64_t>;
+
+        counter_type writes_;
+        counter_type frames_;
+        counter_type bytes_;
+        counter_type corked_;
+        counter_type drops_;
+
+        static void add( counter_type &cnt, std::uint64_t value )
+        {
+            cnt.fetch_add( value, std::memory_order_relaxed );
+        }
+
+    public:
+
+        write_counters( )
+            :writes_(0)
+            ,frames_(0)
+            ,bytes_(0)
+            ,corked_(0)
+            ,drops_(0)
+        { }
+
+        void add_write( size_t frames, size_t bytes )
+        {
+            add( writes_, 1 );
+            add( frames_, frames );
+            add( bytes_,  bytes );
+            if( frames > 1 ) {
+                add( corked_, 1 );
+            }
+        }
+
+        void add_drop( )
+        {
+            add( drops_, 1 );
+        }
+
+        write_stat stat( ) const
+        {
+            write_stat res;
+            res.writes = writes_.load( std::memory_order_relaxed );
+            res.frames = frames_.load( std::memory_order_relaxed );
+            res.bytes  = bytes_.load( std::memory_order_relaxed );
+            res.corked = corked_.load( std::memory_order_relaxed );
+            res.drops  = drops_.load( std::memory_order_relaxed );
+            return res;
+        }
+    };
+
+}}
+
+#endif // WRITE_STAT_H